@@ -15,6 +15,12 @@ static bool cl_act_no_process(cl_action_t *action)
 
 bool cl_free_action(cl_action_t *action)
 {
+  unsigned i;
+
+  /* Memory notes only this action used no longer need to be updated */
+  for (i = 0; i < CL_ACTION_OPERANDS; i++)
+    cl_memnote_unref(action->operands[i].memnote);
+
   action->argument_count = 0;
   free(action->arguments);
   action->arguments = NULL;
@@ -23,97 +29,18 @@ bool cl_free_action(cl_action_t *action)
 
   action->prev_action = NULL;
   action->next_action = NULL;
+  memset(action->operands, 0, sizeof(action->operands));
+  script.freed_actions++;
 
   return false;
 }
 
-/**
- * @brief Returns a copy of a counter's data. Used in cases where the requested
- *   counter should not be directly mutated.
- * @param source The source type of the requested counter.
- * @param offset An address or index relevant to the source type. For example,
- *   a memory note or counter index, or a memory address.
- * @return A mutable counter, or return CL_CTR_INVALID if unavailable.
- **/
-static cl_counter_t cl_get_compare_value(cl_src_t source, int64_t offset)
-{
-  cl_counter_t counter;
-
-  switch (source)
-  {
-  case CL_SRCTYPE_IMMEDIATE_INT:
-    counter.type = CL_MEMTYPE_INT64;
-    cl_ctr_store(&counter, &offset, CL_MEMTYPE_INT64);
-    break;
-  case CL_SRCTYPE_IMMEDIATE_FLOAT:
-    counter.type = CL_MEMTYPE_DOUBLE;
-    cl_ctr_store(&counter, &offset, CL_MEMTYPE_DOUBLE);
-    break;
-  case CL_SRCTYPE_CURRENT_RAM:
-  case CL_SRCTYPE_PREVIOUS_RAM:
-  case CL_SRCTYPE_LAST_UNIQUE_RAM:
-  {
-    cl_memnote_t *memnote = cl_find_memnote((unsigned)offset);
-
-    if (source == CL_SRCTYPE_CURRENT_RAM)
-      counter = memnote->current;
-    else if (source == CL_SRCTYPE_PREVIOUS_RAM)
-      counter = memnote->previous;
-    else /* if (source == CL_SRCTYPE_LAST_UNIQUE_RAM) warning silence */
-      counter = memnote->last_unique;
-
-    break;
-  }
-  case CL_SRCTYPE_COUNTER:
-    if (offset < CL_COUNTERS_SIZE && offset >= 0)
-      counter = script.current_page->counters[offset];
-    else
-      counter.type = CL_MEMTYPE_NOT_SET;
-    break;
-  case CL_SRCTYPE_ROM: /* TODO */
-  default:
-    counter.type = CL_MEMTYPE_NOT_SET;
-  }
-
-  return counter;
-}
-
-/**
- * Returns a pointer to a counter that can be mutated. Currently, this only
- *   includes the counters stored within script pages.
- * @param source The source type of the requested counter.
- * @param offset An address or index relevant to the source type.
- * @return A mutable counter, or NULL if unavailable.
- **/
-static cl_counter_t *cl_get_mutable_value(cl_src_t source, int64_t offset)
-{
-  switch (source)
-  {
-  case CL_SRCTYPE_COUNTER:
-    if (offset < CL_COUNTERS_SIZE && offset >= 0)
-      return &script.current_page->counters[offset];
-    else
-      return NULL;
-  case CL_SRCTYPE_IMMEDIATE_INT:
-  case CL_SRCTYPE_IMMEDIATE_FLOAT:
-  case CL_SRCTYPE_CURRENT_RAM:
-  case CL_SRCTYPE_PREVIOUS_RAM:
-  case CL_SRCTYPE_LAST_UNIQUE_RAM:
-  case CL_SRCTYPE_ROM:
-  default:
-    return NULL;
-  }
-
-  return NULL;
-}
-
 static bool cl_act_post_achievement(cl_action_t *action)
 {
-  cl_counter_t ach_id = cl_get_compare_value(action->arguments[0].uintval,
-                                             action->arguments[1].uintval);
+  const cl_counter_t *ach_id = action->operands[0].counter;
   char data[CL_POST_DATA_SIZE];
 
-  snprintf(data, CL_POST_DATA_SIZE, "ach_id=%llu", ach_id.intval.i64);
+  snprintf(data, CL_POST_DATA_SIZE, "ach_id=%llu", cl_ctr_get_int(ach_id));
   cl_network_post(CL_REQUEST_POST_ACHIEVEMENT, data, NULL);
 
   /* Clear this action so we don't re-submit the achievement */
@@ -136,11 +63,10 @@ static bool cl_act_post_progress(cl_action_t *action)
 /** @todo Support optional values */
 static bool cl_act_post_leaderboard(cl_action_t *action)
 {
-  cl_counter_t ldb_id = cl_get_compare_value(action->arguments[0].uintval,
-                                             action->arguments[1].uintval);
+  const cl_counter_t *ldb_id = action->operands[0].counter;
   char data[CL_POST_DATA_SIZE];
 
-  snprintf(data, CL_POST_DATA_SIZE, "ldb_id=%llu", ldb_id.intval.i64);
+  snprintf(data, CL_POST_DATA_SIZE, "ldb_id=%llu", cl_ctr_get_int(ldb_id));
   cl_network_post(CL_REQUEST_POST_LEADERBOARD, data, NULL);
    
   return true;
@@ -148,22 +74,22 @@ static bool cl_act_post_leaderboard(cl_action_t *action)
 
 static bool cl_act_compare(cl_action_t *action)
 {
-  cl_counter_t left = cl_get_compare_value(action->arguments[0].uintval, action->arguments[1].uintval);
-  cl_counter_t right = cl_get_compare_value(action->arguments[2].uintval, action->arguments[3].uintval);
+  const cl_counter_t *left = action->operands[0].counter;
+  const cl_counter_t *right = action->operands[1].counter;
 
-  if (left.type == CL_MEMTYPE_NOT_SET || right.type == CL_MEMTYPE_NOT_SET)
+  if (left->type == CL_MEMTYPE_NOT_SET || right->type == CL_MEMTYPE_NOT_SET)
     return cl_free_action(action);
 
   switch (action->arguments[4].intval)
   {
     case CL_CMPTYPE_IFEQUAL:
-      return cl_ctr_equal(&left, &right);
+      return cl_ctr_equal(left, right);
     case CL_CMPTYPE_IFGREATER:
-      return cl_ctr_greater(&left, &right);
+      return cl_ctr_greater(left, right);
     case CL_CMPTYPE_IFLESS:
-      return cl_ctr_lesser(&left, &right);
+      return cl_ctr_lesser(left, right);
     case CL_CMPTYPE_IFNEQUAL:
-      return cl_ctr_not_equal(&left, &right);
+      return cl_ctr_not_equal(left, right);
     default:
       return cl_free_action(action);
   }
@@ -171,54 +97,42 @@ static bool cl_act_compare(cl_action_t *action)
 
 static bool cl_act_changed(cl_action_t *action)
 {
-  cl_counter_t left = cl_get_compare_value(CL_SRCTYPE_CURRENT_RAM, action->arguments[0].uintval);
-  cl_counter_t right = cl_get_compare_value(CL_SRCTYPE_PREVIOUS_RAM, action->arguments[0].uintval);
+  const cl_counter_t *left = action->operands[0].counter;
+  const cl_counter_t *right = action->operands[1].counter;
 
-  if (left.type == CL_MEMTYPE_NOT_SET || right.type == CL_MEMTYPE_NOT_SET)
+  if (left->type == CL_MEMTYPE_NOT_SET || right->type == CL_MEMTYPE_NOT_SET)
     return cl_free_action(action);
   else
-    return cl_ctr_not_equal(&left, &right);
+    return cl_ctr_not_equal(left, right);
 }
 
 static bool cl_act_bits(cl_action_t *action)
 {
-  cl_counter_t left = cl_get_compare_value(action->arguments[0].uintval, action->arguments[1].uintval);
-  cl_counter_t right = cl_get_compare_value(action->arguments[2].uintval, action->arguments[3].uintval);
+  const cl_counter_t *left = action->operands[0].counter;
+  const cl_counter_t *right = action->operands[1].counter;
 
-  if (left.type == CL_MEMTYPE_NOT_SET || right.type == CL_MEMTYPE_NOT_SET)
+  if (left->type == CL_MEMTYPE_NOT_SET || right->type == CL_MEMTYPE_NOT_SET)
     return cl_free_action(action);
 
   /* TODO: Not exactly what we want */
-  return (left.intval.raw & right.intval.raw) == right.intval.raw;
+  return (cl_ctr_get_int(left) & cl_ctr_get_int(right)) ==
+         cl_ctr_get_int(right);
 }
 
 static bool cl_act_write(cl_action_t *action)
 {
-  cl_counter_t left = cl_get_compare_value(action->arguments[0].uintval, action->arguments[1].uintval);
-  cl_counter_t right = cl_get_compare_value(action->arguments[2].uintval, action->arguments[3].uintval);
+  cl_counter_t *left = action->operands[0].counter;
+  const cl_counter_t *right = action->operands[1].counter;
 
-  if (left.type == CL_MEMTYPE_NOT_SET || right.type == CL_MEMTYPE_NOT_SET)
+  if (left->type == CL_MEMTYPE_NOT_SET || right->type == CL_MEMTYPE_NOT_SET)
     return cl_free_action(action);
+  else if (action->operands[0].memnote)
+    return cl_write_memnote(action->operands[0].memnote, right);
   else
   {
-    switch (action->arguments[0].uintval)
-    {
-    case CL_SRCTYPE_CURRENT_RAM:
-      return cl_write_memnote_from_key(action->arguments[1].uintval, &right);
-    case CL_SRCTYPE_COUNTER:
-    {
-      cl_counter_t *ctr = cl_get_mutable_value(CL_SRCTYPE_COUNTER, action->arguments[1].uintval);
-      if (!ctr)
-        return false;
-      else
-        *ctr = right;
+    *left = *right;
 
-      return true;
-    }
-    default:
-      cl_script_break(true, "Invalid srctype to write: %u", action->arguments[0].uintval);
-      return false;
-    }
+    return true;
   }
 }
 
@@ -227,24 +141,20 @@ static bool cl_act_write(cl_action_t *action)
  * index that operates on itself.
  **/
 #define CL_TEMPLATE_CTR_UNARY \
-  cl_counter_t *ctr = cl_get_mutable_value(CL_SRCTYPE_COUNTER, \
-                                           action->arguments[0].uintval); \
-  if (!ctr || \
-      ctr->type == CL_MEMTYPE_NOT_SET) \
+  cl_counter_t *ctr = action->operands[0].counter; \
+  if (ctr->type == CL_MEMTYPE_NOT_SET) \
     return false; \
   else
 
 /**
  * A template for command actions that use one argument for a mutable counter
- * index and two for a compare value lookup.
+ * index and two for a compare value. The compare value is copied, as it may
+ * be the counter itself.
  **/
 #define CL_TEMPLATE_CTR_BINARY \
-  cl_counter_t *ctr = cl_get_mutable_value(CL_SRCTYPE_COUNTER, \
-                                           action->arguments[0].uintval); \
-  cl_counter_t src = cl_get_compare_value(action->arguments[1].uintval, \
-                                          action->arguments[2].uintval); \
-  if (!ctr || \
-      ctr->type == CL_MEMTYPE_NOT_SET || \
+  cl_counter_t *ctr = action->operands[0].counter; \
+  cl_counter_t src = *action->operands[1].counter; \
+  if (ctr->type == CL_MEMTYPE_NOT_SET || \
       src.type == CL_MEMTYPE_NOT_SET) \
     return false; \
   else
@@ -339,42 +249,68 @@ static bool cl_act_subtraction(cl_action_t *action)
 
 static bool cl_act_change_ctr_type(cl_action_t *action)
 {
-  cl_counter_t *ctr = cl_get_mutable_value(CL_SRCTYPE_COUNTER, action->arguments[0].uintval);
-  return ctr ? cl_ctr_change_type(ctr, action->arguments[1].uintval) : false;
+  return cl_ctr_change_type(action->operands[0].counter,
+                            action->arguments[1].uintval);
 }
 
+/* Shorthands for the operands used by each action type */
+#define CL_OPS_NONE { { CL_OPERAND_NONE, 0 }, { CL_OPERAND_NONE, 0 } }
+#define CL_OPS_VALUE { { CL_OPERAND_VALUE, 0 }, { CL_OPERAND_NONE, 0 } }
+#define CL_OPS_COMPARE { { CL_OPERAND_VALUE, 0 }, { CL_OPERAND_VALUE, 2 } }
+#define CL_OPS_CHANGED \
+  { { CL_OPERAND_CURRENT_RAM, 0 }, { CL_OPERAND_PREVIOUS_RAM, 0 } }
+#define CL_OPS_WRITE { { CL_OPERAND_TARGET, 0 }, { CL_OPERAND_VALUE, 2 } }
+#define CL_OPS_CTR_UNARY { { CL_OPERAND_COUNTER, 0 }, { CL_OPERAND_NONE, 0 } }
+#define CL_OPS_CTR_BINARY { { CL_OPERAND_COUNTER, 0 }, { CL_OPERAND_VALUE, 1 } }
+
 static const cl_acttype_t action_types[] =
 {
-  { CL_ACTTYPE_NO_PROCESS, false, 0, 0, 0, cl_act_no_process },
-  { CL_ACTTYPE_COMPARE,    true,  5, 5, 0, cl_act_compare },
-  { CL_ACTTYPE_CHANGED,    true,  1, 1, 0, cl_act_changed },
-  { CL_ACTTYPE_BITS,       true,  4, 4, 0, cl_act_bits },
+  { CL_ACTTYPE_NO_PROCESS, false, 0, 0, 0, cl_act_no_process, CL_OPS_NONE },
+  { CL_ACTTYPE_COMPARE,    true,  5, 5, 0, cl_act_compare, CL_OPS_COMPARE },
+  { CL_ACTTYPE_CHANGED,    true,  1, 1, 0, cl_act_changed, CL_OPS_CHANGED },
+  { CL_ACTTYPE_BITS,       true,  4, 4, 0, cl_act_bits, CL_OPS_COMPARE },
 
   /* Counter arithmetic */
-  { CL_ACTTYPE_ADDITION,       false, 3, 3, 0, cl_act_addition },
-  { CL_ACTTYPE_SUBTRACTION,    false, 3, 3, 0, cl_act_subtraction },
-  { CL_ACTTYPE_MULTIPLICATION, false, 3, 3, 0, cl_act_multiplication },
-  { CL_ACTTYPE_DIVISION,       false, 3, 3, 0, cl_act_division },
-  { CL_ACTTYPE_MODULO,         false, 3, 3, 0, cl_act_modulo },
+  { CL_ACTTYPE_ADDITION,       false, 3, 3, 0, cl_act_addition,
+    CL_OPS_CTR_BINARY },
+  { CL_ACTTYPE_SUBTRACTION,    false, 3, 3, 0, cl_act_subtraction,
+    CL_OPS_CTR_BINARY },
+  { CL_ACTTYPE_MULTIPLICATION, false, 3, 3, 0, cl_act_multiplication,
+    CL_OPS_CTR_BINARY },
+  { CL_ACTTYPE_DIVISION,       false, 3, 3, 0, cl_act_division,
+    CL_OPS_CTR_BINARY },
+  { CL_ACTTYPE_MODULO,         false, 3, 3, 0, cl_act_modulo,
+    CL_OPS_CTR_BINARY },
 
   /* Counter bitwise arithmetic */
-  { CL_ACTTYPE_AND,         false, 3, 3, 0, cl_act_bitwise_and },
-  { CL_ACTTYPE_OR,          false, 3, 3, 0, cl_act_bitwise_or },
-  { CL_ACTTYPE_XOR,         false, 3, 3, 0, cl_act_bitwise_xor },
-  { CL_ACTTYPE_COMPLEMENT,  false, 1, 1, 0, cl_act_bitwise_complement },
-  { CL_ACTTYPE_SHIFT_LEFT,  false, 3, 3, 0, cl_act_shift_left },
-  { CL_ACTTYPE_SHIFT_RIGHT, false, 3, 3, 0, cl_act_shift_right },
+  { CL_ACTTYPE_AND,         false, 3, 3, 0, cl_act_bitwise_and,
+    CL_OPS_CTR_BINARY },
+  { CL_ACTTYPE_OR,          false, 3, 3, 0, cl_act_bitwise_or,
+    CL_OPS_CTR_BINARY },
+  { CL_ACTTYPE_XOR,         false, 3, 3, 0, cl_act_bitwise_xor,
+    CL_OPS_CTR_BINARY },
+  { CL_ACTTYPE_COMPLEMENT,  false, 1, 1, 0, cl_act_bitwise_complement,
+    CL_OPS_CTR_UNARY },
+  { CL_ACTTYPE_SHIFT_LEFT,  false, 3, 3, 0, cl_act_shift_left,
+    CL_OPS_CTR_BINARY },
+  { CL_ACTTYPE_SHIFT_RIGHT, false, 3, 3, 0, cl_act_shift_right,
+    CL_OPS_CTR_BINARY },
 
   /* Direct value manipulation */
-  { CL_ACTTYPE_WRITE,           false, 4, 4, 0, cl_act_write },
-  { CL_ACTTYPE_CHANGE_CTR_TYPE, false, 2, 2, 0, cl_act_change_ctr_type },
+  { CL_ACTTYPE_WRITE,           false, 4, 4, 0, cl_act_write,
+    CL_OPS_WRITE },
+  { CL_ACTTYPE_CHANGE_CTR_TYPE, false, 2, 2, 0, cl_act_change_ctr_type,
+    CL_OPS_CTR_UNARY },
 
   /* Website API calls */
-  { CL_ACTTYPE_POST_ACHIEVEMENT, false, 2, 2,  0, cl_act_post_achievement },
-  { CL_ACTTYPE_POST_LEADERBOARD, false, 2, 16, 2, cl_act_post_leaderboard },
-  { CL_ACTTYPE_POST_PROGRESS,    false, 2, 16, 2, cl_act_post_progress },
-
-  { 0, false, 0, 0, 0, NULL }
+  { CL_ACTTYPE_POST_ACHIEVEMENT, false, 2, 2,  0, cl_act_post_achievement,
+    CL_OPS_VALUE },
+  { CL_ACTTYPE_POST_LEADERBOARD, false, 2, 16, 2, cl_act_post_leaderboard,
+    CL_OPS_VALUE },
+  { CL_ACTTYPE_POST_PROGRESS,    false, 2, 16, 2, cl_act_post_progress,
+    CL_OPS_NONE },
+
+  { 0, false, 0, 0, 0, NULL, CL_OPS_NONE }
 };
 
 bool cl_init_action(cl_action_t *action)
@@ -416,6 +352,152 @@ bool cl_init_action(cl_action_t *action)
   return false;
 }
 
+/**
+ * Resolves a source type and offset pair into the counter it refers to.
+ * @return Whether the pair refers to something that exists.
+ **/
+static bool cl_link_operand(cl_operand_t *operand, cl_src_t source,
+  int64_t offset, cl_counter_t *counters)
+{
+  operand->counter = NULL;
+  operand->memnote = NULL;
+
+  switch (source)
+  {
+  case CL_SRCTYPE_IMMEDIATE_INT:
+    operand->immediate.type = CL_MEMTYPE_INT64;
+    cl_ctr_store(&operand->immediate, &offset, CL_MEMTYPE_INT64);
+    operand->counter = &operand->immediate;
+    break;
+  case CL_SRCTYPE_IMMEDIATE_FLOAT:
+    operand->immediate.type = CL_MEMTYPE_DOUBLE;
+    cl_ctr_store(&operand->immediate, &offset, CL_MEMTYPE_DOUBLE);
+    operand->counter = &operand->immediate;
+    break;
+  case CL_SRCTYPE_CURRENT_RAM:
+  case CL_SRCTYPE_PREVIOUS_RAM:
+  case CL_SRCTYPE_LAST_UNIQUE_RAM:
+  {
+    cl_memnote_t *memnote = cl_find_memnote((unsigned)offset);
+    cl_memnote_values_t *values = cl_memnote_values(memnote);
+
+    if (!values)
+    {
+      cl_message(CL_MSG_ERROR, "Action refers to unknown memory note %lld.\n",
+                 (long long)offset);
+      return false;
+    }
+    else if (source == CL_SRCTYPE_CURRENT_RAM)
+      operand->counter = &values->current;
+    else if (source == CL_SRCTYPE_PREVIOUS_RAM)
+      operand->counter = &values->previous;
+    else
+      operand->counter = &values->last_unique;
+    operand->memnote = memnote;
+    cl_memnote_ref(memnote);
+    break;
+  }
+  case CL_SRCTYPE_COUNTER:
+    if (offset < CL_COUNTERS_SIZE && offset >= 0)
+      operand->counter = &counters[offset];
+    else
+    {
+      cl_message(CL_MSG_ERROR, "Action refers to invalid counter %lld.\n",
+                 (long long)offset);
+      return false;
+    }
+    break;
+  case CL_SRCTYPE_ROM: /* TODO */
+  default:
+    cl_message(CL_MSG_ERROR, "Action refers to unsupported srctype %u.\n",
+               source);
+    return false;
+  }
+
+  return true;
+}
+
+bool cl_link_action(cl_action_t *action, cl_counter_t *counters)
+{
+  const cl_acttype_t *acttype = &action_types[0];
+  unsigned i;
+
+  while (acttype->function && action->type != acttype->id)
+    acttype++;
+  if (!acttype->function || !action->arguments)
+    return false;
+
+  for (i = 0; i < CL_ACTION_OPERANDS; i++)
+  {
+    const cl_operand_spec_t *spec = &acttype->operands[i];
+    cl_operand_t *operand = &action->operands[i];
+    const cl_arg_t *args = &action->arguments[spec->argument];
+    bool success;
+
+    switch (spec->kind)
+    {
+    case CL_OPERAND_NONE:
+      operand->counter = NULL;
+      operand->memnote = NULL;
+      success = true;
+      break;
+    case CL_OPERAND_VALUE:
+      success = cl_link_operand(operand, args[0].uintval, args[1].intval,
+                                counters);
+      break;
+    case CL_OPERAND_TARGET:
+      if (args[0].uintval != CL_SRCTYPE_CURRENT_RAM &&
+          args[0].uintval != CL_SRCTYPE_COUNTER)
+      {
+        cl_message(CL_MSG_ERROR, "Invalid srctype to write: %u\n",
+                   args[0].uintval);
+        success = false;
+      }
+      else
+        success = cl_link_operand(operand, args[0].uintval, args[1].intval,
+                                  counters);
+      break;
+    case CL_OPERAND_COUNTER:
+      success = cl_link_operand(operand, CL_SRCTYPE_COUNTER, args[0].intval,
+                                counters);
+      break;
+    case CL_OPERAND_CURRENT_RAM:
+      success = cl_link_operand(operand, CL_SRCTYPE_CURRENT_RAM,
+                                args[0].intval, counters);
+      break;
+    case CL_OPERAND_PREVIOUS_RAM:
+      success = cl_link_operand(operand, CL_SRCTYPE_PREVIOUS_RAM,
+                                args[0].intval, counters);
+      break;
+    default:
+      success = false;
+    }
+    if (!success)
+      return false;
+  }
+
+  return true;
+}
+
+bool cl_action_has_side_effects(const cl_action_t *action)
+{
+  switch (action->type)
+  {
+  case CL_ACTTYPE_WRITE:
+    /* Writing to a page counter only affects the page */
+    return action->operands[0].memnote != NULL;
+  case CL_ACTTYPE_POST_LEADERBOARD:
+  case CL_ACTTYPE_POST_PROGRESS:
+  case CL_ACTTYPE_POST_POLL:
+  case CL_ACTTYPE_POST_INFO:
+    return true;
+  case CL_ACTTYPE_POST_ACHIEVEMENT:
+    /* Frees itself once posted, which marks its page as changed */
+  default:
+    return false;
+  }
+}
+
 bool cl_process_action(cl_action_t *action)
 {
   if (!action)
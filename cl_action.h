@@ -2,6 +2,10 @@
 #define CL_ACTION_H
 
 #include "cl_common.h"
+#include "cl_counter.h"
+
+/* The most operands a single action reads from or writes to */
+#define CL_ACTION_OPERANDS 2
 
 typedef enum
 {
@@ -37,6 +41,50 @@ typedef enum
   CL_ACTTYPE_POST_INFO,
 } cl_action_id;
 
+typedef enum
+{
+  /* The action does not use this operand */
+  CL_OPERAND_NONE = 0,
+
+  /* A source type and offset pair, such as a memory note key or immediate */
+  CL_OPERAND_VALUE,
+
+  /* A source type and offset pair that is written to */
+  CL_OPERAND_TARGET,
+
+  /* A page counter index */
+  CL_OPERAND_COUNTER,
+
+  /* A memory note key, read as the current or previous value of the note */
+  CL_OPERAND_CURRENT_RAM,
+  CL_OPERAND_PREVIOUS_RAM
+} cl_operand_kind;
+
+typedef struct
+{
+  /* How the arguments are resolved. For example, CL_OPERAND_VALUE. */
+  cl_operand_kind kind;
+
+  /* The index of the first argument used */
+  unsigned argument;
+} cl_operand_spec_t;
+
+/**
+ * An action argument resolved to the counter it refers to, so the action can
+ * be processed without looking anything up.
+ */
+typedef struct
+{
+  /* The counter to use, or NULL if the action does not use this operand */
+  cl_counter_t *counter;
+
+  /* The memory note the counter belongs to, if any */
+  struct cl_memnote_t *memnote;
+
+  /* Holds the value of an immediate, which "counter" then points to */
+  cl_counter_t immediate;
+} cl_operand_t;
+
 typedef struct
 {
   cl_action_id id;
@@ -55,6 +103,9 @@ typedef struct
 
   /* The function of the action */
   bool    (*function)();
+
+  /* Which arguments are resolved into operands when the script is linked */
+  cl_operand_spec_t operands[CL_ACTION_OPERANDS];
 } cl_acttype_t;
 
 enum
@@ -79,6 +130,9 @@ typedef struct cl_action_t
    unsigned  indentation;
    unsigned  type;
 
+   /* Set by cl_link_action: the arguments resolved into counters */
+   cl_operand_t operands[CL_ACTION_OPERANDS];
+
    /* TODO: Double-link actions together so the editor can easily insert new lines */ 
    struct cl_action_t *prev_action;
    struct cl_action_t *next_action;
@@ -89,6 +143,24 @@ bool cl_free_action(cl_action_t *action);
 /* Assign the correct function pointer for the type of action */
 bool cl_init_action(cl_action_t *action);
 
+/**
+ * Resolves the arguments of an action into pointers to the memory note values,
+ * page counters or immediates they refer to. Call once the script and memory
+ * notes are loaded, and again if either changes.
+ * @param action The action to link.
+ * @param counters The counters of the page the action belongs to.
+ * @return Whether every operand could be resolved. If not, the action must not
+ * be processed.
+ **/
+bool cl_link_action(cl_action_t *action, cl_counter_t *counters);
+
+/**
+ * Returns whether processing an action can affect anything outside of the
+ * script, such as game memory or the website. Pages with such actions are
+ * processed every frame, even if nothing they read has changed.
+ **/
+bool cl_action_has_side_effects(const cl_action_t *action);
+
 /* Run the function and return whether it succeeded. */
 bool cl_process_action(cl_action_t *action);
 
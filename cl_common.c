@@ -47,11 +47,8 @@ bool cl_read(void *dest, const uint8_t *src, cl_addr_t offset, unsigned size,
     memcpy(dest, &src[offset], size);
 
     /* Byte swap if necessary */
-#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
-    if (endianness == CL_ENDIAN_LITTLE)
-#else
-    if (endianness == CL_ENDIAN_BIG)
-#endif
+    if (endianness == CL_ENDIAN_SWAPPED ||
+        endianness == CL_ENDIAN_WORD_FLIP_SWAPPED)
     {
       switch (size)
       {
@@ -79,6 +76,15 @@ bool cl_read(void *dest, const uint8_t *src, cl_addr_t offset, unsigned size,
       }
     }
 
+    /* Swap the words of word-flipped values */
+    if (size == 8 && (endianness == CL_ENDIAN_WORD_FLIP_NATIVE ||
+                      endianness == CL_ENDIAN_WORD_FLIP_SWAPPED))
+    {
+      uint64_t value = *((uint64_t*)dest);
+
+      *((uint64_t*)dest) = (value << 32) | (value >> 32);
+    }
+
     return true;
   }
 
@@ -144,3 +150,12 @@ bool cl_write(uint8_t *dest, const void *src, cl_addr_t offset, unsigned size,
 
   return false;
 }
+
+#if CL_TESTS
+unsigned cl_test_rand(unsigned *seed)
+{
+  *seed = *seed * 1103515245 + 12345;
+
+  return (*seed >> 16) & 0x7FFF;
+}
+#endif
@@ -76,6 +76,22 @@ typedef enum
   CL_ENDIAN_SIZE
 } cl_endianness;
 
+/**
+ * The byte order opposite to the host's, and the word-flipped byte orders
+ * whose 32-bit words are stored in the host's byte order or in the opposite
+ * one. Values of up to 4 bytes in a word-flipped region are stored in the
+ * byte order of its words.
+ */
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define CL_ENDIAN_SWAPPED           CL_ENDIAN_LITTLE
+#define CL_ENDIAN_WORD_FLIP_NATIVE  CL_ENDIAN_WORD_FLIP_LB
+#define CL_ENDIAN_WORD_FLIP_SWAPPED CL_ENDIAN_WORD_FLIP_BL
+#else
+#define CL_ENDIAN_SWAPPED           CL_ENDIAN_BIG
+#define CL_ENDIAN_WORD_FLIP_NATIVE  CL_ENDIAN_WORD_FLIP_BL
+#define CL_ENDIAN_WORD_FLIP_SWAPPED CL_ENDIAN_WORD_FLIP_LB
+#endif
+
 typedef enum
 {
   CL_MSG_DEBUG = 0,
@@ -110,6 +126,113 @@ typedef enum
  */
 #define CL_UNUSED(a) (void)(a)
 
+/**
+ * Returns the number of set bits in a 64-bit value.
+ */
+static inline unsigned cl_popcount64(uint64_t value)
+{
+#ifdef __GNUC__
+  return (unsigned)__builtin_popcountll(value);
+#else
+  value = value - ((value >> 1) & 0x5555555555555555ULL);
+  value = (value & 0x3333333333333333ULL) +
+          ((value >> 2) & 0x3333333333333333ULL);
+  value = (value + (value >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+
+  return (unsigned)((value * 0x0101010101010101ULL) >> 56);
+#endif
+}
+
+/**
+ * Returns the index of the lowest set bit in a 64-bit value, which must not
+ * be zero.
+ */
+static inline unsigned cl_ctz64(uint64_t value)
+{
+#ifdef __GNUC__
+  return (unsigned)__builtin_ctzll(value);
+#else
+  unsigned i = 0;
+
+  if (!(value & 0xFFFFFFFFULL))
+  {
+    value >>= 32;
+    i += 32;
+  }
+  while (!(value & 1))
+  {
+    value >>= 1;
+    i++;
+  }
+
+  return i;
+#endif
+}
+
+/**
+ * Returns the index of the highest set bit in a 64-bit value, which must not
+ * be zero.
+ */
+static inline unsigned cl_msb64(uint64_t value)
+{
+#ifdef __GNUC__
+  return 63 - (unsigned)__builtin_clzll(value);
+#else
+  unsigned i = 63;
+
+  if (!(value >> 32))
+  {
+    value <<= 32;
+    i -= 32;
+  }
+  while (!(value >> 63))
+  {
+    value <<= 1;
+    i--;
+  }
+
+  return i;
+#endif
+}
+
+/**
+ * Reverses the byte order of a 16-bit value.
+ */
+static inline uint16_t cl_bswap16(uint16_t value)
+{
+#ifdef __GNUC__
+  return __builtin_bswap16(value);
+#else
+  return (uint16_t)((value >> 8) | (value << 8));
+#endif
+}
+
+/**
+ * Reverses the byte order of a 32-bit value.
+ */
+static inline uint32_t cl_bswap32(uint32_t value)
+{
+#ifdef __GNUC__
+  return __builtin_bswap32(value);
+#else
+  return (value >> 24) | ((value >> 8) & 0xFF00) | ((value << 8) & 0xFF0000) |
+         (value << 24);
+#endif
+}
+
+/**
+ * Reverses the byte order of a 64-bit value.
+ */
+static inline uint64_t cl_bswap64(uint64_t value)
+{
+#ifdef __GNUC__
+  return __builtin_bswap64(value);
+#else
+  return ((uint64_t)cl_bswap32((uint32_t)value) << 32) |
+         cl_bswap32((uint32_t)(value >> 32));
+#endif
+}
+
 /**
  * Formats a message and instructs the frontend to display or log it.
  * @param level The severity of the message. For example, CL_MSG_ERROR.
@@ -125,7 +248,8 @@ void cl_log(const char *format, ...);
 
 /**
  * Reads data from one location to another, automatically applying transforms
- *   for size and endianness differences.
+ *   for size and endianness differences. Values of 8 bytes in word-flipped
+ *   memory have their words swapped as well.
  * @param dest The destination buffer.
  * @param src The source buffer.
  * @param offset The location from which to start reading from src.
@@ -151,4 +275,13 @@ bool cl_write(uint8_t *dest, const void *src, cl_addr_t offset, unsigned size,
 
 bool cl_strto(const char **pos, void *value, unsigned size, bool is_signed);
 
+#if CL_TESTS
+/**
+ * Returns a pseudo-random number from 0 to 32767 for unit tests, so a test
+ * run with the same seed sees the same numbers on every host.
+ * @param seed The state of the sequence, advanced by each call.
+ */
+unsigned cl_test_rand(unsigned *seed);
+#endif
+
 #endif
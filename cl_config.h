@@ -62,6 +62,14 @@
 #define CL_HAVE_FILESYSTEM false
 #endif
 
+#ifndef CL_HAVE_THREADS
+/**
+ * Whether or not worker threads can be created with pthreads or Win32 threads
+ * on this host. If false, parallel search functions run on the calling thread.
+ */
+#define CL_HAVE_THREADS (CL_HOST_PLATFORM != CL_PLATFORM_UNKNOWN)
+#endif
+
 #ifndef CL_HAVE_SSL
 /**
  * Whether or not the networking callbacks in this implementation support HTTPS.
@@ -80,6 +88,43 @@
 #define CL_EXTERNAL_MEMORY false
 #endif
 
+#ifndef CL_EXTERNAL_MEMORY_BATCH
+/**
+ * Whether or not memory notes are read from external memory in batches, one
+ * level of their pointer chains at a time, with nearby reads merged into
+ * larger ranges. If true, the frontend needs to supply an implementation of
+ * cl_fe_memory_read_batch as well. See cl_frontend.h.
+ */
+#define CL_EXTERNAL_MEMORY_BATCH false
+#endif
+
+#ifndef CL_EXTERNAL_MEMORY_GAP
+/**
+ * The most unused bytes allowed between two batched external memory reads for
+ * them to be merged into one range.
+ */
+#define CL_EXTERNAL_MEMORY_GAP 64
+#endif
+
+#ifndef CL_EXTERNAL_MEMORY_LINUX
+/**
+ * Whether or not external memory is read from another process on this Linux
+ * host by the backend in cl_linux.c, which then supplies the external memory
+ * functions of cl_frontend.h itself.
+ */
+#define CL_EXTERNAL_MEMORY_LINUX false
+#endif
+
+#ifndef CL_EXTERNAL_MEMORY_SOFT_DIRTY
+/**
+ * Whether or not the Linux backend uses the kernel's soft-dirty page bits to
+ * only copy the pages another process wrote to since the last search step.
+ * Writes made while the bits are being collected can be missed until the page
+ * is written again.
+ */
+#define CL_EXTERNAL_MEMORY_SOFT_DIRTY true
+#endif
+
 #ifndef CL_LIBRETRO
 /**
  * Whether or not this implementation is a libretro frontend.
@@ -87,6 +132,55 @@
 #define CL_LIBRETRO false
 #endif
 
+#ifndef CL_SEARCH_SIMD
+/**
+ * Whether or not memory searches may use SSE2 or AVX2 compare kernels on x86
+ * hosts that support them. The kernel set is chosen at runtime, and a scalar
+ * fallback is always available.
+ */
+#define CL_SEARCH_SIMD true
+#endif
+
+#ifndef CL_SEARCH_SPARSE_THRESHOLD
+/**
+ * The number of matches at or below which a memory search bank drops its
+ * full-size snapshot and bitset and keeps its candidates in a sorted list.
+ * 0 disables the list representation.
+ */
+#define CL_SEARCH_SPARSE_THRESHOLD 4096
+#endif
+
+#ifndef CL_SEARCH_WRITE_TRACKING
+/**
+ * Whether or not memory searches write-protect the pages of local memory
+ * regions on Linux hosts, so each step only compares the pages written to
+ * since the last one. Writes into a protected page by the kernel, such as a
+ * read() into emulated memory, fail instead of being tracked, so this is only
+ * safe for cores that write their memory directly.
+ */
+#define CL_SEARCH_WRITE_TRACKING false
+#endif
+
+#ifndef CL_SCRIPT_JIT
+/**
+ * Whether or not script pages are compiled to native code when a script is
+ * loaded. Only x86-64 hosts using the System V calling convention are
+ * supported; other hosts, and actions without a native implementation, use
+ * the script interpreter.
+ */
+#define CL_SCRIPT_JIT false
+#endif
+
+#ifndef CL_SCRIPT_CHANGE_DRIVEN
+/**
+ * Whether or not script pages are skipped on frames where none of the memory
+ * notes they read and none of their counters changed. Pages with actions that
+ * affect anything outside of the script are processed every frame. Actions on
+ * skipped pages do not count executions.
+ */
+#define CL_SCRIPT_CHANGE_DRIVEN true
+#endif
+
 #ifndef CL_URL_HOSTNAME
 /**
  * The full hostname for the CL website.
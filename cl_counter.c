@@ -15,6 +15,22 @@ bool cl_ctr_is_float(const cl_counter_t *counter)
     return false;
 }
 
+int64_t cl_ctr_get_int(const cl_counter_t *counter)
+{
+  if (cl_ctr_is_float(counter))
+    return (int64_t)counter->value.fp;
+  else
+    return counter->value.i64;
+}
+
+double cl_ctr_get_float(const cl_counter_t *counter)
+{
+  if (cl_ctr_is_float(counter))
+    return counter->value.fp;
+  else
+    return (double)counter->value.i64;
+}
+
 bool cl_ctr_store(cl_counter_t *counter, const void *src, unsigned type)
 {
   switch (type)
@@ -42,11 +58,9 @@ bool cl_ctr_store(cl_counter_t *counter, const void *src, unsigned type)
   }
 }
 
-/** @todo Make sure the commented lines still work */
 bool cl_ctr_store_int(cl_counter_t *counter, int64_t value)
 {
-  counter->intval.i64 = value;
-  counter->floatval.fp = (double)value;
+  counter->value.i64 = value;
   counter->type = CL_MEMTYPE_INT64;
 
   return true;
@@ -54,9 +68,9 @@ bool cl_ctr_store_int(cl_counter_t *counter, int64_t value)
 
 bool cl_ctr_store_float(cl_counter_t *counter, double value)
 {
-  counter->intval.i64 = (int64_t)value;
-  counter->floatval.fp = value;
-  /** @todo Can we add this back? counter->type = CL_MEMTYPE_DOUBLE; */
+  counter->value.fp = value;
+  if (!cl_ctr_is_float(counter))
+    counter->type = CL_MEMTYPE_DOUBLE;
 
   return true;
 }
@@ -64,15 +78,15 @@ bool cl_ctr_store_float(cl_counter_t *counter, double value)
 bool cl_ctr_equal(const cl_counter_t *left, const cl_counter_t *right)
 {
   if (cl_ctr_is_float(left) && cl_ctr_is_float(right))
-    return fabs(left->floatval.fp - right->floatval.fp) < CL_CTR_EPSILON;
+    return fabs(left->value.fp - right->value.fp) < CL_CTR_EPSILON;
   else
-    return left->intval.i64 == right->intval.i64;
+    return cl_ctr_get_int(left) == cl_ctr_get_int(right);
 }
 
 bool cl_ctr_equal_exact(const cl_counter_t *left, const cl_counter_t *right)
 {
-  return (left->floatval.raw == right->floatval.raw &&
-          left->intval.i64 == right->intval.i64);
+  return left->value.raw == right->value.raw &&
+         cl_ctr_is_float(left) == cl_ctr_is_float(right);
 }
 
 bool cl_ctr_not_equal(const cl_counter_t *left, const cl_counter_t *right)
@@ -83,17 +97,17 @@ bool cl_ctr_not_equal(const cl_counter_t *left, const cl_counter_t *right)
 bool cl_ctr_lesser(const cl_counter_t *left, const cl_counter_t *right)
 {
   if (cl_ctr_is_float(left) && cl_ctr_is_float(right))
-    return left->floatval.fp < right->floatval.fp;
+    return left->value.fp < right->value.fp;
   else
-    return left->intval.i64 < right->intval.i64;
+    return cl_ctr_get_int(left) < cl_ctr_get_int(right);
 }
 
 bool cl_ctr_greater(const cl_counter_t *left, const cl_counter_t *right)
 {
   if (cl_ctr_is_float(left) && cl_ctr_is_float(right))
-    return left->floatval.fp > right->floatval.fp;
+    return left->value.fp > right->value.fp;
   else
-    return left->intval.i64 > right->intval.i64;
+    return cl_ctr_get_int(left) > cl_ctr_get_int(right);
 }
 
 bool cl_ctr_lesser_or_equal(const cl_counter_t *left, const cl_counter_t *right)
@@ -106,106 +120,72 @@ bool cl_ctr_greater_or_equal(const cl_counter_t *left, const cl_counter_t *right
   return cl_ctr_greater(left, right) || cl_ctr_equal(left, right);
 }
 
+/*
+ * Bitwise operations work on the bits of each value as it is held, so a
+ * floating point value is used as its IEEE 754 representation.
+ */
+
 bool cl_ctr_and(cl_counter_t *counter, const cl_counter_t *value)
 {
-  uint64_t temp_src;
-
-  if (cl_ctr_is_float(value))
-    temp_src = value->floatval.raw;
-  else
-    temp_src = value->intval.raw;
-
-  if (cl_ctr_is_float(counter))
-  {
-    uint64_t temp = counter->floatval.raw & temp_src;
-    double temp_fp;
-
-    memcpy(&temp_fp, &temp, sizeof(temp_fp));
+  counter->value.raw &= value->value.raw;
+  if (!cl_ctr_is_float(counter))
+    counter->type = CL_MEMTYPE_INT64;
 
-    return cl_ctr_store_float(counter, temp_fp);
-  }
-  else
-    return cl_ctr_store_int(counter, counter->intval.raw & temp_src);
+  return true;
 }
 
 bool cl_ctr_or(cl_counter_t *counter, const cl_counter_t *value)
 {
-  uint64_t temp_src;
+  counter->value.raw |= value->value.raw;
+  if (!cl_ctr_is_float(counter))
+    counter->type = CL_MEMTYPE_INT64;
 
-  if (cl_ctr_is_float(value))
-    temp_src = value->floatval.raw;
-  else
-    temp_src = value->intval.raw;
-
-  if (cl_ctr_is_float(counter))
-  {
-    uint64_t temp = counter->floatval.raw | temp_src;
-    double temp_fp;
-
-    memcpy(&temp_fp, &temp, sizeof(temp_fp));
-
-    return cl_ctr_store_float(counter, temp_fp);
-  }
-  else
-    return cl_ctr_store_int(counter, counter->intval.raw | temp_src);
+  return true;
 }
 
 bool cl_ctr_xor(cl_counter_t *counter, const cl_counter_t *value)
 {
-  uint64_t temp_src;
-
-  if (cl_ctr_is_float(value))
-    temp_src = value->floatval.raw;
-  else
-    temp_src = value->intval.raw;
-
-  if (cl_ctr_is_float(counter))
-  {
-    uint64_t temp = counter->floatval.raw ^ temp_src;
-    double temp_fp;
-
-    memcpy(&temp_fp, &temp, sizeof(temp_fp));
+  counter->value.raw ^= value->value.raw;
+  if (!cl_ctr_is_float(counter))
+    counter->type = CL_MEMTYPE_INT64;
 
-    return cl_ctr_store_float(counter, temp_fp);
-  }
-  else
-    return cl_ctr_store_int(counter, counter->intval.raw ^ temp_src);
+  return true;
 }
 
 bool cl_ctr_shift_left(cl_counter_t *counter, const cl_counter_t *value)
 {
-  if (cl_ctr_is_float(counter))
-  {
-    counter->floatval.raw <<= value->intval.raw;
-    return cl_ctr_store_int(counter, counter->floatval.raw);
-  }
-  else
-    return cl_ctr_store_int(counter, counter->intval.raw << value->intval.raw);
+  return cl_ctr_store_int(counter, (int64_t)((uint64_t)cl_ctr_get_int(counter)
+    << (uint64_t)cl_ctr_get_int(value)));
 }
 
 bool cl_ctr_shift_right(cl_counter_t *counter, const cl_counter_t *value)
 {
-  if (cl_ctr_is_float(counter))
-  {
-    counter->floatval.raw >>= value->intval.raw;
-    return cl_ctr_store_int(counter, counter->floatval.raw);
-  }
-  else
-    return cl_ctr_store_int(counter, counter->intval.raw >> value->intval.raw);
+  return cl_ctr_store_int(counter, (int64_t)((uint64_t)cl_ctr_get_int(counter)
+    >> (uint64_t)cl_ctr_get_int(value)));
 }
 
 bool cl_ctr_complement(cl_counter_t *counter)
 {
-  return cl_ctr_store_int(counter,
-    ~(cl_ctr_is_float(counter) ? counter->floatval.raw : counter->intval.raw));
+  return cl_ctr_store_int(counter, (int64_t)~counter->value.raw);
 }
 
+/*
+ * Arithmetic is done on integers if both counters hold integers, and on
+ * floating point values otherwise, in which case the result is a
+ * CL_MEMTYPE_DOUBLE. Integer addition, subtraction and multiplication wrap
+ * around on overflow, as they do in native code.
+ */
+
 bool cl_ctr_add(cl_counter_t *left, const cl_counter_t *right)
 {
   if (cl_ctr_is_float(left) || cl_ctr_is_float(right))
+  {
+    left->value.fp = cl_ctr_get_float(left) + cl_ctr_get_float(right);
     left->type = CL_MEMTYPE_DOUBLE;
-  left->intval.i64 += right->intval.i64;
-  left->floatval.fp += right->floatval.fp;
+  }
+  else
+    left->value.i64 = (int64_t)((uint64_t)left->value.i64 +
+                                (uint64_t)right->value.i64);
 
   return true;
 }
@@ -213,9 +193,13 @@ bool cl_ctr_add(cl_counter_t *left, const cl_counter_t *right)
 bool cl_ctr_subtract(cl_counter_t *left, const cl_counter_t *right)
 {
   if (cl_ctr_is_float(left) || cl_ctr_is_float(right))
+  {
+    left->value.fp = cl_ctr_get_float(left) - cl_ctr_get_float(right);
     left->type = CL_MEMTYPE_DOUBLE;
-  left->intval.i64 -= right->intval.i64;
-  left->floatval.fp -= right->floatval.fp;
+  }
+  else
+    left->value.i64 = (int64_t)((uint64_t)left->value.i64 -
+                                (uint64_t)right->value.i64);
 
   return true;
 }
@@ -223,9 +207,13 @@ bool cl_ctr_subtract(cl_counter_t *left, const cl_counter_t *right)
 bool cl_ctr_multiply(cl_counter_t *left, const cl_counter_t *right)
 {
   if (cl_ctr_is_float(left) || cl_ctr_is_float(right))
+  {
+    left->value.fp = cl_ctr_get_float(left) * cl_ctr_get_float(right);
     left->type = CL_MEMTYPE_DOUBLE;
-  left->intval.i64 *= right->intval.i64;
-  left->floatval.fp *= right->floatval.fp;
+  }
+  else
+    left->value.i64 = (int64_t)((uint64_t)left->value.i64 *
+                                (uint64_t)right->value.i64);
 
   return true;
 }
@@ -233,9 +221,12 @@ bool cl_ctr_multiply(cl_counter_t *left, const cl_counter_t *right)
 bool cl_ctr_divide(cl_counter_t *left, const cl_counter_t *right)
 {
   if (cl_ctr_is_float(left) || cl_ctr_is_float(right))
+  {
+    left->value.fp = cl_ctr_get_float(left) / cl_ctr_get_float(right);
     left->type = CL_MEMTYPE_DOUBLE;
-  left->intval.i64 /= right->intval.i64;
-  left->floatval.fp /= right->floatval.fp;
+  }
+  else
+    left->value.i64 /= right->value.i64;
 
   return true;
 }
@@ -243,17 +234,34 @@ bool cl_ctr_divide(cl_counter_t *left, const cl_counter_t *right)
 bool cl_ctr_modulo(cl_counter_t *left, const cl_counter_t *right)
 {
   if (cl_ctr_is_float(left) || cl_ctr_is_float(right))
+  {
+    left->value.fp = fmod(cl_ctr_get_float(left), cl_ctr_get_float(right));
     left->type = CL_MEMTYPE_DOUBLE;
-  left->intval.i64 %= right->intval.i64;
-  left->floatval.fp = fmod(left->floatval.fp, right->floatval.fp);
+  }
+  else
+    left->value.i64 %= right->value.i64;
 
   return true;
 }
 
-/* TODO */
 bool cl_ctr_change_type(cl_counter_t *counter, unsigned type)
 {
-  counter->type = type;
+  if (cl_ctr_is_float(counter))
+  {
+    double value = counter->value.fp;
+
+    counter->type = type;
+    if (!cl_ctr_is_float(counter))
+      counter->value.i64 = (int64_t)value;
+  }
+  else
+  {
+    int64_t value = counter->value.i64;
+
+    counter->type = type;
+    if (cl_ctr_is_float(counter))
+      counter->value.fp = (double)value;
+  }
 
   return true;
 }
@@ -267,16 +275,16 @@ static void cl_ctr_test_add(void)
   cl_ctr_store_int(&a, 2);
   cl_ctr_store_int(&b, 4);
   cl_ctr_add(&a, &b);
-  if (a.intval.i64 != 6)
+  if (cl_ctr_get_int(&a) != 6)
     CL_TEST_FAIL(1);
-  if (fabs(a.floatval.fp - 6.0) < CL_CTR_EPSILON)
+  if (fabs(cl_ctr_get_float(&a) - 6.0) > CL_CTR_EPSILON)
     CL_TEST_FAIL(2);
 
   cl_ctr_store_float(&a, 10.0);
   cl_ctr_add(&a, &b);
-  if (a.intval.i64 != 14)
+  if (cl_ctr_get_int(&a) != 14)
     exit(3);
-  if (fabs(a.floatval.fp - 14.0) < CL_CTR_EPSILON)
+  if (fabs(cl_ctr_get_float(&a) - 14.0) > CL_CTR_EPSILON)
     exit(4);
 }
 
@@ -287,16 +295,16 @@ static void cl_ctr_test_subtract(void)
   cl_ctr_store_int(&a, 10);
   cl_ctr_store_int(&b, 4);
   cl_ctr_subtract(&a, &b);
-  if (a.intval.i64 != 6)
+  if (cl_ctr_get_int(&a) != 6)
     exit(1);
-  if (fabs(a.floatval.fp - 6.0) > CL_CTR_EPSILON)
+  if (fabs(cl_ctr_get_float(&a) - 6.0) > CL_CTR_EPSILON)
     exit(2);
 
   cl_ctr_store_float(&a, 15.0);
   cl_ctr_subtract(&a, &b);
-  if (a.intval.i64 != 11)
+  if (cl_ctr_get_int(&a) != 11)
     exit(3);
-  if (fabs(a.floatval.fp - 11.0) > CL_CTR_EPSILON)
+  if (fabs(cl_ctr_get_float(&a) - 11.0) > CL_CTR_EPSILON)
     exit(4);
 }
 
@@ -307,16 +315,16 @@ static void cl_ctr_test_multiply(void)
   cl_ctr_store_int(&a, 3);
   cl_ctr_store_int(&b, 5);
   cl_ctr_multiply(&a, &b);
-  if (a.intval.i64 != 15)
+  if (cl_ctr_get_int(&a) != 15)
     exit(1);
-  if (fabs(a.floatval.fp - 15.0) > CL_CTR_EPSILON)
+  if (fabs(cl_ctr_get_float(&a) - 15.0) > CL_CTR_EPSILON)
     exit(2);
 
   cl_ctr_store_float(&a, 2.0);
   cl_ctr_multiply(&a, &b);
-  if (a.intval.i64 != 10)
+  if (cl_ctr_get_int(&a) != 10)
     exit(3);
-  if (fabs(a.floatval.fp - 10.0) > CL_CTR_EPSILON)
+  if (fabs(cl_ctr_get_float(&a) - 10.0) > CL_CTR_EPSILON)
     exit(4);
 }
 
@@ -327,16 +335,16 @@ static void cl_ctr_test_divide(void)
   cl_ctr_store_int(&a, 20);
   cl_ctr_store_int(&b, 4);
   cl_ctr_divide(&a, &b);
-  if (a.intval.i64 != 5)
+  if (cl_ctr_get_int(&a) != 5)
     exit(1);
-  if (fabs(a.floatval.fp - 5.0) > CL_CTR_EPSILON)
+  if (fabs(cl_ctr_get_float(&a) - 5.0) > CL_CTR_EPSILON)
     exit(2);
 
   cl_ctr_store_float(&a, 30.0);
   cl_ctr_divide(&a, &b);
-  if (a.intval.i64 != 7)
+  if (cl_ctr_get_int(&a) != 7)
     exit(3);
-  if (fabs(a.floatval.fp - 7.5) > CL_CTR_EPSILON)
+  if (fabs(cl_ctr_get_float(&a) - 7.5) > CL_CTR_EPSILON)
     exit(4);
 }
 
@@ -347,17 +355,17 @@ static void cl_ctr_test_modulo(void)
   cl_ctr_store_int(&a, 10);
   cl_ctr_store_int(&b, 3);
   cl_ctr_modulo(&a, &b);
-  if (a.intval.i64 != 1)
+  if (cl_ctr_get_int(&a) != 1)
     exit(1);
-  if (fabs(a.floatval.fp - 1.0) > CL_CTR_EPSILON)
+  if (fabs(cl_ctr_get_float(&a) - 1.0) > CL_CTR_EPSILON)
     exit(2);
 
   cl_ctr_store_float(&a, 15.5);
   cl_ctr_store_float(&b, 4.0);
   cl_ctr_modulo(&a, &b);
-  if (a.intval.i64 != 3)
+  if (cl_ctr_get_int(&a) != 3)
     exit(3);
-  if (fabs(a.floatval.fp - 3.5) > CL_CTR_EPSILON)
+  if (fabs(cl_ctr_get_float(&a) - 3.5) > CL_CTR_EPSILON)
     exit(4);
 }
 
@@ -368,12 +376,12 @@ static void cl_ctr_test_shift_left(void)
   cl_ctr_store_int(&a, 10);
   cl_ctr_store_int(&b, 2);
   cl_ctr_shift_left(&a, &b);
-  if (a.intval.i64 != 40)
+  if (cl_ctr_get_int(&a) != 40)
     exit(1);
 
   cl_ctr_store_float(&a, 15.0);
   cl_ctr_shift_left(&a, &b);
-  if (a.intval.i64 != 60)
+  if (cl_ctr_get_int(&a) != 60)
     exit(2);
 }
 
@@ -384,22 +392,42 @@ static void cl_ctr_test_shift_right(void)
   cl_ctr_store_int(&a, 40);
   cl_ctr_store_int(&b, 2);
   cl_ctr_shift_right(&a, &b);
-  if (a.intval.i64 != 10)
+  if (cl_ctr_get_int(&a) != 10)
     exit(1);
 
   cl_ctr_store_float(&a, 64.0);
   cl_ctr_shift_right(&a, &b);
-  if (a.intval.i64 != 16)
+  if (cl_ctr_get_int(&a) != 16)
     exit(2);
 }
 
+static void cl_ctr_test_change_type(void)
+{
+  cl_counter_t a, b;
+
+  cl_ctr_store_int(&a, 7);
+  cl_ctr_change_type(&a, CL_MEMTYPE_DOUBLE);
+  if (!cl_ctr_is_float(&a) || cl_ctr_get_float(&a) != 7.0)
+    exit(1);
+
+  cl_ctr_store_float(&a, 7.9);
+  cl_ctr_change_type(&a, CL_MEMTYPE_INT64);
+  if (cl_ctr_is_float(&a) || cl_ctr_get_int(&a) != 7)
+    exit(2);
+
+  cl_ctr_store_int(&b, 0);
+  cl_ctr_store_float(&b, 7.0);
+  if (!cl_ctr_equal(&a, &b) || cl_ctr_equal_exact(&a, &b))
+    exit(3);
+}
+
 static void cl_ctr_test_complement(void)
 {
   cl_counter_t a;
 
   cl_ctr_store_int(&a, 10);
   cl_ctr_complement(&a);
-  if (a.intval.i64 != ~10)
+  if (cl_ctr_get_int(&a) != ~10)
     exit(1);
 }
 
@@ -413,6 +441,7 @@ int cl_ctr_tests(void)
   cl_ctr_test_shift_left();
   cl_ctr_test_shift_right();
   cl_ctr_test_complement();
+  cl_ctr_test_change_type();
 
   return 1;
 }
@@ -3,26 +3,49 @@
 
 #include "cl_types.h"
 
+/**
+ * A value used by scripts, tagged with its type. Counters of type
+ * CL_MEMTYPE_FLOAT or CL_MEMTYPE_DOUBLE hold a double in "fp", and counters of
+ * any other type hold an integer in "i64". The other representation is only
+ * computed when it is asked for.
+ **/
 typedef struct cl_counter_t
 {
   union
   {
     int64_t i64;
     uint64_t raw;
-  } intval;
-  union
-  {
     double fp;
-    uint64_t raw;
-  } floatval;
+  } value;
   unsigned type;
 } cl_counter_t;
 
 bool cl_ctr_store(cl_counter_t *counter, const void *src, unsigned type);
 bool cl_ctr_store_int(cl_counter_t *counter, int64_t value);
+
+/**
+ * Stores a floating point value in a counter. Counters not already holding a
+ * floating point value become CL_MEMTYPE_DOUBLE.
+ **/
 bool cl_ctr_store_float(cl_counter_t *counter, double value);
 
+/**
+ * Returns the value of a counter as an integer. Floating point values are
+ * truncated.
+ **/
+int64_t cl_ctr_get_int(const cl_counter_t *counter);
+
+/**
+ * Returns the value of a counter as a floating point value.
+ **/
+double cl_ctr_get_float(const cl_counter_t *counter);
+
 bool cl_ctr_equal(const cl_counter_t *left, const cl_counter_t *right);
+
+/**
+ * Returns whether two counters hold the same kind of value with the same bits.
+ * Unlike cl_ctr_equal, floating point values must match exactly.
+ **/
 bool cl_ctr_equal_exact(const cl_counter_t *left, const cl_counter_t *right);
 bool cl_ctr_not_equal(const cl_counter_t *left, const cl_counter_t *right);
 bool cl_ctr_lesser(const cl_counter_t *left, const cl_counter_t *right);
@@ -42,14 +65,14 @@ bool cl_ctr_is_float(const cl_counter_t *counter);
 /**
  * Shifts a counter value to the left. Changes counter type to int.
  * @param counter The target counter value.
- * @param value The number of bits to shift left, taken from intval.
+ * @param value The number of bits to shift left, as an integer.
  **/
 bool cl_ctr_shift_left(cl_counter_t *counter, const cl_counter_t *value);
 
 /**
  * Shifts a counter value to the right. Changes counter type to int.
  * @param counter The target counter value.
- * @param value The number of bits to shift right, taken from intval.
+ * @param value The number of bits to shift right, as an integer.
  **/
 bool cl_ctr_shift_right(cl_counter_t *counter, const cl_counter_t *value);
 
@@ -69,6 +92,10 @@ bool cl_ctr_multiply(cl_counter_t *left, const cl_counter_t *right);
 bool cl_ctr_divide(cl_counter_t *left, const cl_counter_t *right);
 bool cl_ctr_modulo(cl_counter_t *left, const cl_counter_t *right);
 
+/**
+ * Changes the type of a counter, converting its value between integer and
+ * floating point if needed.
+ **/
 bool cl_ctr_change_type(cl_counter_t *counter, unsigned type);
 
 #endif
@@ -91,7 +91,8 @@ bool cl_fe_user_data(cl_user_t *user, unsigned index);
 
 /**
  * These frontend functions are only used for frontends that need to interface
- * with the memory of another process via an operating system.
+ * with the memory of another process via an operating system. On Linux hosts,
+ * cl_linux.c supplies them if CL_EXTERNAL_MEMORY_LINUX is true.
  */
 #if CL_EXTERNAL_MEMORY
 #include <cl_memory.h>
@@ -111,6 +112,24 @@ bool cl_fe_user_data(cl_user_t *user, unsigned index);
 unsigned cl_fe_memory_read(cl_memory_t *memory, void *dest, cl_addr_t address,
                            unsigned size);
 
+#if CL_EXTERNAL_MEMORY_BATCH
+/**
+ * Instructs the frontend to copy several portions of external memory into
+ * buffers at once. Used to read memory notes every frame.
+ * 
+ * Can be implemented by calling cl_fe_memory_read for each request. On Linux,
+ * cl_linux_read_batch reads them with as few system calls as possible.
+ * 
+ * @param reads The requests. The "read" member of each is set to the number
+ * of bytes successfully read.
+ * @param count The number of requests.
+ * 
+ * @return The total number of bytes successfully read.
+ */
+unsigned cl_fe_memory_read_batch(cl_memory_t *memory, cl_memory_read_t *reads,
+                                 unsigned count);
+#endif
+
 /**
  * Instructs the frontend to copy data to external memory.
  * 
@@ -129,6 +148,9 @@ unsigned cl_fe_memory_write(cl_memory_t *memory, const void *src,
  * Requests a deep copy of host memory into a search struct.
  * 
  * Can be stubbed if the editor is not used in this implementation.
+ * 
+ * If the frontend knows which pages changed since a search bank's last copy,
+ * it can say so in the bank's "dirty" map to let the search skip the rest.
  */
 bool cl_fe_search_deep_copy(cl_search_t *search);
 #endif
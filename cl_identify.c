@@ -88,6 +88,7 @@ static void cl_task_gcwii(cl_task_t *task)
     retro_sleep(5);
 
     cl_fe_install_membanks();
+    cl_memory_index_regions();
       
     /* When memory has been initialized, 0x20 in memory is 0D15EA5E. */
     if (memory.regions[0].base_host &&
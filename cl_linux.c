@@ -0,0 +1,928 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#ifndef _FILE_OFFSET_BITS
+#define _FILE_OFFSET_BITS 64
+#endif
+
+#include "cl_linux.h"
+
+#if CL_HOST_PLATFORM == CL_PLATFORM_LINUX
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "cl_common.h"
+#include "cl_frontend.h"
+
+/* The most requests given to one process_vm_readv call */
+#define CL_LINUX_IOVECS 256
+
+/* The size of the chunks regions are deep copied in */
+#define CL_LINUX_COPY_CHUNK (1 << 20)
+
+/* The bit of a /proc/<pid>/pagemap entry set for pages written since the
+   soft-dirty bits were last cleared */
+#define CL_LINUX_PAGEMAP_SOFT_DIRTY 55
+
+/**
+ * A local copy of a region of the attached process.
+ **/
+typedef struct cl_linux_copy_t
+{
+  uint8_t *data;
+
+  /* The generation each host page of the copy was last copied on */
+  unsigned *generations;
+
+  /* One bit per host page written by the process since it was last copied */
+  uint64_t *stale;
+} cl_linux_copy_t;
+
+/**
+ * The process being inspected, and how its memory is being read.
+ **/
+typedef struct cl_linux_process_t
+{
+  pid_t pid;
+
+  /* /proc/<pid>/mem, opened the first time it is needed, or -1 */
+  int mem;
+
+  /* Whether process_vm_readv is unavailable, so /proc/<pid>/mem is used */
+  bool use_mem;
+
+  /* Local copies made by cl_linux_deep_copy, one per entry of the region
+     array they were made for */
+  cl_linux_copy_t          *copies;
+  const cl_memory_region_t *copies_regions;
+  unsigned                  copies_count;
+
+  /* Incremented on every deep copy, and never reset, so search banks can
+     tell which pages changed since they last saw a copy */
+  unsigned generation;
+} cl_linux_process_t;
+
+static cl_linux_process_t cl_linux_process =
+  { 0, -1, false, NULL, NULL, 0, 0 };
+
+static void cl_linux_free_copies(void)
+{
+  unsigned i, j;
+
+  for (i = 0; i < cl_linux_process.copies_count; i++)
+  {
+    /* Regions still pointing at a copy are left without one */
+    if (cl_linux_process.copies[i].data)
+      for (j = 0; j < memory.region_count; j++)
+        if (memory.regions[j].base_host == cl_linux_process.copies[i].data)
+          memory.regions[j].base_host = NULL;
+    free(cl_linux_process.copies[i].data);
+    free(cl_linux_process.copies[i].generations);
+    free(cl_linux_process.copies[i].stale);
+  }
+  free(cl_linux_process.copies);
+  cl_linux_process.copies = NULL;
+  cl_linux_process.copies_regions = NULL;
+  cl_linux_process.copies_count = 0;
+}
+
+bool cl_linux_attach(pid_t pid)
+{
+  cl_linux_detach();
+  if (pid <= 0 || (kill(pid, 0) != 0 && errno == ESRCH))
+    return false;
+  cl_linux_process.pid = pid;
+
+  return true;
+}
+
+void cl_linux_detach(void)
+{
+  if (cl_linux_process.mem >= 0)
+    close(cl_linux_process.mem);
+  cl_linux_process.pid = 0;
+  cl_linux_process.mem = -1;
+  cl_linux_process.use_mem = false;
+  cl_linux_free_copies();
+}
+
+/**
+ * Returns a descriptor for /proc/<pid>/mem of the attached process, opening it
+ * the first time, or -1 if it cannot be opened.
+ **/
+static int cl_linux_mem(void)
+{
+  if (cl_linux_process.mem < 0 && cl_linux_process.pid > 0)
+  {
+    char path[64];
+
+    snprintf(path, sizeof(path), "/proc/%d/mem", (int)cl_linux_process.pid);
+    cl_linux_process.mem = open(path, O_RDWR);
+    if (cl_linux_process.mem < 0)
+      cl_linux_process.mem = open(path, O_RDONLY);
+  }
+
+  return cl_linux_process.mem;
+}
+
+/**
+ * Whether an error from process_vm_readv or process_vm_writev means the calls
+ * are unavailable, rather than that an address was bad. Kernels can be built
+ * without them, and container sandboxes often block them.
+ **/
+static bool cl_linux_vm_unavailable(int error)
+{
+  return error == ENOSYS || error == EPERM;
+}
+
+static unsigned cl_linux_pread(void *dest, cl_addr_t address, unsigned size)
+{
+  int fd = cl_linux_mem();
+
+  if (fd < 0)
+    return 0;
+  else
+    return pread(fd, dest, size, (off_t)address) == (ssize_t)size ? size : 0;
+}
+
+unsigned cl_linux_read_batch(cl_memory_read_t *reads, unsigned count)
+{
+  struct iovec local[CL_LINUX_IOVECS];
+  struct iovec remote[CL_LINUX_IOVECS];
+  unsigned total = 0;
+  unsigned i;
+
+  for (i = 0; i < count; i++)
+    reads[i].read = 0;
+
+  i = 0;
+  while (i < count && !cl_linux_process.use_mem)
+  {
+    unsigned batch = count - i;
+    ssize_t  result;
+    unsigned j;
+
+    if (batch > CL_LINUX_IOVECS)
+      batch = CL_LINUX_IOVECS;
+
+    for (j = 0; j < batch; j++)
+    {
+      local[j].iov_base = reads[i + j].dest;
+      local[j].iov_len = reads[i + j].size;
+      remote[j].iov_base = (void*)reads[i + j].address;
+      remote[j].iov_len = reads[i + j].size;
+    }
+    result = process_vm_readv(cl_linux_process.pid, local, batch, remote,
+                              batch, 0);
+
+    if (result < 0)
+    {
+      if (cl_linux_vm_unavailable(errno))
+        cl_linux_process.use_mem = true;
+      else if (errno != EFAULT)
+        return total;
+      else
+        /* Only a bad address is specific to the first request */
+        i++;
+      continue;
+    }
+
+    /* Requests are never split, so the reads stop at the first failure */
+    for (j = 0; j < batch && (size_t)result >= reads[i + j].size; j++)
+    {
+      reads[i + j].read = reads[i + j].size;
+      result -= reads[i + j].size;
+      total += reads[i + j].size;
+    }
+
+    /* Skip past the request that failed, if any */
+    i += j < batch ? j + 1 : batch;
+  }
+
+  /* Without process_vm_readv, read each request through /proc/<pid>/mem */
+  for (; i < count; i++)
+  {
+    reads[i].read = cl_linux_pread(reads[i].dest, reads[i].address,
+                                   reads[i].size);
+    total += reads[i].read;
+  }
+
+  return total;
+}
+
+unsigned cl_linux_read(void *dest, cl_addr_t address, unsigned size)
+{
+  cl_memory_read_t read;
+
+  read.address = address;
+  read.dest = dest;
+  read.size = size;
+
+  return cl_linux_read_batch(&read, 1);
+}
+
+unsigned cl_linux_write(const void *src, cl_addr_t address, unsigned size)
+{
+  int fd;
+
+  if (!cl_linux_process.use_mem)
+  {
+    struct iovec local, remote;
+    ssize_t result;
+
+    local.iov_base = (void*)src;
+    local.iov_len = size;
+    remote.iov_base = (void*)address;
+    remote.iov_len = size;
+    result = process_vm_writev(cl_linux_process.pid, &local, 1, &remote, 1, 0);
+    if (result == (ssize_t)size)
+      return size;
+    else if (result < 0 && cl_linux_vm_unavailable(errno))
+      cl_linux_process.use_mem = true;
+  }
+
+  /* Read-only mappings can still be written through /proc/<pid>/mem */
+  fd = cl_linux_mem();
+  if (fd < 0)
+    return 0;
+  else
+    return pwrite(fd, src, size, (off_t)address) == (ssize_t)size ? size : 0;
+}
+
+bool cl_linux_init_membanks(void)
+{
+  char     line[4352];
+  FILE    *maps;
+  unsigned capacity = 0;
+  unsigned i;
+
+  snprintf(line, sizeof(line), "/proc/%d/maps", (int)cl_linux_process.pid);
+  maps = fopen(line, "r");
+  if (!maps)
+    return false;
+  cl_linux_free_membanks();
+
+  while (fgets(line, sizeof(line), maps))
+  {
+    unsigned long long start, end, offset, inode;
+    unsigned major, minor;
+    char perms[5];
+    const char *name;
+    int name_pos = 0;
+    cl_memory_region_t *region;
+
+    line[strcspn(line, "\n")] = '\0';
+    if (sscanf(line, "%llx-%llx %4s %llx %x:%x %llu %n", &start, &end, perms,
+               &offset, &major, &minor, &inode, &name_pos) < 7 || !name_pos)
+      continue;
+    name = &line[name_pos];
+
+    /* Guard pages and the kernel's data pages cannot be read */
+    if (perms[0] != 'r' || start >= end || !strncmp(name, "[vvar", 5) ||
+        !strcmp(name, "[vsyscall]"))
+      continue;
+
+    if (memory.region_count == capacity)
+    {
+      cl_memory_region_t *regions;
+
+      capacity = capacity ? capacity * 2 : 64;
+      regions = (cl_memory_region_t*)realloc(memory.regions,
+        capacity * sizeof(cl_memory_region_t));
+      if (!regions)
+        break;
+      memory.regions = regions;
+    }
+    region = &memory.regions[memory.region_count++];
+    memset(region, 0, sizeof(*region));
+
+    region->base_alloc = CL_ADDRESS_INVALID;
+    region->base_guest = (cl_addr_t)start;
+    region->base_host = NULL;
+    region->endianness = CL_ENDIAN_NATIVE;
+    region->pointer_length = sizeof(void*);
+    region->size = (cl_addr_t)(end - start);
+    region->flags.bits.commit = 1;
+    region->flags.bits.read = 1;
+    region->flags.bits.write = perms[1] == 'w';
+    region->flags.bits.execute = perms[2] == 'x';
+    region->flags.bits.privated = perms[3] == 'p';
+    region->flags.bits.mapped = inode != 0;
+    /* Paths can be longer than a title, so are cut short to fit */
+    snprintf(region->title, sizeof(region->title), "%.*s",
+             (int)sizeof(region->title) - 1, *name ? name : "Anonymous");
+  }
+  fclose(maps);
+
+  /* The maps file is already sorted by address */
+  cl_memory_index_regions();
+
+  for (i = 0; i < memory.region_count; i++)
+    cl_log("Bank %02X: 0x%08llX | %08llX bytes | %s\n", i,
+           (unsigned long long)memory.regions[i].base_guest,
+           (unsigned long long)memory.regions[i].size,
+           memory.regions[i].title);
+
+  return memory.region_count != 0;
+}
+
+void cl_linux_free_membanks(void)
+{
+  cl_linux_free_copies();
+  free(memory.regions);
+  memory.regions = NULL;
+  memory.region_count = 0;
+  cl_memory_index_regions();
+}
+
+/**
+ * Copies one region into its local copy, a batch of chunks at a time.
+ **/
+static bool cl_linux_copy_region(cl_memory_region_t *region)
+{
+  cl_memory_read_t reads[CL_LINUX_IOVECS];
+  uint8_t  *copy = (uint8_t*)region->base_host;
+  cl_addr_t offset = 0;
+  bool      success = true;
+
+  while (offset < region->size)
+  {
+    unsigned count, i;
+
+    for (count = 0; count < CL_LINUX_IOVECS && offset < region->size; count++)
+    {
+      cl_addr_t size = region->size - offset;
+
+      if (size > CL_LINUX_COPY_CHUNK)
+        size = CL_LINUX_COPY_CHUNK;
+      reads[count].address = region->base_guest + offset;
+      reads[count].dest = &copy[offset];
+      reads[count].size = (unsigned)size;
+      offset += size;
+    }
+    cl_linux_read_batch(reads, count);
+
+    for (i = 0; i < count; i++)
+    {
+      if (reads[i].read != reads[i].size)
+      {
+        memset(reads[i].dest, 0, reads[i].size);
+        success = false;
+      }
+    }
+  }
+
+  return success;
+}
+
+static cl_addr_t cl_linux_page_size(void)
+{
+  static cl_addr_t page_size = 0;
+
+  /* Never smaller than a search page on Linux */
+  if (!page_size)
+    page_size = (cl_addr_t)sysconf(_SC_PAGESIZE);
+
+  return page_size;
+}
+
+/**
+ * Returns the number of host pages covering a region.
+ **/
+static cl_addr_t cl_linux_page_count(const cl_memory_region_t *region)
+{
+  return (region->size + cl_linux_page_size() - 1) / cl_linux_page_size();
+}
+
+static bool cl_linux_clear_refs(const char *process)
+{
+  char path[64];
+  bool success;
+  int  fd;
+
+  snprintf(path, sizeof(path), "/proc/%s/clear_refs", process);
+  fd = open(path, O_WRONLY);
+  if (fd < 0)
+    return false;
+  success = write(fd, "4", 1) == 1;
+  close(fd);
+
+  return success;
+}
+
+static bool cl_linux_pagemap_dirty(int pagemap, cl_addr_t address)
+{
+  uint64_t entry;
+
+  return pread(pagemap, &entry, sizeof(entry),
+               (off_t)(address / cl_linux_page_size() * sizeof(entry))) ==
+           sizeof(entry) &&
+         ((entry >> CL_LINUX_PAGEMAP_SOFT_DIRTY) & 1);
+}
+
+/**
+ * Checks once whether the kernel tracks soft-dirty pages, by clearing the bits
+ * of this process and writing to a page of its own. Kernels built without
+ * them accept clear_refs, but never set the bit.
+ **/
+static bool cl_linux_soft_dirty_supported(void)
+{
+  static int supported = -1;
+
+  if (supported < 0)
+  {
+    volatile uint8_t *page;
+    int pagemap = open("/proc/self/pagemap", O_RDONLY);
+
+    supported = 0;
+    page = (volatile uint8_t*)mmap(NULL, cl_linux_page_size(),
+                                   PROT_READ | PROT_WRITE,
+                                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (pagemap >= 0 && page != MAP_FAILED)
+    {
+      page[0] = 1;
+      if (cl_linux_clear_refs("self") &&
+          !cl_linux_pagemap_dirty(pagemap, (cl_addr_t)page))
+      {
+        page[0] = 2;
+        supported = cl_linux_pagemap_dirty(pagemap, (cl_addr_t)page);
+      }
+    }
+    if (page != MAP_FAILED)
+      munmap((void*)page, cl_linux_page_size());
+    if (pagemap >= 0)
+      close(pagemap);
+  }
+
+  return supported == 1;
+}
+
+/**
+ * Marks the pages of a copy the process wrote to since the soft-dirty bits
+ * were last cleared as stale. If /proc/<pid>/pagemap cannot be read, every
+ * page is.
+ **/
+static void cl_linux_read_pagemap(int pagemap,
+  const cl_memory_region_t *region, cl_linux_copy_t *copy)
+{
+  const cl_addr_t page_size = cl_linux_page_size();
+  const cl_addr_t first = region->base_guest / page_size;
+  const cl_addr_t pages = cl_linux_page_count(region);
+  uint64_t  entries[512];
+  cl_addr_t i, j;
+
+  for (i = 0; i < pages; i += 512)
+  {
+    cl_addr_t count = pages - i < 512 ? pages - i : 512;
+    bool read = pagemap >= 0 &&
+      pread(pagemap, entries, count * sizeof(uint64_t),
+            (off_t)((first + i) * sizeof(uint64_t))) ==
+        (ssize_t)(count * sizeof(uint64_t));
+
+    for (j = 0; j < count; j++)
+      if (!read || ((entries[j] >> CL_LINUX_PAGEMAP_SOFT_DIRTY) & 1))
+        copy->stale[(i + j) / 64] |= 1ULL << ((i + j) % 64);
+  }
+}
+
+/**
+ * Gathers which pages of every copy the process wrote to, then clears the
+ * soft-dirty bits so the next deep copy only sees later writes.
+ * Pages written between reading a copy's pagemap and clearing the bits are
+ * not seen as stale until they are written again, so the two are kept as
+ * close together as possible. Stopping the process would close the gap, but
+ * would also interrupt it on every search step.
+ * @return Whether the bits were cleared. If not, every page must be copied.
+ **/
+static bool cl_linux_collect_stale(void)
+{
+  char     path[64];
+  int      pagemap;
+  unsigned i;
+
+  if (!CL_EXTERNAL_MEMORY_SOFT_DIRTY || !cl_linux_soft_dirty_supported())
+    return false;
+  snprintf(path, sizeof(path), "/proc/%d/pagemap", (int)cl_linux_process.pid);
+  pagemap = open(path, O_RDONLY);
+  for (i = 0; i < cl_linux_process.copies_count; i++)
+    if (cl_linux_process.copies[i].data)
+      cl_linux_read_pagemap(pagemap, &memory.regions[i],
+                            &cl_linux_process.copies[i]);
+  if (pagemap < 0)
+    return false;
+  close(pagemap);
+  snprintf(path, sizeof(path), "%d", (int)cl_linux_process.pid);
+
+  return cl_linux_clear_refs(path);
+}
+
+/**
+ * Returns the copy of a region made by this backend, allocating it if the
+ * region has no local copy yet, or NULL if the region's local copy belongs
+ * to someone else.
+ **/
+static cl_linux_copy_t* cl_linux_copy_for(cl_memory_region_t *region)
+{
+  const cl_addr_t pages = cl_linux_page_count(region);
+  cl_linux_copy_t *copy;
+
+  if (region < memory.regions ||
+      region >= memory.regions + memory.region_count)
+    return NULL;
+  copy = &cl_linux_process.copies[region - memory.regions];
+  if (copy->data)
+    return copy->data == region->base_host ? copy : NULL;
+  else if (region->base_host)
+    return NULL;
+
+  /* Every page of a new copy needs to be read */
+  copy->data = (uint8_t*)malloc(region->size);
+  copy->generations = (unsigned*)calloc(pages, sizeof(unsigned));
+  copy->stale = (uint64_t*)malloc((pages + 63) / 64 * sizeof(uint64_t));
+  if (!copy->data || !copy->generations || !copy->stale)
+  {
+    free(copy->data);
+    free(copy->generations);
+    free(copy->stale);
+    memset(copy, 0, sizeof(*copy));
+    return NULL;
+  }
+  memset(copy->stale, 0xFF, (pages + 63) / 64 * sizeof(uint64_t));
+  region->base_host = copy->data;
+
+  return copy;
+}
+
+/**
+ * Copies the stale pages of a copy from the process, merged into chunks.
+ * Pages that cannot be read are zeroed.
+ **/
+static bool cl_linux_copy_stale(cl_memory_region_t *region,
+  cl_linux_copy_t *copy)
+{
+  const cl_addr_t page_size = cl_linux_page_size();
+  const cl_addr_t pages = cl_linux_page_count(region);
+  cl_memory_read_t reads[CL_LINUX_IOVECS];
+  bool      success = true;
+  cl_addr_t page = 0;
+
+  while (page < pages)
+  {
+    unsigned count, i;
+
+    for (count = 0; count < CL_LINUX_IOVECS && page < pages; page++)
+    {
+      cl_addr_t offset = page * page_size;
+      cl_addr_t size = page_size;
+
+      if (!((copy->stale[page / 64] >> (page % 64)) & 1))
+        continue;
+      copy->stale[page / 64] &= ~(1ULL << (page % 64));
+      copy->generations[page] = cl_linux_process.generation;
+      if (offset + size > region->size)
+        size = region->size - offset;
+
+      /* Extend the last chunk if this page follows it */
+      if (count && reads[count - 1].address + reads[count - 1].size ==
+                     region->base_guest + offset &&
+          reads[count - 1].size + size <= CL_LINUX_COPY_CHUNK)
+        reads[count - 1].size += (unsigned)size;
+      else
+      {
+        reads[count].address = region->base_guest + offset;
+        reads[count].dest = &copy->data[offset];
+        reads[count].size = (unsigned)size;
+        count++;
+      }
+    }
+    cl_linux_read_batch(reads, count);
+
+    for (i = 0; i < count; i++)
+    {
+      if (reads[i].read != reads[i].size)
+      {
+        memset(reads[i].dest, 0, reads[i].size);
+        success = false;
+      }
+    }
+  }
+
+  return success;
+}
+
+/**
+ * Sets the bits of a search bank's page map for the pages of a copy that
+ * changed since the bank last saw it.
+ **/
+static bool cl_linux_mark_dirty(cl_searchbank_t *sbank,
+  const cl_linux_copy_t *copy)
+{
+  const cl_addr_t page_size = cl_linux_page_size();
+  const cl_addr_t pages = (sbank->region->size + CL_SEARCH_PAGE_SIZE - 1) /
+                          CL_SEARCH_PAGE_SIZE;
+  cl_addr_t i;
+
+  if (!sbank->dirty)
+  {
+    sbank->dirty = (uint64_t*)malloc((pages + 63) / 64 * sizeof(uint64_t));
+    if (!sbank->dirty)
+      return false;
+  }
+  memset(sbank->dirty, 0, (pages + 63) / 64 * sizeof(uint64_t));
+  for (i = 0; i < pages; i++)
+    if (copy->generations[i * CL_SEARCH_PAGE_SIZE / page_size] >
+        sbank->copy_generation)
+      sbank->dirty[i / 64] |= 1ULL << (i % 64);
+  sbank->copy_generation = cl_linux_process.generation;
+
+  return true;
+}
+
+bool cl_linux_deep_copy(cl_search_t *search)
+{
+  bool     success = true;
+  bool     tracked;
+  unsigned i;
+
+  if (!search)
+    return false;
+
+  /* Copies made for a previous set of regions are no longer used */
+  if (cl_linux_process.copies_regions != memory.regions ||
+      cl_linux_process.copies_count != memory.region_count)
+  {
+    cl_linux_free_copies();
+    cl_linux_process.copies = (cl_linux_copy_t*)calloc(
+      memory.region_count + 1, sizeof(cl_linux_copy_t));
+    if (!cl_linux_process.copies)
+      return false;
+    cl_linux_process.copies_regions = memory.regions;
+    cl_linux_process.copies_count = memory.region_count;
+  }
+  tracked = cl_linux_collect_stale();
+  cl_linux_process.generation++;
+
+  for (i = 0; i < search->searchbank_count; i++)
+  {
+    cl_searchbank_t *sbank = &search->searchbanks[i];
+    cl_linux_copy_t *copy = cl_linux_copy_for(sbank->region);
+
+    if (copy)
+    {
+      /* Without soft-dirty bits, any page could have been written */
+      if (!tracked)
+        memset(copy->stale, 0xFF,
+               (cl_linux_page_count(sbank->region) + 63) / 64 *
+               sizeof(uint64_t));
+      if (!cl_linux_copy_stale(sbank->region, copy))
+        success = false;
+      if (cl_linux_mark_dirty(sbank, copy))
+        continue;
+    }
+    else if (!sbank->region->base_host ||
+             !cl_linux_copy_region(sbank->region))
+      success = false;
+
+    /* Every page may have changed */
+    free(sbank->dirty);
+    sbank->dirty = NULL;
+  }
+
+  return success;
+}
+
+#if CL_EXTERNAL_MEMORY && CL_EXTERNAL_MEMORY_LINUX
+unsigned cl_fe_memory_read(cl_memory_t *memory, void *dest, cl_addr_t address,
+                           unsigned size)
+{
+  CL_UNUSED(memory);
+  return cl_linux_read(dest, address, size);
+}
+
+#if CL_EXTERNAL_MEMORY_BATCH
+unsigned cl_fe_memory_read_batch(cl_memory_t *memory, cl_memory_read_t *reads,
+                                 unsigned count)
+{
+  CL_UNUSED(memory);
+  return cl_linux_read_batch(reads, count);
+}
+#endif
+
+unsigned cl_fe_memory_write(cl_memory_t *memory, const void *src,
+                            cl_addr_t address, unsigned size)
+{
+  CL_UNUSED(memory);
+  return cl_linux_write(src, address, size);
+}
+
+bool cl_fe_search_deep_copy(cl_search_t *search)
+{
+  return cl_linux_deep_copy(search);
+}
+#endif
+
+#if CL_TESTS
+#include <sys/wait.h>
+
+#define CL_LINUX_TEST_SIZE 65536
+
+static uint8_t cl_linux_test_value(unsigned offset)
+{
+  return (uint8_t)(offset * 7 + 3);
+}
+
+/**
+ * The dummy target process, standing in for an emulator. Maps a region of
+ * known values and a read-only page, sends their addresses up a pipe, then
+ * waits to be killed.
+ **/
+static void cl_linux_test_target(int pipe)
+{
+  uint8_t *addresses[2];
+  unsigned i;
+
+  addresses[0] = (uint8_t*)mmap(NULL, CL_LINUX_TEST_SIZE,
+                                PROT_READ | PROT_WRITE,
+                                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  addresses[1] = (uint8_t*)mmap(NULL, 4096, PROT_READ,
+                                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (addresses[0] == MAP_FAILED || addresses[1] == MAP_FAILED)
+    _exit(1);
+  for (i = 0; i < CL_LINUX_TEST_SIZE; i++)
+    addresses[0][i] = cl_linux_test_value(i);
+  if (write(pipe, addresses, sizeof(addresses)) != sizeof(addresses))
+    _exit(1);
+  for (;;)
+    pause();
+}
+
+/**
+ * Reads, writes and batch reads the memory of the dummy target.
+ * @return 0 on success, or the number of the check that failed.
+ **/
+static int cl_linux_test_access(uint8_t *data, uint8_t *rodata)
+{
+  cl_memory_read_t reads[3];
+  uint8_t  buffers[3][8];
+  uint32_t value = 0xC1A55105;
+  uint32_t check = 0;
+  unsigned i;
+
+  if (cl_linux_read(buffers[0], (cl_addr_t)&data[100], 8) != 8)
+    return 1;
+  for (i = 0; i < 8; i++)
+    if (buffers[0][i] != cl_linux_test_value(100 + i))
+      return 2;
+
+  if (cl_linux_write(&value, (cl_addr_t)&data[200], 4) != 4 ||
+      cl_linux_read(&check, (cl_addr_t)&data[200], 4) != 4 || check != value)
+    return 3;
+  value++;
+  if (cl_linux_write(&value, (cl_addr_t)rodata, 4) != 4 ||
+      cl_linux_read(&check, (cl_addr_t)rodata, 4) != 4 || check != value)
+    return 4;
+
+  /* An unmapped address in the middle should not stop the rest */
+  for (i = 0; i < 3; i++)
+  {
+    reads[i].address = (cl_addr_t)&data[CL_LINUX_TEST_SIZE - 8 * (i + 1)];
+    reads[i].dest = buffers[i];
+    reads[i].size = 8;
+  }
+  reads[1].address = 16;
+  if (cl_linux_read_batch(reads, 3) != 16 || reads[1].read)
+    return 5;
+  for (i = 0; i < 8; i++)
+    if (buffers[2][i] != cl_linux_test_value(CL_LINUX_TEST_SIZE - 24 + i))
+      return 6;
+
+  return 0;
+}
+
+static bool cl_linux_test_dirty(const cl_searchbank_t *sbank,
+  cl_addr_t offset)
+{
+  const cl_addr_t page = offset / CL_SEARCH_PAGE_SIZE;
+
+  return sbank->dirty && ((sbank->dirty[page / 64] >> (page % 64)) & 1);
+}
+
+/**
+ * Deep copies a region of the dummy target twice, writing to it in between.
+ * @return 0 on success, or the number of the check that failed.
+ **/
+static int cl_linux_test_copy(cl_memory_region_t *region, uint8_t *data)
+{
+  const cl_addr_t offset = (cl_addr_t)data - region->base_guest;
+  const cl_addr_t written = offset + CL_LINUX_TEST_SIZE / 2;
+  const uint8_t value = 0xA5;
+  cl_searchbank_t bank;
+  cl_search_t search;
+  int result = 0;
+  unsigned i;
+
+  memset(&bank, 0, sizeof(bank));
+  memset(&search, 0, sizeof(search));
+  bank.region = region;
+  search.searchbanks = &bank;
+  search.searchbank_count = 1;
+
+  /* Every page of a new copy has changed */
+  if (!cl_linux_deep_copy(&search) || !region->base_host ||
+      !cl_linux_test_dirty(&bank, offset))
+    result = 1;
+  for (i = 0; i < 100 && !result; i++)
+    if (((uint8_t*)region->base_host)[offset + i] != cl_linux_test_value(i))
+      result = 2;
+
+  /* Only the written page has changed since, if the kernel can tell */
+  if (!result &&
+      (cl_linux_write(&value, region->base_guest + written, 1) != 1 ||
+       !cl_linux_deep_copy(&search) ||
+       ((uint8_t*)region->base_host)[written] != value ||
+       !cl_linux_test_dirty(&bank, written)))
+    result = 3;
+  else if (!result && cl_linux_soft_dirty_supported() &&
+           CL_EXTERNAL_MEMORY_SOFT_DIRTY &&
+           cl_linux_test_dirty(&bank, offset))
+    result = 4;
+  free(bank.dirty);
+
+  return result;
+}
+
+int cl_linux_tests(void)
+{
+  uint8_t *addresses[2];
+  cl_memory_region_t *region = NULL;
+  int   pipes[2];
+  pid_t child;
+  int   result;
+
+  if (pipe(pipes))
+    return 0;
+  child = fork();
+  if (child < 0)
+    return 0;
+  else if (child == 0)
+  {
+    close(pipes[0]);
+    cl_linux_test_target(pipes[1]);
+  }
+  close(pipes[1]);
+
+  if (read(pipes[0], addresses, sizeof(addresses)) != sizeof(addresses) ||
+      !cl_linux_attach(child))
+    result = 1;
+  else if (!cl_linux_init_membanks())
+    result = 2;
+  /* The region of known values should be found and described correctly */
+  else if (!(region = cl_find_memory_region((cl_addr_t)addresses[0])) ||
+           region->size < CL_LINUX_TEST_SIZE || !region->flags.bits.read ||
+           !region->flags.bits.write || region->flags.bits.execute ||
+           !region->flags.bits.privated || region->flags.bits.mapped)
+    result = 3;
+  else if ((result = cl_linux_test_access(addresses[0], addresses[1])) != 0)
+    result += 10;
+  else
+  {
+    /* Again through /proc/<pid>/mem, as if process_vm_readv was blocked */
+    cl_linux_process.use_mem = true;
+    result = cl_linux_test_access(addresses[0], addresses[1]);
+    if (result)
+      result += 20;
+  }
+  close(pipes[0]);
+
+  if (!result && (result = cl_linux_test_copy(region, addresses[0])) != 0)
+    result += 30;
+
+  /* Detaching frees the copies, so regions must no longer point at them */
+  if (!result && !region->base_host)
+    result = 40;
+  else if (!result)
+  {
+    cl_linux_detach();
+    if (region->base_host)
+      result = 41;
+  }
+
+  kill(child, SIGKILL);
+  waitpid(child, NULL, 0);
+  cl_linux_free_membanks();
+  cl_linux_detach();
+  if (result)
+    CL_TEST_FAIL(result);
+
+  return 1;
+}
+#endif
+
+#endif
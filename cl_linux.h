@@ -0,0 +1,97 @@
+#ifndef CL_LINUX_H
+#define CL_LINUX_H
+
+#include "cl_config.h"
+#include "cl_memory.h"
+#include "cl_search.h"
+
+#if CL_HOST_PLATFORM == CL_PLATFORM_LINUX
+#include <sys/types.h>
+
+/**
+ * @file cl_linux.h
+ * A backend for inspecting the memory of another process on Linux hosts.
+ * Memory is read with process_vm_readv, or through /proc/<pid>/mem if that is
+ * unavailable. If CL_EXTERNAL_MEMORY_LINUX is true, this also supplies the
+ * external memory functions of cl_frontend.h.
+ *
+ * Regions keep the address they have in the other process as their guest
+ * address. Their host pointer is a local copy, allocated and filled by
+ * cl_linux_deep_copy for memory searches to read.
+ */
+
+/**
+ * Selects the process to inspect. Reading requires the same permission as
+ * attaching a debugger to it.
+ * @param pid The process ID.
+ * @return Whether the process exists.
+ **/
+bool cl_linux_attach(pid_t pid);
+
+/**
+ * Stops inspecting the process selected with cl_linux_attach.
+ **/
+void cl_linux_detach(void);
+
+/**
+ * Enumerates the readable mappings of the attached process from
+ * /proc/<pid>/maps into the memory regions of the global memory context,
+ * replacing any it had. Suitable for implementing cl_fe_install_membanks.
+ * @return Whether any regions were found.
+ **/
+bool cl_linux_init_membanks(void);
+
+/**
+ * Frees the memory regions made by cl_linux_init_membanks, along with the
+ * local copies of them made by cl_linux_deep_copy.
+ **/
+void cl_linux_free_membanks(void);
+
+/**
+ * Copies a portion of the attached process's memory into a buffer.
+ * @return The number of bytes read, which is either all or none of them.
+ **/
+unsigned cl_linux_read(void *dest, cl_addr_t address, unsigned size);
+
+/**
+ * Copies data into the attached process's memory. Writes to read-only
+ * mappings are retried through /proc/<pid>/mem, which allows them.
+ * @return The number of bytes written.
+ **/
+unsigned cl_linux_write(const void *src, cl_addr_t address, unsigned size);
+
+/**
+ * Copies several portions of the attached process's memory into buffers,
+ * using as few system calls as possible. Suitable for implementing
+ * cl_fe_memory_read_batch.
+ * @param reads The requests. The "read" member of each is set to the number
+ * of bytes read, which is either all or none of them.
+ * @param count The number of requests.
+ * @return The total number of bytes read.
+ **/
+unsigned cl_linux_read_batch(cl_memory_read_t *reads, unsigned count);
+
+/**
+ * Copies the regions of a search from the attached process into their local
+ * copies, allocating any that are missing. Regions are read in large chunks,
+ * and chunks that cannot be read are zeroed. Suitable for implementing
+ * cl_fe_search_deep_copy.
+ *
+ * If the kernel tracks soft-dirty pages, only pages the process wrote to since
+ * the last copy are read again, and each search bank's "dirty" map is set to
+ * the pages that changed since that bank's last copy.
+ * @return Whether every region was copied in full.
+ **/
+bool cl_linux_deep_copy(cl_search_t *search);
+
+#if CL_TESTS
+/**
+ * Forks a dummy target process standing in for an emulator, then finds,
+ * reads, writes and copies its memory through each path of the backend.
+ **/
+int cl_linux_tests(void);
+#endif
+
+#endif
+
+#endif
@@ -9,6 +9,7 @@
 #include "cl_memory.h"
 #include "cl_network.h"
 #include "cl_script.h"
+#include "cl_thread.h"
 
 /* Call C++ code only if the editor is built in */
 #if CL_HAVE_EDITOR
@@ -56,6 +57,7 @@ bool cl_init_session(const char* json)
 
   if (!cl_fe_install_membanks())
     return false;
+  cl_memory_index_regions();
   session.ready = true;
 
   /* Script-related */
@@ -189,6 +191,8 @@ bool cl_run()
 void cl_free(void)
 {
   cl_network_post(CL_REQUEST_CLOSE, "", NULL);
-  cl_memory_free();
+  /* Scripts hold references to memory notes, so are freed first */
   cl_script_free();
+  cl_memory_free();
+  cl_threadpool_shared_free();
 }
@@ -11,43 +11,746 @@
 
 cl_memory_t memory;
 
+#if defined(_MSC_VER)
+#define CL_THREAD_LOCAL __declspec(thread)
+#elif defined(__GNUC__)
+#define CL_THREAD_LOCAL __thread
+#else
+#define CL_THREAD_LOCAL
+#endif
+
+/**
+ * The size, in bytes, of each page in the guest page table, as a shift.
+ */
+#define CL_REGION_PAGE_BITS 16
+#define CL_REGION_PAGE_COUNT (1 << (32 - CL_REGION_PAGE_BITS))
+
+/* Page table entries for pages touched by no region, or by more than one */
+#define CL_REGION_PAGE_NONE  0
+#define CL_REGION_PAGE_MIXED 0xFFFF
+
+/**
+ * The fields of a memory region needed to translate a guest address, kept
+ * together and sorted by base address.
+ */
+typedef struct cl_region_entry_t
+{
+  cl_addr_t base;
+  cl_addr_t end;
+  void     *host;
+  unsigned  index;
+
+  /* The highest end of this region and every region sorted before it */
+  cl_addr_t reach;
+} cl_region_entry_t;
+
+typedef struct cl_region_index_t
+{
+  cl_region_entry_t *entries;
+  unsigned           count;
+
+  /**
+   * For guest address spaces of 32 bits or less, the only region touching
+   * each page plus one, or one of the CL_REGION_PAGE values. NULL otherwise.
+   */
+  uint16_t *pages;
+
+  /**
+   * Whether any regions overlap. Libretro memory descriptors can be nested,
+   * and an address in more than one region belongs to the first of them in
+   * the region array.
+   */
+  bool overlapping;
+
+  /* The region array the index was built from, to notice when it changes */
+  const cl_memory_region_t *regions;
+  unsigned                  region_count;
+} cl_region_index_t;
+
+static cl_region_index_t cl_region_index;
+
+/* The entry each thread found last, as lookups tend to repeat */
+static CL_THREAD_LOCAL unsigned cl_region_last_hit;
+
+static void cl_region_index_free(void)
+{
+  free(cl_region_index.entries);
+  free(cl_region_index.pages);
+  memset(&cl_region_index, 0, sizeof(cl_region_index));
+}
+
+void cl_memory_index_regions(void)
+{
+  cl_region_entry_t *entries;
+  unsigned count = 0;
+  unsigned i, j;
+  bool fits_32bit = true;
+
+  cl_region_index_free();
+  cl_region_index.regions = memory.regions;
+  cl_region_index.region_count = memory.region_count;
+  if (!memory.region_count)
+    return;
+  entries = (cl_region_entry_t*)calloc(memory.region_count,
+                                       sizeof(cl_region_entry_t));
+  if (!entries)
+    return;
+
+  /* Insert each region in order of base address */
+  for (i = 0; i < memory.region_count; i++)
+  {
+    const cl_memory_region_t *region = &memory.regions[i];
+    cl_region_entry_t entry;
+
+    if (!region->size)
+      continue;
+    entry.base  = region->base_guest;
+    entry.end   = region->base_guest + region->size;
+    entry.host  = region->base_host;
+    entry.index = i;
+    if (entry.end < entry.base || (uint64_t)(entry.end - 1) > 0xFFFFFFFFULL)
+      fits_32bit = false;
+    for (j = count; j > 0 && entries[j - 1].base > entry.base; j--)
+      entries[j] = entries[j - 1];
+    entries[j] = entry;
+    count++;
+  }
+  for (i = 0; i < count; i++)
+  {
+    entries[i].reach = entries[i].end;
+    if (i && entries[i - 1].reach > entries[i].base)
+    {
+      cl_region_index.overlapping = true;
+      if (entries[i - 1].reach > entries[i].reach)
+        entries[i].reach = entries[i - 1].reach;
+    }
+  }
+  cl_region_index.entries = entries;
+  cl_region_index.count = count;
+  cl_region_last_hit = 0;
+
+  /* Small guest address spaces can map each page straight to its region */
+  if (fits_32bit && count && count < CL_REGION_PAGE_MIXED)
+  {
+    uint16_t *pages = (uint16_t*)calloc(CL_REGION_PAGE_COUNT,
+                                        sizeof(uint16_t));
+
+    if (!pages)
+      return;
+    for (i = 0; i < count; i++)
+    {
+      cl_addr_t first = entries[i].base >> CL_REGION_PAGE_BITS;
+      cl_addr_t last = (entries[i].end - 1) >> CL_REGION_PAGE_BITS;
+      cl_addr_t page;
+
+      for (page = first; page <= last; page++)
+        pages[page] = pages[page] == CL_REGION_PAGE_NONE ?
+                      (uint16_t)(i + 1) : CL_REGION_PAGE_MIXED;
+    }
+    cl_region_index.pages = pages;
+  }
+}
+
+/**
+ * Finds the index entry holding a guest address. If several do, finds the
+ * one for the first of them in the region array.
+ */
+static const cl_region_entry_t* cl_region_index_find(cl_addr_t address)
+{
+  const cl_region_entry_t *entries = cl_region_index.entries;
+  const cl_region_entry_t *entry;
+  unsigned low, high;
+
+  if (!cl_region_index.count)
+    return NULL;
+
+  /* Try the region found last first, unless another may also hold it */
+  if (!cl_region_index.overlapping &&
+      cl_region_last_hit < cl_region_index.count)
+  {
+    entry = &entries[cl_region_last_hit];
+    if (entry->base <= address && address < entry->end)
+      return entry;
+  }
+
+  if (cl_region_index.pages)
+  {
+    unsigned page;
+
+    if ((uint64_t)address > 0xFFFFFFFFULL)
+      return NULL;
+    page = cl_region_index.pages[address >> CL_REGION_PAGE_BITS];
+    if (page == CL_REGION_PAGE_NONE)
+      return NULL;
+    else if (page != CL_REGION_PAGE_MIXED)
+    {
+      entry = &entries[page - 1];
+      if (entry->base <= address && address < entry->end)
+      {
+        cl_region_last_hit = page - 1;
+        return entry;
+      }
+      return NULL;
+    }
+  }
+
+  /* Find the last region starting at or before the address */
+  low = 0;
+  high = cl_region_index.count;
+  while (low < high)
+  {
+    unsigned middle = low + (high - low) / 2;
+
+    if (entries[middle].base <= address)
+      low = middle + 1;
+    else
+      high = middle;
+  }
+  if (low == 0)
+    return NULL;
+  else if (!cl_region_index.overlapping)
+  {
+    entry = &entries[low - 1];
+    if (address >= entry->end)
+      return NULL;
+    cl_region_last_hit = low - 1;
+
+    return entry;
+  }
+  else
+  {
+    const cl_region_entry_t *found = NULL;
+
+    /* Walk back over every region that may reach past the address */
+    for (; low > 0 && entries[low - 1].reach > address; low--)
+    {
+      entry = &entries[low - 1];
+      if (address < entry->end && (!found || entry->index < found->index))
+        found = entry;
+    }
+
+    return found;
+  }
+}
+
 cl_memory_region_t* cl_find_memory_region(cl_addr_t address)
 {
   if (memory.region_count == 0)
     return NULL;
   else if (memory.region_count == 1)
     return &memory.regions[0];
-  else
+  else if (cl_region_index.regions != memory.regions ||
+           cl_region_index.region_count != memory.region_count)
   {
-    cl_memory_region_t *region;
     unsigned i;
 
+    /**
+     * The regions were replaced without the index being rebuilt. Search them
+     * in order rather than rebuilding here, as this may run on any thread.
+     */
     for (i = 0; i < memory.region_count; i++)
+      if (memory.regions[i].base_guest <= address &&
+          address - memory.regions[i].base_guest < memory.regions[i].size)
+        return &memory.regions[i];
+
+    return NULL;
+  }
+  else
+  {
+    const cl_region_entry_t *entry = cl_region_index_find(address);
+
+    return entry ? &memory.regions[entry->index] : NULL;
+  }
+}
+
+/**
+ * Memory note keys below this are looked up directly in a table. Keys are
+ * currently documented as being between 0-999.
+ */
+#define CL_MEMNOTE_DIRECT_KEYS 1024
+
+typedef struct cl_memnote_index_t
+{
+  /* The memory note with each small key, or NULL */
+  cl_memnote_t *direct[CL_MEMNOTE_DIRECT_KEYS];
+
+  /* An open-addressing table for any larger keys, with a power of 2 size */
+  cl_memnote_t **hashed;
+  unsigned       hashed_mask;
+
+  /* The note array the index was built from, to notice when it changes */
+  const cl_memnote_t *notes;
+  unsigned            note_count;
+} cl_memnote_index_t;
+
+static cl_memnote_index_t cl_memnote_index;
+
+static unsigned cl_memnote_hash(unsigned key)
+{
+  return (key * 0x9E3779B1u) & cl_memnote_index.hashed_mask;
+}
+
+static void cl_memnote_index_free(void)
+{
+  free(cl_memnote_index.hashed);
+  memset(&cl_memnote_index, 0, sizeof(cl_memnote_index));
+}
+
+/**
+ * Builds the key lookup tables for the current memory notes. If two notes
+ * share a key, the first one is kept.
+ */
+static void cl_memnote_index_build(void)
+{
+  unsigned large = 0;
+  unsigned i;
+
+  cl_memnote_index_free();
+  cl_memnote_index.notes = memory.notes;
+  cl_memnote_index.note_count = memory.note_count;
+
+  for (i = 0; i < memory.note_count; i++)
+  {
+    cl_memnote_t *note = &memory.notes[i];
+
+    if (note->key < CL_MEMNOTE_DIRECT_KEYS)
     {
-      region = &memory.regions[i];
+      if (!cl_memnote_index.direct[note->key])
+        cl_memnote_index.direct[note->key] = note;
+    }
+    else
+      large++;
+  }
 
-      if (region->base_guest <= address &&
-        address < region->base_guest + region->size)
+  if (large)
+  {
+    unsigned size = 16;
+
+    /* Keep the table at most half full */
+    while (size < large * 2)
+      size *= 2;
+    cl_memnote_index.hashed = (cl_memnote_t**)calloc(size,
+                                                     sizeof(cl_memnote_t*));
+    if (!cl_memnote_index.hashed)
+      return;
+    cl_memnote_index.hashed_mask = size - 1;
 
-      return region;
+    for (i = 0; i < memory.note_count; i++)
+    {
+      cl_memnote_t *note = &memory.notes[i];
+      unsigned slot;
+
+      if (note->key < CL_MEMNOTE_DIRECT_KEYS)
+        continue;
+      for (slot = cl_memnote_hash(note->key);
+           cl_memnote_index.hashed[slot];
+           slot = (slot + 1) & cl_memnote_index.hashed_mask)
+        if (cl_memnote_index.hashed[slot]->key == note->key)
+          break;
+      if (!cl_memnote_index.hashed[slot])
+        cl_memnote_index.hashed[slot] = note;
     }
   }
+}
+
+cl_memnote_t* cl_find_memnote(unsigned key)
+{
+  /* Catch notes being replaced without the index being rebuilt */
+  if (cl_memnote_index.notes != memory.notes ||
+      cl_memnote_index.note_count != memory.note_count)
+    cl_memnote_index_build();
+
+  if (key < CL_MEMNOTE_DIRECT_KEYS)
+    return cl_memnote_index.direct[key];
+  else if (cl_memnote_index.hashed)
+  {
+    unsigned slot;
+
+    for (slot = cl_memnote_hash(key);
+         cl_memnote_index.hashed[slot];
+         slot = (slot + 1) & cl_memnote_index.hashed_mask)
+      if (cl_memnote_index.hashed[slot]->key == key)
+        return cl_memnote_index.hashed[slot];
+  }
 
   return NULL;
 }
 
-cl_memnote_t* cl_find_memnote(unsigned key)
+/*
+ * Loads of each width in each byte order. Values of up to 4 bytes in
+ * word-flipped memory are stored in the byte order of its words.
+ */
+
+static uint16_t cl_load16(const uint8_t *src)
+{
+  uint16_t value;
+
+  memcpy(&value, src, sizeof(value));
+
+  return value;
+}
+
+static uint16_t cl_load16_swapped(const uint8_t *src)
+{
+  return cl_bswap16(cl_load16(src));
+}
+
+static uint32_t cl_load32(const uint8_t *src)
+{
+  uint32_t value;
+
+  memcpy(&value, src, sizeof(value));
+
+  return value;
+}
+
+static uint32_t cl_load32_swapped(const uint8_t *src)
+{
+  return cl_bswap32(cl_load32(src));
+}
+
+static uint64_t cl_load64(const uint8_t *src)
+{
+  uint64_t value;
+
+  memcpy(&value, src, sizeof(value));
+
+  return value;
+}
+
+static uint64_t cl_load64_swapped(const uint8_t *src)
+{
+  return cl_bswap64(cl_load64(src));
+}
+
+static uint64_t cl_load64_word_flip(const uint8_t *src)
+{
+  uint64_t value = cl_load64(src);
+
+  return (value << 32) | (value >> 32);
+}
+
+static uint64_t cl_load64_word_flip_swapped(const uint8_t *src)
+{
+  uint64_t value = cl_load64_swapped(src);
+
+  return (value << 32) | (value >> 32);
+}
+
+/**
+ * Defines a reader for an integer type, which loads it with a function and
+ * sign or zero extends it.
+ */
+#define CL_READER_INT(name, ctype, load) \
+static void name(cl_counter_t *counter, const uint8_t *src) \
+{ \
+  counter->value.i64 = (ctype)load(src); \
+  counter->type = CL_MEMTYPE_INT64; \
+}
+
+/**
+ * Defines a reader for a floating point type, which loads its bits with a
+ * function. As with cl_ctr_store_float, counters not holding a floating point
+ * value become CL_MEMTYPE_DOUBLE.
+ */
+#define CL_READER_FLOAT(name, ctype, bits_type, load) \
+static void name(cl_counter_t *counter, const uint8_t *src) \
+{ \
+  bits_type bits = load(src); \
+  ctype value; \
+\
+  memcpy(&value, &bits, sizeof(value)); \
+  counter->value.fp = value; \
+  if (counter->type != CL_MEMTYPE_FLOAT && counter->type != CL_MEMTYPE_DOUBLE) \
+    counter->type = CL_MEMTYPE_DOUBLE; \
+}
+
+#define CL_LOAD8(src) (*(src))
+
+CL_READER_INT(cl_read_int8, int8_t, CL_LOAD8)
+CL_READER_INT(cl_read_uint8, uint8_t, CL_LOAD8)
+
+CL_READER_INT(cl_read_int16, int16_t, cl_load16)
+CL_READER_INT(cl_read_uint16, uint16_t, cl_load16)
+CL_READER_INT(cl_read_int32, int32_t, cl_load32)
+CL_READER_INT(cl_read_uint32, uint32_t, cl_load32)
+CL_READER_INT(cl_read_int64, int64_t, cl_load64)
+CL_READER_FLOAT(cl_read_float, float, uint32_t, cl_load32)
+CL_READER_FLOAT(cl_read_double, double, uint64_t, cl_load64)
+
+CL_READER_INT(cl_read_int16_swapped, int16_t, cl_load16_swapped)
+CL_READER_INT(cl_read_uint16_swapped, uint16_t, cl_load16_swapped)
+CL_READER_INT(cl_read_int32_swapped, int32_t, cl_load32_swapped)
+CL_READER_INT(cl_read_uint32_swapped, uint32_t, cl_load32_swapped)
+CL_READER_INT(cl_read_int64_swapped, int64_t, cl_load64_swapped)
+CL_READER_FLOAT(cl_read_float_swapped, float, uint32_t, cl_load32_swapped)
+CL_READER_FLOAT(cl_read_double_swapped, double, uint64_t, cl_load64_swapped)
+
+CL_READER_INT(cl_read_int64_word_flip, int64_t, cl_load64_word_flip)
+CL_READER_FLOAT(cl_read_double_word_flip, double, uint64_t,
+                cl_load64_word_flip)
+CL_READER_INT(cl_read_int64_word_flip_swapped, int64_t,
+              cl_load64_word_flip_swapped)
+CL_READER_FLOAT(cl_read_double_word_flip_swapped, double, uint64_t,
+                cl_load64_word_flip_swapped)
+
+/**
+ * The readers for each data type, in the order of cl_value_type, for memory
+ * in the host's byte order, the opposite one, and the word-flipped orders
+ * with words in the host's byte order and in the opposite one.
+ */
+static const cl_memory_reader_t cl_memory_readers[4][CL_MEMTYPE_SIZE] =
+{
+  {
+    NULL, cl_read_int64, cl_read_double,
+    cl_read_int8, cl_read_uint8, cl_read_int16, cl_read_uint16,
+    cl_read_int32, cl_read_uint32, cl_read_float
+  },
+  {
+    NULL, cl_read_int64_swapped, cl_read_double_swapped,
+    cl_read_int8, cl_read_uint8, cl_read_int16_swapped, cl_read_uint16_swapped,
+    cl_read_int32_swapped, cl_read_uint32_swapped, cl_read_float_swapped
+  },
+  {
+    NULL, cl_read_int64_word_flip, cl_read_double_word_flip,
+    cl_read_int8, cl_read_uint8, cl_read_int16, cl_read_uint16,
+    cl_read_int32, cl_read_uint32, cl_read_float
+  },
+  {
+    NULL, cl_read_int64_word_flip_swapped, cl_read_double_word_flip_swapped,
+    cl_read_int8, cl_read_uint8, cl_read_int16_swapped, cl_read_uint16_swapped,
+    cl_read_int32_swapped, cl_read_uint32_swapped, cl_read_float_swapped
+  }
+};
+
+cl_memory_reader_t cl_memory_reader(unsigned type, unsigned endianness)
+{
+  unsigned order;
+
+  if (type >= CL_MEMTYPE_SIZE)
+    return NULL;
+  else if (endianness == CL_ENDIAN_NATIVE)
+    order = 0;
+  else if (endianness == CL_ENDIAN_SWAPPED)
+    order = 1;
+  else if (endianness == CL_ENDIAN_WORD_FLIP_NATIVE)
+    order = 2;
+  else if (endianness == CL_ENDIAN_WORD_FLIP_SWAPPED)
+    order = 3;
+  else
+    return NULL;
+
+  return cl_memory_readers[order][type];
+}
+
+/**
+ * Stands in for the reader of a note with an invalid data type, leaving its
+ * value unchanged as cl_ctr_store does.
+ */
+static void cl_read_nothing(cl_counter_t *counter, const uint8_t *src)
+{
+  CL_UNUSED(counter);
+  CL_UNUSED(src);
+}
+
+static void cl_memnote_state_free(void)
 {
+  cl_memnote_state_t *state = &memory.note_state;
+
+  free(state->addresses);
+  free(state->types);
+  free(state->readers);
+  free(state->reader_endianness);
+  free(state->values);
+  free(state->changed);
+  free(state->dirty);
+  free(state->active);
+  memset(state, 0, sizeof(*state));
+}
+
+/**
+ * Sets the function reading the value of a memory note from memory in a
+ * given byte order. Memory in an unknown byte order is read as the host's.
+ */
+static void cl_memnote_choose_reader(unsigned index, unsigned endianness)
+{
+  cl_memnote_state_t *state = &memory.note_state;
+  cl_memory_reader_t reader = cl_memory_reader(state->types[index],
+                                               endianness);
+
+  if (!reader)
+    reader = cl_memory_reader(state->types[index], CL_ENDIAN_NATIVE);
+  state->readers[index] = reader ? reader : cl_read_nothing;
+  state->reader_endianness[index] = (uint8_t)endianness;
+}
+
+bool cl_memory_index_notes(void)
+{
+  cl_memnote_state_t *state = &memory.note_state;
+  unsigned count = memory.note_count;
   unsigned i;
 
-  for (i = 0; i < memory.note_count; i++)
+  cl_memnote_state_free();
+  if (!memory.notes || !count)
+  {
+    state->notes = memory.notes;
+    state->note_count = count;
+
+    return true;
+  }
+  state->addresses = (cl_addr_t*)calloc(count, sizeof(cl_addr_t));
+  state->types = (uint8_t*)malloc(count * sizeof(uint8_t));
+  state->readers = (cl_memory_reader_t*)malloc(count *
+                                               sizeof(cl_memory_reader_t));
+  state->reader_endianness = (uint8_t*)malloc(count * sizeof(uint8_t));
+  state->values = (cl_memnote_values_t*)calloc(count,
+                                               sizeof(cl_memnote_values_t));
+  state->changed = (bool*)calloc(count, sizeof(bool));
+  state->dirty = (bool*)calloc(count, sizeof(bool));
+  state->active = (unsigned*)malloc(count * sizeof(unsigned));
+  if (!state->addresses || !state->types || !state->readers ||
+      !state->reader_endianness || !state->values ||
+      !state->changed || !state->dirty || !state->active)
   {
-    if (memory.notes[i].key == key)
-      return &memory.notes[i];
+    cl_memnote_state_free();
+    return false;
   }
 
-  return NULL;
+  for (i = 0; i < count; i++)
+  {
+    const cl_memnote_t *note = &memory.notes[i];
+    cl_memnote_values_t *values = &state->values[i];
+#if CL_EXTERNAL_MEMORY
+    /* External memory is read as it is */
+    unsigned endianness = CL_ENDIAN_NATIVE;
+#else
+    const cl_memory_region_t *region =
+      cl_find_memory_region(note->address_initial);
+    unsigned endianness = region ? region->endianness : CL_ENDIAN_NATIVE;
+#endif
+
+    /* Initialize the tracked values based on the data type of the memnote */
+    state->types[i] = (uint8_t)note->type;
+    cl_memnote_choose_reader(i, endianness);
+    values->current.type = note->type;
+    values->previous.type = note->type;
+    values->last_unique.type = note->type;
+    if (note->refs)
+      state->active[state->active_count++] = i;
+  }
+  state->notes = memory.notes;
+  state->note_count = count;
+
+  return true;
+}
+
+/**
+ * Rebuilds the memory note state if the note array was replaced since it was
+ * built.
+ * @return Whether the state matches the note array.
+ */
+static bool cl_memnote_state_sync(void)
+{
+  if (memory.note_state.notes != memory.notes ||
+      memory.note_state.note_count != memory.note_count)
+    return cl_memory_index_notes();
+  else
+    return true;
+}
+
+/**
+ * Returns whether a memory note is an element of the global note array.
+ */
+static bool cl_memnote_in_array(const cl_memnote_t *note)
+{
+  return note && memory.notes && note >= memory.notes &&
+         note < memory.notes + memory.note_count;
+}
+
+cl_memnote_values_t* cl_memnote_values(const cl_memnote_t *note)
+{
+  if (!cl_memnote_in_array(note) || !cl_memnote_state_sync())
+    return NULL;
+  else
+    return &memory.note_state.values[note - memory.notes];
+}
+
+/**
+ * Adds a memory note to the list of notes updated every frame, or removes it.
+ * The state should match the note array.
+ */
+static void cl_memnote_set_active(const cl_memnote_t *note, bool active)
+{
+  cl_memnote_state_t *state = &memory.note_state;
+  unsigned index;
+  unsigned i = 0;
+
+  if (!cl_memnote_in_array(note))
+    return;
+  index = (unsigned)(note - memory.notes);
+
+  /* Find where the note is, or would go, in the sorted list */
+  while (i < state->active_count && state->active[i] < index)
+    i++;
+  if (active)
+  {
+    memmove(&state->active[i + 1], &state->active[i],
+            (state->active_count - i) * sizeof(unsigned));
+    state->active[i] = index;
+    state->active_count++;
+  }
+  else if (i < state->active_count && state->active[i] == index)
+  {
+    memmove(&state->active[i], &state->active[i + 1],
+            (state->active_count - i - 1) * sizeof(unsigned));
+    state->active_count--;
+
+    /* No longer updated, so nothing can be changing */
+    state->changed[index] = false;
+    state->dirty[index] = false;
+  }
+}
+
+#if CL_EXTERNAL_MEMORY && CL_EXTERNAL_MEMORY_BATCH
+/* The largest range nearby batched reads are merged into */
+#define CL_READ_RANGE_MAX 65536
+
+/**
+ * Buffers used to read memory notes in batches, kept between frames so they
+ * are only allocated when the number of notes grows.
+ */
+typedef struct cl_read_plan_t
+{
+  /* One request per memory note still being resolved */
+  cl_memory_read_t *reads;
+  unsigned         *indices;
+  cl_addr_t        *addresses;
+  uint64_t         *values;
+  unsigned          capacity;
+
+  /* The requests sorted by address, and the ranges they are merged into */
+  cl_memory_read_t **sorted;
+  cl_memory_read_t  *ranges;
+  unsigned          *range_starts;
+  uint8_t           *buffer;
+  cl_addr_t          buffer_size;
+} cl_read_plan_t;
+
+static cl_read_plan_t cl_read_plan;
+
+static void cl_read_plan_free(void)
+{
+  free(cl_read_plan.reads);
+  free(cl_read_plan.indices);
+  free(cl_read_plan.addresses);
+  free(cl_read_plan.values);
+  free(cl_read_plan.sorted);
+  free(cl_read_plan.ranges);
+  free(cl_read_plan.range_starts);
+  free(cl_read_plan.buffer);
+  memset(&cl_read_plan, 0, sizeof(cl_read_plan));
 }
+#endif
 
 void cl_free_memnote(cl_memnote_t *note)
 {
@@ -62,10 +765,41 @@ void cl_memory_free(void)
 
   for (i = 0; i < memory.note_count; i++)
     cl_free_memnote(&memory.notes[i]);
+  free(memory.notes);
   memory.notes = NULL;
+  memory.note_count = 0;
+  cl_memnote_index_free();
+  cl_memnote_state_free();
+#if CL_HAVE_EDITOR
+  free(memory.note_meta);
+  memory.note_meta = NULL;
+#endif
 
   free(memory.regions);
   memory.regions = NULL;
+  cl_region_index_free();
+  cl_ptrcache_free(&memory.pointer_cache);
+#if CL_EXTERNAL_MEMORY && CL_EXTERNAL_MEMORY_BATCH
+  cl_read_plan_free();
+#endif
+}
+
+void cl_memnote_ref(cl_memnote_t *note)
+{
+  if (note)
+  {
+    if (note->refs == 0 && cl_memnote_state_sync())
+      cl_memnote_set_active(note, true);
+    note->refs++;
+  }
+}
+
+void cl_memnote_unref(cl_memnote_t *note)
+{
+  if (!note || !note->refs)
+    return;
+  else if (--note->refs == 0 && cl_memnote_state_sync())
+    cl_memnote_set_active(note, false);
 }
 
 bool cl_get_memnote_flag(cl_memnote_t *note, uint8_t flag)
@@ -88,20 +822,22 @@ bool cl_get_memnote_flag_from_key(unsigned key, uint8_t flag)
 
 bool cl_get_memnote_value(cl_counter_t *src, cl_memnote_t *note, unsigned type)
 {
-  if (!src || !note)
+  const cl_memnote_values_t *values = cl_memnote_values(note);
+
+  if (!src || !values)
    return false;
   else
   {
    switch (type)
    {
    case CL_SRCTYPE_CURRENT_RAM:
-    *src = note->current;
+    *src = values->current;
     break;
    case CL_SRCTYPE_PREVIOUS_RAM:
-    *src = note->previous;
+    *src = values->previous;
     break;
    case CL_SRCTYPE_LAST_UNIQUE_RAM:
-    *src = note->last_unique;
+    *src = values->last_unique;
     break;
    default:
     return false;
@@ -166,7 +902,8 @@ bool cl_init_membanks_libretro(const struct retro_memory_descriptor **descs,
     region->base_host = desc->ptr;
     region->endianness = desc->flags & RETRO_MEMDESC_BIGENDIAN ?
                                      CL_ENDIAN_BIG : CL_ENDIAN_LITTLE;
-    region->flags = (cl_memory_region_flags){ .bits.read=1, .bits.write=1 };
+    region->flags = (cl_memory_region_flags){ .bits.read=1,
+      .bits.write=!(desc->flags & RETRO_MEMDESC_CONST) };
     /**
      * @todo Is there a commonly used libretro flag for this? Not a huge deal
      * since this gets overwritten by the server later
@@ -184,6 +921,7 @@ bool cl_init_membanks_libretro(const struct retro_memory_descriptor **descs,
   }
 
   cl_sort_memory_regions(memory.regions, memory.region_count);
+  cl_memory_index_regions();
 
   for (i = 0; i < memory.region_count; i++)
   {
@@ -205,12 +943,15 @@ bool cl_init_memory(const char **pos)
   if (!cl_strto(pos, &memory.note_count, sizeof(memory.note_count), false))
     return false;
   memory.notes = (cl_memnote_t*)calloc(memory.note_count, sizeof(cl_memnote_t));
+#if CL_HAVE_EDITOR
+  memory.note_meta = (cl_memnote_meta_t*)calloc(memory.note_count,
+                                                sizeof(cl_memnote_meta_t));
+#endif
 
   cl_log("Memory notes: %u\n", memory.note_count);
 
   for (i = 0; i < memory.note_count; i++)
   {
-    cl_counter_t new_ctr;
     new_memnote = &memory.notes[i];
 
     if (!(cl_strto(pos, &new_memnote->key,        4, false) &&
@@ -226,14 +967,6 @@ bool cl_init_memory(const char **pos)
      new_memnote->pointer_passes,
      new_memnote->address_initial);
 
-    /* Initialize the tracked values based on the data type of the memnote */
-    new_ctr.floatval.fp = 0;
-    new_ctr.intval.i64 = 0;
-    new_ctr.type = new_memnote->type;
-    new_memnote->current    = new_ctr;
-    new_memnote->previous   = new_ctr;
-    new_memnote->last_unique = new_ctr;
-
     /* Initialize offsets for pointer-chain variables */
     if (new_memnote->pointer_passes > 0)
     {
@@ -249,6 +982,14 @@ bool cl_init_memory(const char **pos)
     }
     cl_log("\n");
   }
+  cl_memnote_index_build();
+  if (!cl_memory_index_notes())
+    return false;
+
+  /* Rich presence values are sent to the server, so are always updated */
+  for (i = 0; i < memory.note_count; i++)
+    if (cl_get_memnote_flag(&memory.notes[i], CL_MEMFLAG_RICH))
+      cl_memnote_ref(&memory.notes[i]);
   cl_log("End of memory.\n");
 
   return true;
@@ -304,81 +1045,384 @@ unsigned cl_sizeof_memtype(const unsigned type)
 
 /**
  * Gets the final address referenced by a memory note's chain of pointers, and
- * reads it into a buffer.
- * @param address The buffer to read the address into.
- * @param note A pointer to the memory note to have its address resolved.
+ * stores it in the note's state.
+ * @param index The index of the memory note to have its address resolved.
  * @return Whether or not the final address could be inferred from the note.
  **/
-bool cl_memnote_resolve_ptrs(cl_memnote_t *note)
+static bool cl_memnote_resolve_ptrs(unsigned index)
 {
-  cl_addr_t final_addr = note->address_initial;
-  unsigned i;
+  const cl_memnote_t *note = &memory.notes[index];
+
+  return cl_ptrcache_resolve(&memory.pointer_cache,
+                             &memory.note_state.addresses[index],
+                             note->address_initial,
+                             (const uint32_t*)note->pointer_offsets,
+                             note->pointer_passes);
+}
+
+/**
+ * Marks a memory note as not read on this frame, as its address could not be
+ * resolved. None of its stored values change.
+ **/
+static void cl_memnote_unread(unsigned index)
+{
+  memory.note_state.changed[index] = false;
+  memory.note_state.dirty[index] = false;
+}
 
-  for (i = 0; i < note->pointer_passes; i++)
+/**
+ * Stores the value read for a memory note on this frame.
+ * @param src The value, in memory the note's reader is chosen for.
+ **/
+static void cl_memnote_store(unsigned index, const uint8_t *src)
+{
+  cl_memnote_state_t *state = &memory.note_state;
+  cl_memnote_values_t *values = &state->values[index];
+  cl_counter_t previous = values->previous;
+  bool changed;
+
+  /* The "previous" value is the value from the previous frame */
+  values->previous = values->current;
+  state->readers[index](&values->current, src);
+
+  /* Logic for "last unique" values; the previous value will persist */
+  changed = !cl_ctr_equal_exact(&values->previous, &values->current);
+  if (changed)
+    values->last_unique = values->previous;
+
+  /* "previous" also changes on the frame after "current" does */
+  state->changed[index] = changed;
+  state->dirty[index] = changed ||
+                        values->current.type != values->previous.type ||
+                        previous.type != values->previous.type ||
+                        !cl_ctr_equal_exact(&previous, &values->previous);
+}
+
+/**
+ * Reads the value of a memory note on this frame.
+ * @param index The index of the memory note. The state should match the note
+ * array.
+ * @return Whether the note's pointer chain could be resolved.
+ **/
+static bool cl_update_memnote(unsigned index)
+{
+  if (!cl_memnote_resolve_ptrs(index))
   {
-    const cl_memory_region_t *region = cl_find_memory_region(final_addr);
+    cl_memnote_unread(index);
 
-    if (!region)
-      return false;
-    else if (!cl_read_memory(&final_addr, NULL, final_addr,
-                             region->pointer_length))
-      return false;
+    return false;
+  }
+  else
+  {
+    cl_memnote_state_t *state = &memory.note_state;
+    cl_addr_t address = state->addresses[index];
+#if CL_EXTERNAL_MEMORY
+    uint64_t new_val = 0;
 
-    final_addr += note->pointer_offsets[i];
+    cl_read_memory_external(&new_val, NULL, address,
+                            cl_sizeof_memtype(state->types[index]));
+    cl_memnote_store(index, (const uint8_t*)&new_val);
+#else
+    /* Addresses that cannot be read give a value of 0 */
+    static const uint64_t unread = 0;
+    const cl_memory_region_t *region = cl_find_memory_region(address);
+
+    if (region && region->base_host &&
+        address - region->base_guest < region->size)
+    {
+      if (region->endianness != state->reader_endianness[index])
+        cl_memnote_choose_reader(index, region->endianness);
+      cl_memnote_store(index, (const uint8_t*)region->base_host +
+                              (address - region->base_guest));
+    }
+    else
+      cl_memnote_store(index, (const uint8_t*)&unread);
+#endif
+
+    return true;
   }
-  note->address = final_addr;
+}
+
+#if CL_EXTERNAL_MEMORY && CL_EXTERNAL_MEMORY_BATCH
+static bool cl_read_plan_reserve(unsigned count)
+{
+  cl_read_plan_t *plan = &cl_read_plan;
+
+  if (count <= plan->capacity)
+    return true;
+  cl_read_plan_free();
+  plan->reads = (cl_memory_read_t*)malloc(count * sizeof(cl_memory_read_t));
+  plan->indices = (unsigned*)malloc(count * sizeof(unsigned));
+  plan->addresses = (cl_addr_t*)malloc(count * sizeof(cl_addr_t));
+  plan->values = (uint64_t*)malloc(count * sizeof(uint64_t));
+  plan->sorted = (cl_memory_read_t**)malloc(count * sizeof(cl_memory_read_t*));
+  plan->ranges = (cl_memory_read_t*)malloc(count * sizeof(cl_memory_read_t));
+  plan->range_starts = (unsigned*)malloc((count + 1) * sizeof(unsigned));
+  if (!plan->reads || !plan->indices || !plan->addresses || !plan->values ||
+      !plan->sorted || !plan->ranges || !plan->range_starts)
+  {
+    cl_read_plan_free();
+    return false;
+  }
+  plan->capacity = count;
 
   return true;
 }
 
-bool cl_update_memnote(cl_memnote_t *note)
+static int cl_read_compare(const void *a, const void *b)
 {
-  if (!note || !cl_memnote_resolve_ptrs(note))
-    return false;
+  const cl_memory_read_t *left = *(cl_memory_read_t* const*)a;
+  const cl_memory_read_t *right = *(cl_memory_read_t* const*)b;
+
+  if (left->address != right->address)
+    return left->address < right->address ? -1 : 1;
   else
+    return 0;
+}
+
+/**
+ * Sorts a batch of requests by address and merges those close to each other
+ * into the ranges of the read plan. A range is never grown past
+ * CL_READ_RANGE_MAX bytes, so a request that would cross that starts a new
+ * one.
+ * @param buffer_used Set to the bytes of shared buffer the ranges need.
+ * Ranges of one request are read straight into it, and need none.
+ * @return The number of ranges.
+ **/
+static unsigned cl_read_plan_ranges(cl_memory_read_t *reads, unsigned count,
+  cl_addr_t *buffer_used)
+{
+  cl_read_plan_t *plan = &cl_read_plan;
+  unsigned range_count = 0;
+  unsigned i, j;
+
+  *buffer_used = 0;
+
+  for (i = 0; i < count; i++)
   {
-    int64_t new_val = 0;
+    plan->sorted[i] = &reads[i];
+    reads[i].read = 0;
+  }
+  qsort(plan->sorted, count, sizeof(cl_memory_read_t*), cl_read_compare);
 
-    /* The "previous" value is the value from the previous frame */
-    note->previous = note->current;
+  for (i = 0; i < count; i = j)
+  {
+    cl_memory_read_t *range = &plan->ranges[range_count];
+    cl_addr_t start = plan->sorted[i]->address;
+    cl_addr_t end = start + plan->sorted[i]->size;
 
-    /**
-     * Read the current frame's value from memory
-     * @todo-branch Test this on Wii U. Is it fixed?
-     */
-#if __WIIU__
-    cl_read(&new_val, memory.banks[0].data, note->address - memory.banks[0].start, cl_sizeof_memtype(note->type), memory.endianness);
-#else
-    cl_read_memory(&new_val, NULL, note->address, cl_sizeof_memtype(note->type));
-#endif
-    cl_ctr_store(&note->current, &new_val, note->type);
+    for (j = i + 1; j < count; j++)
+    {
+      cl_addr_t next_end = plan->sorted[j]->address + plan->sorted[j]->size;
 
-    /* Logic for "last unique" values; the previous value will persist */
-    if (!cl_ctr_equal_exact(&note->previous, &note->current))
-      note->last_unique = note->previous;
+      if (plan->sorted[j]->address > end + CL_EXTERNAL_MEMORY_GAP ||
+          (next_end > end ? next_end : end) - start > CL_READ_RANGE_MAX)
+        break;
+      else if (next_end > end)
+        end = next_end;
+    }
+    range->address = start;
+    range->size = (unsigned)(end - start);
+    range->read = 0;
+    plan->range_starts[range_count++] = i;
+
+    /* Ranges of one request are read straight into it */
+    if (j == i + 1)
+      range->dest = plan->sorted[i]->dest;
+    else
+    {
+      range->dest = NULL;
+      *buffer_used += range->size;
+    }
+  }
+  plan->range_starts[range_count] = count;
 
-    return true;
+  return range_count;
+}
+
+/**
+ * Reads a batch of requests from external memory. Requests close to each
+ * other are merged into one range, read into a shared buffer and copied out.
+ * Requests in a range that could not be read in full are read on their own,
+ * in case the range crossed into unreadable memory.
+ **/
+static void cl_read_batch(cl_memory_read_t *reads, unsigned count)
+{
+  cl_read_plan_t *plan = &cl_read_plan;
+  cl_addr_t buffer_used;
+  unsigned  range_count = cl_read_plan_ranges(reads, count, &buffer_used);
+  unsigned  i, j;
+
+  if (buffer_used > plan->buffer_size)
+  {
+    uint8_t *buffer = (uint8_t*)realloc(plan->buffer, buffer_used);
+
+    if (!buffer)
+    {
+      /* Read every request on its own instead */
+      cl_fe_memory_read_batch(&memory, reads, count);
+      return;
+    }
+    plan->buffer = buffer;
+    plan->buffer_size = buffer_used;
+  }
+  for (i = 0, buffer_used = 0; i < range_count; i++)
+  {
+    if (!plan->ranges[i].dest)
+    {
+      plan->ranges[i].dest = &plan->buffer[buffer_used];
+      buffer_used += plan->ranges[i].size;
+    }
+  }
+
+  cl_fe_memory_read_batch(&memory, plan->ranges, range_count);
+
+  for (i = 0; i < range_count; i++)
+  {
+    const cl_memory_read_t *range = &plan->ranges[i];
+
+    for (j = plan->range_starts[i]; j < plan->range_starts[i + 1]; j++)
+    {
+      cl_memory_read_t *read = plan->sorted[j];
+
+      if (read->dest == range->dest)
+        read->read = range->read;
+      else if (read->address + read->size <= range->address + range->read)
+      {
+        memcpy(read->dest,
+               (const uint8_t*)range->dest + (read->address - range->address),
+               read->size);
+        read->read = read->size;
+      }
+      else
+        read->read = cl_fe_memory_read(&memory, read->dest, read->address,
+                                        read->size);
+    }
   }
 }
 
+/**
+ * Updates every referenced memory note with batched reads. All notes follow
+ * their pointer chains together, so each level of pointers is one batch, and
+ * the values they lead to are the last.
+ * @return Whether the notes were updated. If not, they should be updated one
+ * at a time instead.
+ **/
+static bool cl_update_memory_batched(void)
+{
+  cl_read_plan_t *plan = &cl_read_plan;
+  const cl_memnote_state_t *state = &memory.note_state;
+  unsigned count = state->active_count;
+  unsigned depth, i;
+
+  if (!cl_read_plan_reserve(count))
+    return false;
+
+  for (i = 0; i < count; i++)
+  {
+    plan->indices[i] = state->active[i];
+    plan->addresses[i] = memory.notes[state->active[i]].address_initial;
+  }
+
+  for (depth = 0; count; depth++)
+  {
+    unsigned next = 0;
+
+    for (i = 0; i < count; i++)
+    {
+      unsigned index = plan->indices[i];
+      const cl_memnote_t *note = &memory.notes[index];
+      cl_addr_t address = plan->addresses[i];
+      cl_memory_read_t *read = &plan->reads[next];
+
+      plan->values[next] = 0;
+      if (depth < note->pointer_passes)
+      {
+        const cl_memory_region_t *region = cl_find_memory_region(address);
+
+        if (!region || region->pointer_length > sizeof(cl_addr_t))
+        {
+          cl_memnote_unread(index);
+          continue;
+        }
+
+        /* Pointers are read into a copy of the address, as they are when
+           notes are updated one at a time */
+        memcpy(&plan->values[next], &address, sizeof(address));
+        read->size = region->pointer_length;
+      }
+      else
+        read->size = cl_sizeof_memtype(state->types[index]);
+      read->address = address;
+      read->dest = &plan->values[next];
+      plan->indices[next] = index;
+      plan->addresses[next] = address;
+      next++;
+    }
+    count = next;
+    if (!count)
+      break;
+    cl_read_batch(plan->reads, count);
+
+    for (i = 0, next = 0; i < count; i++)
+    {
+      unsigned index = plan->indices[i];
+      const cl_memnote_t *note = &memory.notes[index];
+
+      if (depth < note->pointer_passes)
+      {
+        cl_addr_t pointer;
+
+        if (!plan->reads[i].read)
+        {
+          cl_memnote_unread(index);
+          continue;
+        }
+        memcpy(&pointer, &plan->values[i], sizeof(pointer));
+        plan->indices[next] = index;
+        plan->addresses[next] = pointer + note->pointer_offsets[depth];
+        next++;
+      }
+      else
+      {
+        memory.note_state.addresses[index] = plan->addresses[i];
+        cl_memnote_store(index, (const uint8_t*)&plan->values[i]);
+      }
+    }
+    count = next;
+  }
+
+  return true;
+}
+#endif
+
 void cl_update_memory(void)
 {
   /* Have memory banks not been set up yet? */
   /* TODO: Maybe we should attempt to set up membanks here, like before */
-  if (memory.region_count == 0)
+  if (memory.region_count == 0 || !cl_memnote_state_sync())
     return;
   else
   {
     unsigned i;
 
-    for (i = 0; i < memory.note_count; i++)
-      cl_update_memnote(&memory.notes[i]);
+    /* Pointers may have changed since the last frame */
+    cl_ptrcache_invalidate(&memory.pointer_cache);
+
+#if CL_EXTERNAL_MEMORY && CL_EXTERNAL_MEMORY_BATCH
+    if (cl_update_memory_batched())
+      return;
+#endif
+    for (i = 0; i < memory.note_state.active_count; i++)
+      cl_update_memnote(memory.note_state.active[i]);
   }
 }
 
 unsigned cl_write_memory(cl_memory_region_t *bank, cl_addr_t address,
                          unsigned size, const void *value)
 {
+  /* The write may change a pointer that was already read on this frame */
+  cl_ptrcache_invalidate(&memory.pointer_cache);
 #if CL_EXTERNAL_MEMORY
   CL_UNUSED(bank);
   return cl_fe_memory_write(&memory, value, address, size);
@@ -403,22 +1447,35 @@ unsigned cl_write_memory(cl_memory_region_t *bank, cl_addr_t address,
 
 bool cl_write_memnote(cl_memnote_t *note, const cl_counter_t *value)
 {
-  if (!note || !value)
+  const cl_memnote_values_t *values = cl_memnote_values(note);
+
+  if (!values || !value)
    return false;
   else
   {
-   if (cl_memnote_resolve_ptrs(note))
+   unsigned index = (unsigned)(note - memory.notes);
+   unsigned size = cl_sizeof_memtype(memory.note_state.types[index]);
+
+   if (cl_memnote_resolve_ptrs(index))
    {
-    if (cl_ctr_is_float(&note->current))
+    if (cl_ctr_is_float(&values->current))
+    {
+      double fp = cl_ctr_get_float(value);
+
       return cl_write_memory(NULL,
-                     note->address,
-                     cl_sizeof_memtype(note->type),
-                     &value->floatval) == cl_sizeof_memtype(note->type);
+                     memory.note_state.addresses[index],
+                     size,
+                     &fp) == size;
+    }
     else
+    {
+      int64_t i64 = cl_ctr_get_int(value);
+
       return cl_write_memory(NULL,
-                     note->address,
-                     cl_sizeof_memtype(note->type),
-                     &value->intval) == cl_sizeof_memtype(note->type);
+                     memory.note_state.addresses[index],
+                     size,
+                     &i64) == size;
+    }
    }
   }
 
@@ -431,3 +1488,349 @@ bool cl_write_memnote_from_key(unsigned key, const cl_counter_t *value)
 
   return note ? cl_write_memnote(note, value) : false;
 }
+
+#if CL_TESTS
+
+static void cl_memory_test_readers(void)
+{
+  uint8_t src[8];
+  unsigned seed = 0x1234567;
+  unsigned i, j, type, endianness;
+
+  for (i = 0; i < 256; i++)
+  {
+    for (j = 0; j < sizeof(src); j++)
+      src[j] = (uint8_t)cl_test_rand(&seed);
+
+    for (type = CL_MEMTYPE_INT64; type < CL_MEMTYPE_SIZE; type++)
+    {
+      for (endianness = CL_ENDIAN_LITTLE;
+           endianness <= CL_ENDIAN_WORD_FLIP_LB;
+           endianness++)
+      {
+        cl_memory_reader_t reader = cl_memory_reader(type, endianness);
+        cl_counter_t expected, actual;
+        int64_t value = 0;
+
+        if (!reader)
+          CL_TEST_FAIL(1);
+
+        /* Compare against the generic read for counters of either type */
+        memset(&expected, 0, sizeof(expected));
+        memset(&actual, 0, sizeof(actual));
+        for (j = 0; j < 2; j++)
+        {
+          if (j)
+            expected.type = actual.type = type;
+          value = 0;
+          cl_read(&value, src, 0, cl_sizeof_memtype(type), endianness);
+          cl_ctr_store(&expected, &value, type);
+          reader(&actual, src);
+          if (!cl_ctr_equal_exact(&expected, &actual) ||
+              expected.type != actual.type)
+            CL_TEST_FAIL(2);
+        }
+      }
+    }
+  }
+}
+
+static void cl_memory_test_word_flip(void)
+{
+  static const uint8_t orders[4][8] =
+  {
+    { 0xEF, 0xCD, 0xAB, 0x89, 0x67, 0x45, 0x23, 0x01 },
+    { 0x01, 0x23, 0x45, 0x67, 0x89, 0xAB, 0xCD, 0xEF },
+    { 0x67, 0x45, 0x23, 0x01, 0xEF, 0xCD, 0xAB, 0x89 },
+    { 0x89, 0xAB, 0xCD, 0xEF, 0x01, 0x23, 0x45, 0x67 }
+  };
+  unsigned endianness;
+
+  for (endianness = CL_ENDIAN_LITTLE;
+       endianness <= CL_ENDIAN_WORD_FLIP_LB;
+       endianness++)
+  {
+    cl_counter_t counter;
+    int64_t value = 0;
+
+    memset(&counter, 0, sizeof(counter));
+    cl_memory_reader(CL_MEMTYPE_INT64, endianness)(&counter,
+                                                   orders[endianness]);
+    if (cl_ctr_get_int(&counter) != 0x0123456789ABCDEF)
+      CL_TEST_FAIL(3);
+    cl_read(&value, orders[endianness], 0, 8, endianness);
+    if (value != 0x0123456789ABCDEF)
+      CL_TEST_FAIL(4);
+  }
+
+  /**
+   * Values of 4 bytes or less are read from one word, whose byte order is
+   * the second letter of the word-flipped orders.
+   **/
+  for (endianness = CL_ENDIAN_LITTLE;
+       endianness <= CL_ENDIAN_WORD_FLIP_LB;
+       endianness++)
+  {
+    const uint8_t *word = endianness == CL_ENDIAN_BIG ||
+                          endianness == CL_ENDIAN_WORD_FLIP_LB ?
+                          orders[CL_ENDIAN_BIG] + 4 :
+                          orders[CL_ENDIAN_LITTLE];
+    cl_counter_t counter;
+    uint32_t value32 = 0;
+    uint16_t value16 = 0;
+
+    cl_read(&value32, word, 0, 4, endianness);
+    cl_read(&value16, word, 2 * (endianness == CL_ENDIAN_BIG ||
+                                 endianness == CL_ENDIAN_WORD_FLIP_LB),
+            2, endianness);
+    if (value32 != 0x89ABCDEF || value16 != 0xCDEF)
+      CL_TEST_FAIL(5);
+    memset(&counter, 0, sizeof(counter));
+    cl_memory_reader(CL_MEMTYPE_UINT32, endianness)(&counter, word);
+    if (cl_ctr_get_int(&counter) != 0x89ABCDEF)
+      CL_TEST_FAIL(5);
+  }
+
+  if (cl_memory_reader(CL_MEMTYPE_NOT_SET, CL_ENDIAN_NATIVE))
+    CL_TEST_FAIL(5);
+}
+
+/**
+ * Finds a region the slow way, as the first in the array holding an address.
+ */
+static cl_memory_region_t* cl_memory_test_find(cl_addr_t address)
+{
+  unsigned i;
+
+  for (i = 0; i < memory.region_count; i++)
+    if (memory.regions[i].base_guest <= address &&
+        address - memory.regions[i].base_guest < memory.regions[i].size)
+      return &memory.regions[i];
+
+  return NULL;
+}
+
+static void cl_memory_test_regions(void)
+{
+  static const cl_addr_t nested[3][2] =
+  {
+    { 0x1000, 0x8000 },
+    { 0x2000, 0x1000 },
+    { 0xA000, 0x1000 }
+  };
+  cl_memory_region_t regions[8];
+  cl_memory_region_t *old_regions = memory.regions;
+  unsigned old_count = memory.region_count;
+  unsigned seed = 0x7654321;
+  unsigned i, j;
+
+  /* An outer region around an inner one, and one after both */
+  memset(regions, 0, sizeof(regions));
+  for (i = 0; i < 3; i++)
+  {
+    regions[i].base_guest = nested[i][0];
+    regions[i].size = nested[i][1];
+  }
+  memory.regions = regions;
+  memory.region_count = 3;
+  cl_memory_index_regions();
+  if (cl_find_memory_region(0xA500) != &regions[2] ||
+      cl_find_memory_region(0x5000) != &regions[0] ||
+      cl_find_memory_region(0x2500) != &regions[0] ||
+      cl_find_memory_region(0x9800) != NULL)
+    CL_TEST_FAIL(6);
+
+  /* The same with the inner region first in the array */
+  regions[0].base_guest = nested[1][0];
+  regions[0].size = nested[1][1];
+  regions[1].base_guest = nested[0][0];
+  regions[1].size = nested[0][1];
+  cl_memory_index_regions();
+  if (cl_find_memory_region(0x2500) != &regions[0] ||
+      cl_find_memory_region(0xA500) != &regions[2] ||
+      cl_find_memory_region(0x5000) != &regions[1])
+    CL_TEST_FAIL(7);
+
+  /**
+   * Random overlapping regions, under and over 32 bits so both the page
+   * table and the sorted array are used, against the slow search.
+   */
+  for (i = 0; i < 256; i++)
+  {
+    cl_addr_t high = i & 1 ? 0x100000000ULL : 0;
+
+    memory.region_count = 2 + i % 7;
+    for (j = 0; j < memory.region_count; j++)
+    {
+      regions[j].base_guest = high + (cl_test_rand(&seed) & 0x3F) * 0x800;
+      regions[j].size = (cl_test_rand(&seed) & 0x1F) * 0x400;
+    }
+    cl_memory_index_regions();
+    for (j = 0; j < 2048; j++)
+    {
+      cl_addr_t address;
+
+      address = high + (cl_addr_t)cl_test_rand(&seed) * 8;
+      address += cl_test_rand(&seed) % 8;
+      if (cl_find_memory_region(address) != cl_memory_test_find(address))
+        CL_TEST_FAIL(8);
+    }
+  }
+
+  memory.regions = old_regions;
+  memory.region_count = old_count;
+  cl_memory_index_regions();
+}
+
+#if CL_EXTERNAL_MEMORY && CL_EXTERNAL_MEMORY_BATCH
+/**
+ * Checks that the ranges planned for a batch cover each request whole, keep
+ * them in order of address, and were not merged where they should not be.
+ **/
+static void cl_memory_test_read_plan_ranges(cl_memory_read_t *reads,
+  unsigned count, unsigned range_count, cl_addr_t buffer_used)
+{
+  const cl_read_plan_t *plan = &cl_read_plan;
+  cl_addr_t buffer_needed = 0;
+  unsigned i, j;
+
+  if (plan->range_starts[0] != 0 || plan->range_starts[range_count] != count)
+    CL_TEST_FAIL(9);
+  for (i = 0; i < range_count; i++)
+  {
+    const cl_memory_read_t *range = &plan->ranges[i];
+    unsigned first = plan->range_starts[i];
+    unsigned last = plan->range_starts[i + 1];
+
+    if (first >= last || range->address != plan->sorted[first]->address)
+      CL_TEST_FAIL(10);
+    if (last - first > 1)
+    {
+      if (range->dest || range->size > CL_READ_RANGE_MAX)
+        CL_TEST_FAIL(11);
+      buffer_needed += range->size;
+    }
+    else if (range->dest != plan->sorted[first]->dest ||
+             range->size != plan->sorted[first]->size)
+      CL_TEST_FAIL(12);
+
+    for (j = first; j < last; j++)
+    {
+      const cl_memory_read_t *read = plan->sorted[j];
+
+      if (read < reads || read >= reads + count ||
+          (j && read->address < plan->sorted[j - 1]->address) ||
+          read->address + read->size > range->address + range->size)
+        CL_TEST_FAIL(13);
+    }
+
+    /* The next range could not have been merged into this one */
+    if (i + 1 < range_count)
+    {
+      const cl_memory_read_t *next = plan->sorted[last];
+      cl_addr_t end = range->address + range->size;
+      cl_addr_t next_end = next->address + next->size;
+
+      if (next->address <= end + CL_EXTERNAL_MEMORY_GAP &&
+          (next_end > end ? next_end : end) - range->address <=
+          CL_READ_RANGE_MAX)
+        CL_TEST_FAIL(14);
+    }
+  }
+  if (buffer_needed != buffer_used)
+    CL_TEST_FAIL(15);
+}
+
+static void cl_memory_test_read_plan(void)
+{
+  const cl_addr_t base = 0x10000000;
+  const cl_addr_t split = base + 0x100000;
+  cl_memory_read_t reads[1024];
+  uint64_t dest[1024];
+  cl_addr_t buffer_used;
+  unsigned seed = 0x2468ACE;
+  unsigned count, range_count, i, j;
+
+  if (!cl_read_plan_reserve(1024))
+    CL_TEST_FAIL(9);
+  memset(reads, 0, sizeof(reads));
+  for (i = 0; i < 1024; i++)
+    reads[i].dest = &dest[i];
+
+  /**
+   * Given out of order: overlapping and adjacent requests, one the largest
+   * gap after them, one just past that gap, and requests filling a 64 KiB
+   * range with gaps between them. The last would cross its end, so starts a
+   * new range.
+   **/
+  reads[0].address = split + CL_READ_RANGE_MAX - 2;
+  reads[0].size = 4;
+  reads[1].address = base + 4;
+  reads[1].size = 4;
+  reads[2].address = base + 8 + 2 * CL_EXTERNAL_MEMORY_GAP + 2;
+  reads[2].size = 2;
+  reads[3].address = base;
+  reads[3].size = 4;
+  reads[4].address = split;
+  reads[4].size = 8;
+  reads[5].address = base + 8 + CL_EXTERNAL_MEMORY_GAP;
+  reads[5].size = 1;
+  reads[6].address = split + CL_READ_RANGE_MAX - 8;
+  reads[6].size = 8;
+  reads[7].address = base + 2;
+  reads[7].size = 2;
+  for (count = 8; count < 8 + CL_READ_RANGE_MAX / 72; count++)
+  {
+    reads[count].address = split + (count - 7) * 72;
+    reads[count].size = 8;
+  }
+  range_count = cl_read_plan_ranges(reads, count, &buffer_used);
+  cl_memory_test_read_plan_ranges(reads, count, range_count, buffer_used);
+  if (range_count != 4 ||
+      cl_read_plan.ranges[0].address != base ||
+      cl_read_plan.ranges[0].size != 8 + CL_EXTERNAL_MEMORY_GAP + 1 ||
+      cl_read_plan.range_starts[1] != 4 ||
+      cl_read_plan.ranges[1].address != reads[2].address ||
+      cl_read_plan.ranges[1].dest != reads[2].dest ||
+      cl_read_plan.ranges[2].address != split ||
+      cl_read_plan.ranges[2].size != CL_READ_RANGE_MAX ||
+      cl_read_plan.range_starts[3] != count - 1 ||
+      cl_read_plan.ranges[3].address != reads[0].address ||
+      cl_read_plan.ranges[3].size != 4)
+    CL_TEST_FAIL(16);
+
+  /* Random batches, from packed together to spread out */
+  for (i = 0; i < 64; i++)
+  {
+    unsigned spread = 4 << (i % 16);
+
+    count = 1 + i * 8;
+    for (j = 0; j < count; j++)
+    {
+      cl_addr_t offset = (cl_addr_t)cl_test_rand(&seed) * 4;
+
+      offset += cl_test_rand(&seed) % 4;
+      reads[j].address = base + offset % spread;
+      reads[j].size = 1 << (cl_test_rand(&seed) % 4);
+    }
+    range_count = cl_read_plan_ranges(reads, count, &buffer_used);
+    cl_memory_test_read_plan_ranges(reads, count, range_count, buffer_used);
+  }
+
+  cl_read_plan_free();
+}
+#endif
+
+int cl_memory_tests(void)
+{
+  cl_memory_test_readers();
+  cl_memory_test_word_flip();
+  cl_memory_test_regions();
+#if CL_EXTERNAL_MEMORY && CL_EXTERNAL_MEMORY_BATCH
+  cl_memory_test_read_plan();
+#endif
+
+  return 1;
+}
+
+#endif
@@ -2,6 +2,7 @@
 #define CL_MEMORY_H
 
 #include "cl_common.h"
+#include "cl_ptrcache.h"
 
 /* Memnotes marked with this are submitted to the server on every request,
    as well as on timed intervals to retrieve a play status string. */
@@ -113,43 +114,127 @@ typedef struct cl_memory_region_t
   char title[256];
 } cl_memory_region_t;
 
+/**
+ * A request to copy a portion of memory into a buffer, as part of a batch.
+ **/
+typedef struct cl_memory_read_t
+{
+  /** The virtual address to read from. */
+  cl_addr_t address;
+
+  /** The buffer to copy into. */
+  void *dest;
+
+  /** The number of bytes to read. */
+  unsigned size;
+
+  /** Set to the number of bytes successfully read. */
+  unsigned read;
+} cl_memory_read_t;
+
 /**
  * A "memory note" or "memnote" is a point in core memory that corresponds
  * with an observable in-game value. Instead of accessing specific addreses
  * every frame, we allocate memory notes and update their contents, then look 
  * off of them for script conditions.
-
- * Here, we keep track of a memnote's value on the current and previous
- * frame, as well as the last unique value it had before it became
- * what it currently is. 
+ *
+ * This struct only holds the definition of a note. The values it tracks are
+ * kept in the cl_memnote_state_t of the global memory context, at the same
+ * index as the note.
 **/
 typedef struct cl_memnote_t
 {
   unsigned  key;
   unsigned  order;
-  cl_addr_t address;
   cl_addr_t address_initial;
 
   unsigned flags;
   unsigned type;
 
-  /* Stored values */
-  cl_counter_t current;
-  cl_counter_t previous;
-  cl_counter_t last_unique;
+  /**
+   * The number of script operands, flags and editor views using this note.
+   * Notes with no references are not read by cl_update_memory, and keep the
+   * values they had when last updated.
+   */
+  unsigned refs;
 
   /* For following pointers to get RAM values */
   unsigned *pointer_offsets;
   unsigned  pointer_passes;
+} cl_memnote_t;
+
+/**
+ * Reads a value of one data type and byte order from memory into a counter.
+ * @param counter The counter to store the value in, as cl_ctr_store would.
+ * @param src A pointer to the value, which does not need to be aligned.
+ **/
+typedef void (*cl_memory_reader_t)(cl_counter_t *counter, const uint8_t *src);
+
+/**
+ * The values tracked for a memory note: its value on the current and previous
+ * frame, as well as the last unique value it had before it became what it
+ * currently is.
+**/
+typedef struct cl_memnote_values_t
+{
+  cl_counter_t current;
+  cl_counter_t previous;
+  cl_counter_t last_unique;
+} cl_memnote_values_t;
+
+/**
+ * The state of every memory note that changes as memory is updated, kept in
+ * arrays indexed the same as the note array. Updating memory each frame only
+ * streams through these, the pointer chains of the notes and the list of
+ * notes that are referenced.
+**/
+typedef struct cl_memnote_state_t
+{
+  /* The address each note's pointer chain resolved to when last updated */
+  cl_addr_t *addresses;
+
+  /* The data type of each note, copied from its definition */
+  uint8_t *types;
+
+  /**
+   * The function reading the value of each note, for its data type and the
+   * byte order in "reader_endianness". Chosen again whenever the note is read
+   * from a region with another byte order.
+   */
+  cl_memory_reader_t *readers;
+  uint8_t            *reader_endianness;
+
+  /* The stored values of each note */
+  cl_memnote_values_t *values;
+
+  /* Whether "current" differs from "previous" as of the last update */
+  bool *changed;
+
+  /* Whether any of the stored values changed on the last update */
+  bool *dirty;
+
+  /* The indices of the notes with references, in ascending order */
+  unsigned *active;
+  unsigned  active_count;
+
+  /* The note array the state was built from, to notice when it changes */
+  const cl_memnote_t *notes;
+  unsigned            note_count;
+} cl_memnote_state_t;
 
 #if CL_HAVE_EDITOR
-  /* Metadata for generated human-readable strings in Live Editor */
+/**
+ * Metadata for generated human-readable strings in Live Editor, kept apart
+ * from the memory notes since it is never read while updating them.
+**/
+typedef struct cl_memnote_meta_t
+{
   /* TODO: Identifiers */
   char description[2048];
   bool edited;
   char title      [256];
+} cl_memnote_meta_t;
 #endif
-} cl_memnote_t;
 
 /**
  * The global struct that contains information related to the content's memory,
@@ -160,8 +245,20 @@ typedef struct cl_memory_t
   cl_memnote_t *notes;
   unsigned note_count;
 
+  /* The values of the memory notes, built from the note array */
+  cl_memnote_state_t note_state;
+
+#if CL_HAVE_EDITOR
+  /* The editor metadata of each memory note, or NULL */
+  cl_memnote_meta_t *note_meta;
+#endif
+
   cl_memory_region_t *regions;
   unsigned region_count;
+
+  /* The pointers read while resolving memory note chains, expired whenever
+     memory is updated or written to */
+  cl_ptrcache_t pointer_cache;
 } cl_memory_t;
 
 /**
@@ -171,6 +268,39 @@ typedef struct cl_memory_t
  **/
 cl_memory_region_t* cl_find_memory_region(cl_addr_t address);
 
+/**
+ * Rebuilds the tables cl_find_memory_region uses to look up regions: an array
+ * sorted by base address, and a table of 64 KB pages for guest address spaces
+ * of 32 bits or less. Should be called whenever the memory regions change,
+ * from the thread that changed them. If the region array or its count is
+ * replaced without this, lookups scan the regions in order until it is.
+ **/
+void cl_memory_index_regions(void);
+
+/**
+ * Rebuilds the state of the memory notes in the global memory context, which
+ * resets their values to zero and their type to that of the note. Should be
+ * called whenever the note array changes. Done automatically if the note
+ * array or its count is replaced.
+ * @return Whether the state could be allocated.
+ **/
+bool cl_memory_index_notes(void);
+
+/**
+ * Gets the function that reads values of a data type in a byte order.
+ * @param type A type of memory value. For example, CL_MEMTYPE_UINT8.
+ * @param endianness The byte order. For example, CL_ENDIAN_LITTLE.
+ * @return The function, or NULL if the type or byte order is not valid.
+ **/
+cl_memory_reader_t cl_memory_reader(unsigned type, unsigned endianness);
+
+/**
+ * Gets the values tracked for a memory note in the global memory context.
+ * @param note A pointer to a memory note in the global note array.
+ * @return A pointer to the values, or NULL if the note is not in the array.
+ **/
+cl_memnote_values_t* cl_memnote_values(const cl_memnote_t *note);
+
 /**
  * Frees all values contained within the global memory context.
  **/
@@ -195,6 +325,20 @@ bool cl_init_membanks_libretro(const struct retro_memory_descriptor **descs,
    const unsigned num_descs);
 #endif
 
+/**
+ * Adds a reference to a memory note, so it is updated every frame until it is
+ * released with cl_memnote_unref.
+ * @param note A pointer to a memory note, or NULL to do nothing.
+ **/
+void cl_memnote_ref(cl_memnote_t *note);
+
+/**
+ * Releases a reference added with cl_memnote_ref. Once a note has no
+ * references left, it is no longer updated.
+ * @param note A pointer to a memory note, or NULL to do nothing.
+ **/
+void cl_memnote_unref(cl_memnote_t *note);
+
 /**
  * Checks whether or not a certain flag is set for a given memory note.
  * @param note A pointer to a memory note.
@@ -259,8 +403,8 @@ unsigned cl_read_memory_external(void *value, const cl_memory_region_t *bank,
 unsigned cl_sizeof_memtype(const unsigned type);
 
 /**
- * Steps through all memory notes and updates their values. Should be called 
- * once per frame.
+ * Steps through all referenced memory notes and updates their values. Should
+ * be called once per frame.
  **/
 void cl_update_memory(void);
 
@@ -287,13 +431,23 @@ bool cl_write_memnote(cl_memnote_t *note, const cl_counter_t *value);
 bool cl_write_memnote_from_key(unsigned key, const cl_counter_t *value);
 
 /**
- * Looks up a memory note based on its key.
+ * Looks up a memory note based on its key, using an index built when memory
+ * notes are initialized.
  * @param key The memory note key to look up. Currently a value between 0-999.
  * @return A pointer to the appropriate memory note, or NULL if one with the
  * given key does not exist.
  **/
 cl_memnote_t* cl_find_memnote(uint32_t key);
 
+#if CL_TESTS
+/**
+ * Checks that the readers from cl_memory_reader read every data type in every
+ * byte order the same as cl_read and cl_ctr_store do, and that regions are
+ * found the same as by searching them in order, including nested ones.
+ **/
+int cl_memory_tests(void);
+#endif
+
 extern cl_memory_t memory;
 
 #endif
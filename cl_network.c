@@ -27,12 +27,12 @@ bool cl_update_generic_post_data()
     {
       if (cl_get_memnote_value(&value, note, CL_SRCTYPE_CURRENT_RAM))
       {
-        if (cl_ctr_is_float(&note->current))
+        if (cl_ctr_is_float(&value))
           snprintf(generic_post_data, sizeof(generic_post_data), "%s&m%u=%f",
-            generic_post_data, note->key, value.floatval.fp);
+            generic_post_data, note->key, cl_ctr_get_float(&value));
         else
           snprintf(generic_post_data, sizeof(generic_post_data), "%s&m%u=%lli",
-            generic_post_data, note->key, value.intval.i64);
+            generic_post_data, note->key, cl_ctr_get_int(&value));
       }
       else
         return false;
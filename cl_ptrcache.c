@@ -0,0 +1,199 @@
+#include <string.h>
+
+#include "cl_common.h"
+#include "cl_memory.h"
+#include "cl_ptrcache.h"
+
+static unsigned cl_ptrcache_hash(const cl_ptrcache_t *cache, unsigned parent,
+  cl_addr_t key)
+{
+  uint64_t hash = (uint64_t)key * 0x9E3779B97F4A7C15ull;
+
+  hash ^= (uint64_t)parent * 0xC2B2AE3D27D4EB4Full;
+
+  return (unsigned)(hash >> 32) & (cache->slot_count - 1);
+}
+
+/**
+ * Reads the pointer at an address. As when memory notes resolved their own
+ * chains, the read goes into a copy of the address, so any bytes past the
+ * pointer length of the region are kept from it.
+ **/
+static bool cl_ptrcache_read(cl_addr_t *pointer, cl_addr_t address)
+{
+  const cl_memory_region_t *region = cl_find_memory_region(address);
+
+  *pointer = address;
+  if (!region)
+    return false;
+  else
+    return cl_read_memory(pointer, NULL, address,
+                          region->pointer_length) != 0;
+}
+
+/**
+ * Empties the cache while keeping its allocations.
+ **/
+static void cl_ptrcache_clear(cl_ptrcache_t *cache)
+{
+  cache->node_count = 0;
+  if (cache->slots)
+    memset(cache->slots, 0, cache->slot_count * sizeof(unsigned));
+}
+
+/**
+ * Doubles the node capacity of the cache, and rebuilds its table so it stays
+ * at most half full.
+ * @return Whether the allocations succeeded.
+ **/
+static bool cl_ptrcache_grow(cl_ptrcache_t *cache)
+{
+  unsigned capacity = cache->node_capacity ? cache->node_capacity * 2 : 64;
+  cl_ptrcache_node_t *nodes;
+  unsigned *slots;
+  unsigned i;
+
+  if (capacity > CL_PTRCACHE_MAX_NODES)
+    capacity = CL_PTRCACHE_MAX_NODES;
+  slots = (unsigned*)calloc(capacity * 2, sizeof(unsigned));
+  if (!slots)
+    return false;
+  nodes = (cl_ptrcache_node_t*)realloc(cache->nodes,
+                                       capacity * sizeof(cl_ptrcache_node_t));
+  if (!nodes)
+  {
+    free(slots);
+    return false;
+  }
+  cache->nodes = nodes;
+  cache->node_capacity = capacity;
+  free(cache->slots);
+  cache->slots = slots;
+  cache->slot_count = capacity * 2;
+
+  for (i = 0; i < cache->node_count; i++)
+  {
+    unsigned slot = cl_ptrcache_hash(cache, cache->nodes[i].parent,
+                                     cache->nodes[i].key);
+
+    while (cache->slots[slot])
+      slot = (slot + 1) & (cache->slot_count - 1);
+    cache->slots[slot] = i + 1;
+  }
+
+  return true;
+}
+
+/**
+ * Finds the node for a key under a parent, adding it if it is missing.
+ * @param parent The index of the parent node plus one, or 0 for a root.
+ * @return The index of the node plus one, or 0 if it could not be added.
+ **/
+static unsigned cl_ptrcache_find(cl_ptrcache_t *cache, unsigned parent,
+  cl_addr_t key)
+{
+  cl_ptrcache_node_t *node;
+  unsigned slot;
+
+  if (cache->slots)
+  {
+    for (slot = cl_ptrcache_hash(cache, parent, key);
+         cache->slots[slot];
+         slot = (slot + 1) & (cache->slot_count - 1))
+    {
+      node = &cache->nodes[cache->slots[slot] - 1];
+      if (node->parent == parent && node->key == key)
+        return cache->slots[slot];
+    }
+  }
+
+  if (cache->node_count == cache->node_capacity &&
+      (cache->node_capacity == CL_PTRCACHE_MAX_NODES ||
+       !cl_ptrcache_grow(cache)))
+    return 0;
+
+  /* The table may have been rebuilt, so probe again for a free slot */
+  for (slot = cl_ptrcache_hash(cache, parent, key);
+       cache->slots[slot];
+       slot = (slot + 1) & (cache->slot_count - 1));
+  node = &cache->nodes[cache->node_count];
+  node->key = key;
+  node->pointer = 0;
+  node->parent = parent;
+  node->frame = 0;
+  node->valid = false;
+  cache->slots[slot] = ++cache->node_count;
+
+  return cache->slots[slot];
+}
+
+bool cl_ptrcache_resolve(cl_ptrcache_t *cache, cl_addr_t *address,
+  cl_addr_t initial, const uint32_t *offsets, unsigned passes)
+{
+  cl_addr_t final_addr = initial;
+  unsigned  parent = 0;
+  bool      cached = cache != NULL;
+  unsigned  i;
+
+  if (cached)
+  {
+    /* Nodes are only added at the end, so a chain must fit in one go */
+    if (cache->node_count + passes > CL_PTRCACHE_MAX_NODES)
+      cl_ptrcache_clear(cache);
+    if (!cache->frame)
+      cache->frame = 1;
+  }
+
+  for (i = 0; i < passes; i++)
+  {
+    cl_addr_t pointer;
+
+    parent = cached ?
+      cl_ptrcache_find(cache, parent, i ? offsets[i - 1] : initial) : 0;
+    if (!parent)
+    {
+      /* Out of memory, so read the rest of the chain directly */
+      cached = false;
+      if (!cl_ptrcache_read(&pointer, final_addr))
+        return false;
+    }
+    else
+    {
+      cl_ptrcache_node_t *node = &cache->nodes[parent - 1];
+
+      if (node->frame != cache->frame)
+      {
+        node->valid = cl_ptrcache_read(&node->pointer, final_addr);
+        node->frame = cache->frame;
+      }
+      if (!node->valid)
+        return false;
+      pointer = node->pointer;
+    }
+    final_addr = pointer + offsets[i];
+  }
+  *address = final_addr;
+
+  return true;
+}
+
+void cl_ptrcache_invalidate(cl_ptrcache_t *cache)
+{
+  if (!cache)
+    return;
+  else if (++cache->frame == 0)
+  {
+    /* Nodes read long ago could look current again, so start over */
+    cl_ptrcache_clear(cache);
+    cache->frame = 1;
+  }
+}
+
+void cl_ptrcache_free(cl_ptrcache_t *cache)
+{
+  if (!cache)
+    return;
+  free(cache->nodes);
+  free(cache->slots);
+  memset(cache, 0, sizeof(*cache));
+}
@@ -0,0 +1,79 @@
+#ifndef CL_PTRCACHE_H
+#define CL_PTRCACHE_H
+
+#include "cl_types.h"
+
+/**
+ * The most nodes a pointer cache holds. Once a chain would not fit, the cache
+ * is emptied and starts over, which only costs the reads it was saving.
+ **/
+#define CL_PTRCACHE_MAX_NODES 65536
+
+/**
+ * A node of a pointer cache, standing for an initial address followed by a
+ * prefix of offsets. It holds the pointer read at the address the prefix
+ * leads to.
+ **/
+typedef struct cl_ptrcache_node_t
+{
+  /* The initial address for root nodes, or the last offset of the prefix */
+  cl_addr_t key;
+
+  /* The pointer read at the address this prefix leads to */
+  cl_addr_t pointer;
+
+  /* The index of the parent node plus one, or 0 for root nodes */
+  unsigned parent;
+
+  /* The frame "pointer" was read on. Reads from other frames are stale. */
+  unsigned frame;
+
+  /* Whether the address this prefix leads to could be read */
+  bool valid;
+} cl_ptrcache_node_t;
+
+/**
+ * A trie of the pointers read while resolving pointer chains, keyed by an
+ * initial address and then each offset. Chains sharing a prefix, like the
+ * fields of a struct reached through the same pointers, share its nodes, so
+ * each pointer is read once per frame however many chains pass through it.
+ **/
+typedef struct cl_ptrcache_t
+{
+  cl_ptrcache_node_t *nodes;
+  unsigned            node_count;
+  unsigned            node_capacity;
+
+  /* Open-addressed table of node indices plus one, keyed by parent and key */
+  unsigned *slots;
+  unsigned  slot_count;
+
+  /* The current frame. Incremented by cl_ptrcache_invalidate. */
+  unsigned frame;
+} cl_ptrcache_t;
+
+/**
+ * Follows a chain of pointers, reading each pointer at most once per frame.
+ * Reads are done directly if the cache cannot allocate memory.
+ * @param cache The pointer cache to use.
+ * @param address Set to the final address of the chain on success.
+ * @param initial The address of the first pointer.
+ * @param offsets The offset added to each pointer read.
+ * @param passes The number of pointers to follow.
+ * @return Whether every pointer in the chain could be read.
+ **/
+bool cl_ptrcache_resolve(cl_ptrcache_t *cache, cl_addr_t *address,
+  cl_addr_t initial, const uint32_t *offsets, unsigned passes);
+
+/**
+ * Starts a new frame, so every pointer is read again the next time it is
+ * used. Should be called whenever memory may have changed.
+ **/
+void cl_ptrcache_invalidate(cl_ptrcache_t *cache);
+
+/**
+ * Frees the nodes of a pointer cache, leaving it empty but usable.
+ **/
+void cl_ptrcache_free(cl_ptrcache_t *cache);
+
+#endif
@@ -4,6 +4,7 @@
 #include "cl_frontend.h"
 #include "cl_memory.h"
 #include "cl_script.h"
+#include "cl_script_jit.h"
 
 cl_script_t script;
 
@@ -13,6 +14,12 @@ void cl_page_free(cl_page_t *page)
 
   for (i = 0; i < page->action_count; i++)
     cl_free_action(&page->actions[i]);
+  free(page->program);
+  page->program = NULL;
+  free(page->inputs);
+  page->inputs = NULL;
+  page->input_count = 0;
+  cl_script_jit_free(page);
 }
 
 void cl_script_free(void)
@@ -21,6 +28,12 @@ void cl_script_free(void)
 
   for (i = 0; i < script.page_count; i++)
     cl_page_free(&script.pages[i]);
+  free(script.note_page_offsets);
+  free(script.note_pages);
+  script.note_page_offsets = NULL;
+  script.note_pages = NULL;
+  script.graph_notes = NULL;
+  script.graph_note_count = 0;
 }
 
 bool cl_init_page(const char **pos, cl_page_t *page)
@@ -76,6 +89,241 @@ bool cl_init_page(const char **pos, cl_page_t *page)
   return page->actions != 0;
 }
 
+/**
+ * Resolves the operands of every action on a page. Actions referring to
+ * something that does not exist are reported and disabled.
+ **/
+static void cl_link_page(cl_page_t *page, unsigned index)
+{
+  unsigned i;
+
+  for (i = 0; i < page->action_count; i++)
+  {
+    if (!cl_link_action(&page->actions[i], page->counters))
+    {
+      cl_message(CL_MSG_ERROR, "Disabled action %u on page %u, as its "
+                 "arguments could not be resolved.\n", i, index);
+      cl_free_action(&page->actions[i]);
+    }
+  }
+}
+
+/**
+ * Returns the index of the first action after a condition, the rest of its
+ * run and everything indented under them. This is where processing continues
+ * if the condition is false.
+ **/
+static unsigned cl_page_scope_end(const cl_page_t *page, unsigned index)
+{
+  unsigned indentation = page->actions[index].indentation;
+  unsigned i;
+
+  for (i = index + 1; i < page->action_count &&
+                      page->actions[i].if_type &&
+                      page->actions[i].indentation == indentation;
+       i++);
+  for (; i < page->action_count &&
+         page->actions[i].indentation > indentation;
+       i++);
+
+  return i;
+}
+
+/**
+ * Frees the actions of a page that can no longer have any effect, so the
+ * memory notes they read stop being updated: everything under a freed
+ * condition, which is never reached again, and conditions no longer guarding
+ * any action that is not freed. Conditions have no effects of their own, so
+ * this only changes whether freed actions are reached and counted as failing
+ * in the result of the page.
+ **/
+static void cl_page_retire_actions(cl_page_t *page)
+{
+  unsigned i, j;
+
+  for (i = 0; i < page->action_count; i++)
+  {
+    const cl_action_t *action = &page->actions[i];
+
+    if (action->if_type && action->type == CL_ACTTYPE_NO_PROCESS)
+    {
+      unsigned end = cl_page_scope_end(page, i);
+
+      for (j = i + 1; j < end; j++)
+        if (page->actions[j].type != CL_ACTTYPE_NO_PROCESS)
+          cl_free_action(&page->actions[j]);
+      i = end - 1;
+    }
+  }
+
+  /* Going backwards, so nested conditions are retired before their parents */
+  for (i = page->action_count; i-- > 0;)
+  {
+    cl_action_t *action = &page->actions[i];
+    unsigned     end;
+    bool         live = false;
+
+    if (!action->if_type || action->type == CL_ACTTYPE_NO_PROCESS)
+      continue;
+
+    /* Skip the rest of the run, which guards the same actions */
+    for (j = i + 1; j < page->action_count &&
+                    page->actions[j].if_type &&
+                    page->actions[j].indentation == action->indentation;
+         j++);
+    end = cl_page_scope_end(page, i);
+    for (; j < end && !live; j++)
+      live = page->actions[j].type != CL_ACTTYPE_NO_PROCESS;
+    if (!live)
+      cl_free_action(action);
+  }
+}
+
+/**
+ * Compiles the actions of a page into a flat list of instructions.
+ *
+ * A run of conditional actions at the same indentation must all be true for
+ * the actions indented under them to be processed. If one is false, the rest
+ * of the run and everything indented under it is skipped, so each condition
+ * stores the index to jump to when it fails.
+ **/
+static bool cl_compile_page(cl_page_t *page)
+{
+  unsigned i;
+
+  free(page->program);
+  page->program = (cl_instruction_t*)calloc(page->action_count + 1,
+                                            sizeof(cl_instruction_t));
+  if (!page->program)
+    return false;
+
+  for (i = 0; i < page->action_count; i++)
+  {
+    const cl_action_t *action = &page->actions[i];
+    cl_instruction_t *instruction = &page->program[i];
+
+    instruction->action = &page->actions[i];
+    if (!action->if_type)
+      instruction->opcode = CL_OPCODE_EXECUTE;
+    else
+    {
+      instruction->opcode = CL_OPCODE_CONDITION;
+
+      /* Conditions in the same run share the same jump target */
+      if (i > 0 && page->actions[i - 1].if_type &&
+          page->actions[i - 1].indentation == action->indentation)
+        instruction->jump = page->program[i - 1].jump;
+      else
+        instruction->jump = cl_page_scope_end(page, i);
+    }
+  }
+  page->program[page->action_count].opcode = CL_OPCODE_END;
+
+  return true;
+}
+
+/**
+ * Lists the memory notes read by the actions of a page, and whether the page
+ * must run every frame.
+ * @param index The index of the page.
+ * @param stamps One value per memory note, none of which are "index + 1".
+ **/
+static bool cl_page_find_inputs(cl_page_t *page, unsigned index,
+  unsigned *stamps)
+{
+  unsigned i, j;
+
+  free(page->inputs);
+  page->inputs = (unsigned*)malloc((page->action_count * CL_ACTION_OPERANDS +
+                                    1) * sizeof(unsigned));
+  page->input_count = 0;
+  page->always_run = false;
+  page->pending = true;
+  if (!page->inputs)
+    return false;
+
+  for (i = 0; i < page->action_count; i++)
+  {
+    const cl_action_t *action = &page->actions[i];
+
+    if (cl_action_has_side_effects(action))
+      page->always_run = true;
+    for (j = 0; j < CL_ACTION_OPERANDS; j++)
+    {
+      const cl_memnote_t *note = action->operands[j].memnote;
+      unsigned note_index;
+
+      if (!note)
+        continue;
+      note_index = (unsigned)(note - memory.notes);
+      if (stamps[note_index] != index + 1)
+      {
+        stamps[note_index] = index + 1;
+        page->inputs[page->input_count++] = note_index;
+      }
+    }
+  }
+
+  return true;
+}
+
+/**
+ * Builds the graph of which pages read each memory note. If it cannot be
+ * built, every page runs every frame.
+ **/
+static void cl_script_build_graph(void)
+{
+  unsigned *stamps;
+  unsigned  i, j;
+  bool      success = true;
+
+  free(script.note_page_offsets);
+  free(script.note_pages);
+  script.note_pages = NULL;
+  script.graph_notes = memory.notes;
+  script.graph_note_count = memory.note_count;
+  script.note_page_offsets = (unsigned*)calloc(memory.note_count + 1,
+                                               sizeof(unsigned));
+  stamps = (unsigned*)calloc(memory.note_count + 1, sizeof(unsigned));
+  if (!script.note_page_offsets || !stamps)
+    success = false;
+
+  for (i = 0; i < script.page_count && success; i++)
+    success = cl_page_find_inputs(&script.pages[i], i, stamps);
+
+  if (success)
+  {
+    /* Count the pages reading each note, then list them in page order */
+    for (i = 0; i < script.page_count; i++)
+      for (j = 0; j < script.pages[i].input_count; j++)
+        script.note_page_offsets[script.pages[i].inputs[j] + 1]++;
+    for (i = 0; i < memory.note_count; i++)
+      script.note_page_offsets[i + 1] += script.note_page_offsets[i];
+
+    script.note_pages = (unsigned*)malloc(
+      (script.note_page_offsets[memory.note_count] + 1) * sizeof(unsigned));
+    if (!script.note_pages)
+      success = false;
+    else
+    {
+      memcpy(stamps, script.note_page_offsets,
+             memory.note_count * sizeof(unsigned));
+      for (i = 0; i < script.page_count; i++)
+        for (j = 0; j < script.pages[i].input_count; j++)
+          script.note_pages[stamps[script.pages[i].inputs[j]]++] = i;
+    }
+  }
+
+  if (!success)
+  {
+    for (i = 0; i < script.page_count; i++)
+      script.pages[i].always_run = true;
+    free(script.note_page_offsets);
+    script.note_page_offsets = NULL;
+  }
+  free(stamps);
+}
+
 bool cl_script_init(const char **pos)
 {
   script.status = CL_SCRSTATUS_INACTIVE;
@@ -90,75 +338,171 @@ bool cl_script_init(const char **pos)
     for (i = 0; i < script.page_count; i++)
       if (!cl_init_page(pos, &script.pages[i]))
         return false;
+    for (i = 0; i < script.page_count; i++)
+    {
+      cl_link_page(&script.pages[i], i);
+      cl_page_retire_actions(&script.pages[i]);
+      if (!cl_compile_page(&script.pages[i]))
+        return false;
+#if CL_SCRIPT_JIT
+      cl_script_jit_compile(&script.pages[i]);
+#endif
+    }
+    cl_script_build_graph();
     script.status = CL_SRCSTATUS_ACTIVE;
 
     return true;
   }
 }
 
-static unsigned cl_process_if_statements(cl_page_t *page, unsigned pos)
+#if defined(__GNUC__) || defined(__clang__)
+/* Dispatch instructions with computed gotos instead of a switch */
+#define CL_SCRIPT_COMPUTED_GOTO 1
+#else
+#define CL_SCRIPT_COMPUTED_GOTO 0
+#endif
+
+static bool cl_process_instruction(const cl_instruction_t *instruction)
 {
-  unsigned current_indent = page->actions[pos].indentation;
-  bool     evaluation     = true;
-  unsigned i;
+  cl_action_t *action = instruction->action;
 
-  for (i = pos; i < page->action_count; i++)
+  script.current_action = action;
+  if (action->function(action))
   {
-    /* Make sure all if statements on the current indentation level are true */
-    if (page->actions[i].if_type &&
-        page->actions[i].indentation == current_indent)
-    {
-      if (evaluation)
-        evaluation = cl_process_action(&page->actions[i]);
-      else
-        continue;
-    }
-    else if (current_indent < page->actions[i].indentation)
-    {
-      /* Indentation went one level deeper, should we follow it? */
-      if (evaluation)
-        return i;
-      else
-      {
-        /* These conditions evaluated false, so skip all of their children */
-        do
-        {
-          i++;
-        } while (page->actions[i].indentation > current_indent &&
-                 i < page->action_count);
-        return i;
-      }
-    }
-    else
-      return i;
+    action->executions++;
+    return true;
   }
-
-  return page->action_count - 1;
+  else
+    return false;
 }
 
 bool cl_process_actions(cl_page_t *page)
 {
-  bool     success = true;
-  unsigned i       = 0;
+  const cl_instruction_t *program     = page->program;
+  const cl_instruction_t *instruction = program;
+  bool                    success     = true;
 
-  while (i < page->action_count)
-  {
-    script.current_action = &page->actions[i];
+  if (page->native)
+    return page->native();
+  else if (!program)
+    return false;
 
-    if (script.status != CL_SRCSTATUS_ACTIVE)
-      break;
-    else if (page->actions[i].if_type)
-      i = cl_process_if_statements(page, i);
+#if CL_SCRIPT_COMPUTED_GOTO
+  {
+    static const void *const opcodes[CL_OPCODE_SIZE] =
+    {
+      &&op_end,
+      &&op_execute,
+      &&op_condition
+    };
+
+#define CL_SCRIPT_DISPATCH \
+    if (script.status != CL_SRCSTATUS_ACTIVE) \
+      return success; \
+    goto *opcodes[instruction->opcode]
+
+    CL_SCRIPT_DISPATCH;
+
+  op_execute:
+    /* TODO: Error handling if a direct command returns false? */
+    success &= cl_process_instruction(instruction);
+    instruction++;
+    CL_SCRIPT_DISPATCH;
+
+  op_condition:
+    if (cl_process_instruction(instruction))
+      instruction++;
     else
+      instruction = &program[instruction->jump];
+    CL_SCRIPT_DISPATCH;
+
+  op_end:
+    return success;
+
+#undef CL_SCRIPT_DISPATCH
+  }
+#else
+  while (script.status == CL_SRCSTATUS_ACTIVE)
+  {
+    switch (instruction->opcode)
     {
-      /* TODO: Error handling if a direct command returns false? */
-      success &= cl_process_action(&page->actions[i]);
-      i++;
+    case CL_OPCODE_EXECUTE:
+      success &= cl_process_instruction(instruction);
+      instruction++;
+      break;
+    case CL_OPCODE_CONDITION:
+      if (cl_process_instruction(instruction))
+        instruction++;
+      else
+        instruction = &program[instruction->jump];
+      break;
+    case CL_OPCODE_END:
+    default:
+      return success;
     }
   }
 
   return success;
+#endif
+}
+
+#if CL_SCRIPT_CHANGE_DRIVEN
+/**
+ * Marks every page reading a memory note that changed on this frame to be
+ * processed.
+ **/
+static void cl_script_mark_pages(void)
+{
+  unsigned i, j;
+
+  /* The notes were replaced since the graph was built */
+  if (!script.note_page_offsets || script.graph_notes != memory.notes ||
+      script.graph_note_count != memory.note_count ||
+      memory.note_state.notes != memory.notes ||
+      memory.note_state.note_count != memory.note_count)
+  {
+    for (i = 0; i < script.page_count; i++)
+      script.pages[i].pending = true;
+    return;
+  }
+
+  for (i = 0; i < memory.note_count; i++)
+    if (memory.note_state.dirty[i])
+      for (j = script.note_page_offsets[i];
+           j < script.note_page_offsets[i + 1];
+           j++)
+        script.pages[script.note_pages[j]].pending = true;
+}
+
+/**
+ * Processes a page if anything it reads changed since it was last processed.
+ * A page is a function of the memory notes it reads, its own counters and
+ * which of its actions are freed, so if none of those changed, processing it
+ * again would do exactly what it did last time.
+ **/
+static bool cl_process_page(cl_page_t *page)
+{
+  cl_counter_t counters[CL_COUNTERS_SIZE];
+  unsigned     freed_actions = script.freed_actions;
+  unsigned     i;
+
+  if (!page->always_run && !page->pending)
+    return page->result;
+
+  memcpy(counters, page->counters, sizeof(counters));
+  page->result = cl_process_actions(page);
+
+  /* If the page changed itself, it has to see the change on the next frame */
+  page->pending = script.status != CL_SRCSTATUS_ACTIVE ||
+                  freed_actions != script.freed_actions;
+  for (i = 0; i < CL_COUNTERS_SIZE && !page->pending; i++)
+    if (counters[i].type != page->counters[i].type ||
+        !cl_ctr_equal_exact(&counters[i], &page->counters[i]))
+      page->pending = true;
+
+  return page->result;
 }
+#endif
 
 bool cl_script_update(void)
 {
@@ -169,10 +513,21 @@ bool cl_script_update(void)
     bool     success = true;
     unsigned i;
 
+#if CL_SCRIPT_CHANGE_DRIVEN
+    cl_script_mark_pages();
+#endif
     for (i = 0; i < script.page_count; i++)
     {
+      unsigned freed_actions = script.freed_actions;
+
       script.current_page = &script.pages[i];
+#if CL_SCRIPT_CHANGE_DRIVEN
+      success &= cl_process_page(script.current_page);
+#else
       success &= cl_process_actions(script.current_page);
+#endif
+      if (freed_actions != script.freed_actions)
+        cl_page_retire_actions(script.current_page);
     }
 
     return success;
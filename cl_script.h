@@ -17,14 +17,63 @@ enum
 /* TODO: Arbitrary! Have pages allocate more/less depending on need */
 #define CL_COUNTERS_SIZE 16
 
+typedef enum
+{
+  /* Stops processing the page */
+  CL_OPCODE_END = 0,
+
+  /* Processes an action */
+  CL_OPCODE_EXECUTE,
+
+  /* Processes a conditional action, jumping past its block if false */
+  CL_OPCODE_CONDITION,
+
+  CL_OPCODE_SIZE
+} cl_opcode;
+
+/**
+ * One step of a compiled page. Pages are compiled when a script is loaded so
+ * that processing them does not need to look at action indentation.
+ **/
+typedef struct cl_instruction_t
+{
+  cl_action_t *action;
+
+  /* For conditions, the instruction to continue from if the action fails */
+  unsigned jump;
+
+  /* What to do with the action. For example, CL_OPCODE_CONDITION. */
+  uint8_t opcode;
+} cl_instruction_t;
+
 typedef struct cl_page_t
 {
   cl_action_t *actions;
   unsigned     action_count;
 
+  /* The actions of the page compiled into instructions, ending in CL_OPCODE_END */
+  cl_instruction_t *program;
+
+  /* The page compiled to native code by cl_script_jit_compile, or NULL */
+  bool   (*native)(void);
+  unsigned native_size;
+
   /* Temporary values (bitflags, counters) we can use for logic */
   cl_counter_t counters[CL_COUNTERS_SIZE];
 
+  /* The index of each memory note read by the page's actions */
+  unsigned *inputs;
+  unsigned  input_count;
+
+  /* Whether the page has actions with side effects, and must always run */
+  bool always_run;
+
+  /* Whether something the page reads changed since it was last processed */
+  bool pending;
+
+  /* What processing the page returned the last time it was not skipped */
+  bool result;
+
   uint32_t     flags;
 } cl_page_t;
 
@@ -49,6 +98,21 @@ typedef struct cl_script_t
 
   /* A message describing the cause of the last script break. */
   char error_msg[256];
+
+  /**
+   * The pages reading each memory note, indexed by the position of the note
+   * in the memory note array. The pages reading note "i" are listed from
+   * note_pages[note_page_offsets[i]] up to note_pages[note_page_offsets[i + 1]].
+   **/
+  unsigned                  *note_page_offsets;
+  unsigned                  *note_pages;
+
+  /* The memory note array the graph was built from */
+  const struct cl_memnote_t *graph_notes;
+  unsigned                   graph_note_count;
+
+  /* Incremented whenever an action is freed, to notice pages changing */
+  unsigned freed_actions;
 } cl_script_t;
 
 /**
@@ -70,6 +134,13 @@ bool cl_script_init(const char **pos);
  **/
 bool cl_script_update(void);
 
+/**
+ * Processes the actions of a single page, using its native code if it has
+ *   been compiled to any.
+ * @return Whether or not all non-conditional actions processed correctly.
+ **/
+bool cl_process_actions(cl_page_t *page);
+
 /**
  * Signals to halt processing of the script and core. Used when debugging 
  * scripts.
@@ -0,0 +1,763 @@
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cl_config.h"
+#include "cl_memory.h"
+#include "cl_script.h"
+#include "cl_script_jit.h"
+
+#if defined(__x86_64__) && !defined(_WIN32)
+#define CL_SCRIPT_JIT_X64 true
+#include <sys/mman.h>
+#else
+#define CL_SCRIPT_JIT_X64 false
+#endif
+
+#if CL_SCRIPT_JIT_X64
+
+/* x86-64 register numbers */
+#define CL_JIT_RAX 0
+#define CL_JIT_RDX 2
+#define CL_JIT_RBX 3
+#define CL_JIT_RSI 6
+#define CL_JIT_RDI 7
+
+/* x86-64 condition codes, as used by jcc and setcc */
+#define CL_JIT_CC_E  0x4
+#define CL_JIT_CC_NE 0x5
+#define CL_JIT_CC_L  0xC
+#define CL_JIT_CC_GE 0xD
+#define CL_JIT_CC_LE 0xE
+#define CL_JIT_CC_G  0xF
+
+/* Offsets of the fields the generated code touches */
+#define CL_JIT_ACTION_TYPE       offsetof(cl_action_t, type)
+#define CL_JIT_ACTION_FUNCTION   offsetof(cl_action_t, function)
+#define CL_JIT_ACTION_EXECUTIONS offsetof(cl_action_t, executions)
+#define CL_JIT_COUNTER_VALUE     offsetof(cl_counter_t, value)
+#define CL_JIT_COUNTER_TYPE      offsetof(cl_counter_t, type)
+
+/**
+ * A jump patched once all code has been emitted, either to the start of an
+ * instruction or to the out-of-line call of an instruction.
+ **/
+typedef struct
+{
+  unsigned position;
+  unsigned instruction;
+  bool     cold;
+} cl_jit_fixup_t;
+
+typedef struct
+{
+  uint8_t *code;
+  unsigned size;
+  unsigned capacity;
+
+  /* The code offset of each instruction, with the epilogue as the last */
+  unsigned *labels;
+
+  /* The code offset of the out-of-line call of each inlined instruction */
+  unsigned *cold_labels;
+
+  cl_jit_fixup_t *fixups;
+  unsigned        fixup_count;
+  unsigned        fixup_capacity;
+
+  /* Set if any allocation failed */
+  bool error;
+} cl_jit_t;
+
+static void cl_jit_emit(cl_jit_t *jit, const void *data, unsigned size)
+{
+  if (jit->error)
+    return;
+  else if (jit->size + size > jit->capacity)
+  {
+    unsigned capacity = jit->capacity ? jit->capacity * 2 : 4096;
+    uint8_t *code;
+
+    while (capacity < jit->size + size)
+      capacity *= 2;
+    code = (uint8_t*)realloc(jit->code, capacity);
+    if (!code)
+    {
+      jit->error = true;
+      return;
+    }
+    jit->code = code;
+    jit->capacity = capacity;
+  }
+  memcpy(&jit->code[jit->size], data, size);
+  jit->size += size;
+}
+
+static void cl_jit_byte(cl_jit_t *jit, uint8_t value)
+{
+  cl_jit_emit(jit, &value, 1);
+}
+
+static void cl_jit_u32(cl_jit_t *jit, uint32_t value)
+{
+  uint8_t bytes[4];
+
+  bytes[0] = value & 0xFF;
+  bytes[1] = (value >> 8) & 0xFF;
+  bytes[2] = (value >> 16) & 0xFF;
+  bytes[3] = (value >> 24) & 0xFF;
+  cl_jit_emit(jit, bytes, sizeof(bytes));
+}
+
+/* mov reg, imm64 */
+static void cl_jit_mov_imm64(cl_jit_t *jit, unsigned reg, const void *ptr)
+{
+  uint64_t value = (uint64_t)(uintptr_t)ptr;
+
+  cl_jit_byte(jit, 0x48);
+  cl_jit_byte(jit, 0xB8 + reg);
+  cl_jit_u32(jit, (uint32_t)value);
+  cl_jit_u32(jit, (uint32_t)(value >> 32));
+}
+
+/**
+ * Emits an instruction with a [base + disp] memory operand.
+ * @param prefix A mandatory prefix, or 0 for none.
+ * @param rex A REX prefix, or 0 for none.
+ * @param opcode One or two opcode bytes, the first in the low byte.
+ * @param reg The register or opcode extension of the ModRM byte.
+ **/
+static void cl_jit_mem(cl_jit_t *jit, uint8_t prefix, uint8_t rex,
+  unsigned opcode, unsigned opcode_size, unsigned reg, unsigned base,
+  size_t disp)
+{
+  if (prefix)
+    cl_jit_byte(jit, prefix);
+  if (rex)
+    cl_jit_byte(jit, rex);
+  cl_jit_byte(jit, opcode & 0xFF);
+  if (opcode_size > 1)
+    cl_jit_byte(jit, (opcode >> 8) & 0xFF);
+  if (disp < 0x80)
+  {
+    cl_jit_byte(jit, 0x40 | (reg << 3) | base);
+    cl_jit_byte(jit, (uint8_t)disp);
+  }
+  else
+  {
+    cl_jit_byte(jit, 0x80 | (reg << 3) | base);
+    cl_jit_u32(jit, (uint32_t)disp);
+  }
+}
+
+/**
+ * Emits a jump with a 32-bit displacement to be patched later.
+ * @param cc A condition code, or -1 for an unconditional jump.
+ * @return The position of the displacement.
+ **/
+static unsigned cl_jit_jump(cl_jit_t *jit, int cc)
+{
+  if (cc < 0)
+    cl_jit_byte(jit, 0xE9);
+  else
+  {
+    cl_jit_byte(jit, 0x0F);
+    cl_jit_byte(jit, 0x80 + cc);
+  }
+  cl_jit_u32(jit, 0);
+
+  return jit->size - 4;
+}
+
+static void cl_jit_patch(cl_jit_t *jit, unsigned position, unsigned target)
+{
+  uint32_t rel = (uint32_t)(target - (position + 4));
+
+  if (jit->error)
+    return;
+  jit->code[position] = rel & 0xFF;
+  jit->code[position + 1] = (rel >> 8) & 0xFF;
+  jit->code[position + 2] = (rel >> 16) & 0xFF;
+  jit->code[position + 3] = (rel >> 24) & 0xFF;
+}
+
+/**
+ * Emits a jump to the start of an instruction or the epilogue, or with "cold"
+ * set, to the out-of-line call of an instruction.
+ **/
+static void cl_jit_jump_to(cl_jit_t *jit, int cc, unsigned instruction,
+  bool cold)
+{
+  unsigned position = cl_jit_jump(jit, cc);
+
+  if (jit->fixup_count == jit->fixup_capacity)
+  {
+    unsigned capacity = jit->fixup_capacity ? jit->fixup_capacity * 2 : 64;
+    cl_jit_fixup_t *fixups = (cl_jit_fixup_t*)realloc(jit->fixups,
+      capacity * sizeof(cl_jit_fixup_t));
+
+    if (!fixups)
+    {
+      jit->error = true;
+      return;
+    }
+    jit->fixups = fixups;
+    jit->fixup_capacity = capacity;
+  }
+  jit->fixups[jit->fixup_count].position = position;
+  jit->fixups[jit->fixup_count].instruction = instruction;
+  jit->fixups[jit->fixup_count].cold = cold;
+  jit->fixup_count++;
+}
+
+/* Leaves the page if an action paused or stopped the script */
+static void cl_jit_status_check(cl_jit_t *jit, unsigned epilogue)
+{
+  cl_jit_mov_imm64(jit, CL_JIT_RAX, &script.status);
+  /* cmp byte [rax], CL_SRCSTATUS_ACTIVE */
+  cl_jit_byte(jit, 0x80);
+  cl_jit_byte(jit, 0x38);
+  cl_jit_byte(jit, CL_SRCSTATUS_ACTIVE);
+  cl_jit_jump_to(jit, CL_JIT_CC_NE, epilogue, false);
+}
+
+/**
+ * Loads a counter address into a register, and unless it is an integer
+ * immediate that can never change, jumps to the out-of-line call of an
+ * instruction if the counter is not holding an integer.
+ **/
+static void cl_jit_guard_counter(cl_jit_t *jit, unsigned reg,
+  const cl_operand_t *operand, unsigned index)
+{
+  cl_jit_mov_imm64(jit, reg, operand->counter);
+  if (operand->counter != &operand->immediate)
+  {
+    /* cmp dword [reg + type], CL_MEMTYPE_INT64 */
+    cl_jit_mem(jit, 0, 0, 0x81, 1, 7, reg, CL_JIT_COUNTER_TYPE);
+    cl_jit_u32(jit, CL_MEMTYPE_INT64);
+    cl_jit_jump_to(jit, CL_JIT_CC_NE, index, true);
+  }
+}
+
+/**
+ * Returns whether an action has an inline implementation for integer
+ * counters. Comparisons are always conditions, and arithmetic never is.
+ **/
+static bool cl_jit_can_inline(const cl_instruction_t *ins)
+{
+  const cl_action_t *action = ins->action;
+  unsigned i;
+
+  if (!action->arguments)
+    return false;
+  for (i = 0; i < 2; i++)
+  {
+    const cl_operand_t *operand = &action->operands[i];
+
+    if (!operand->counter ||
+        (operand->counter == &operand->immediate &&
+         operand->immediate.type != CL_MEMTYPE_INT64))
+      return false;
+  }
+
+  switch (action->type)
+  {
+  case CL_ACTTYPE_COMPARE:
+    return ins->opcode == CL_OPCODE_CONDITION &&
+           action->arguments[4].intval >= CL_CMPTYPE_IFEQUAL &&
+           action->arguments[4].intval <= CL_CMPTYPE_IFNEQUAL;
+  case CL_ACTTYPE_ADDITION:
+  case CL_ACTTYPE_SUBTRACTION:
+  case CL_ACTTYPE_MULTIPLICATION:
+  case CL_ACTTYPE_AND:
+  case CL_ACTTYPE_OR:
+  case CL_ACTTYPE_XOR:
+    return ins->opcode == CL_OPCODE_EXECUTE;
+  default:
+    return false;
+  }
+}
+
+/**
+ * Emits an inlined action. The action is in rdi, the left counter in rsi and
+ * the right counter in rdx. A failed comparison jumps past its block.
+ **/
+static void cl_jit_emit_body(cl_jit_t *jit, const cl_instruction_t *ins)
+{
+  const cl_action_t *action = ins->action;
+
+  switch (action->type)
+  {
+  case CL_ACTTYPE_COMPARE:
+  {
+    unsigned fail;
+
+    switch (action->arguments[4].intval)
+    {
+    case CL_CMPTYPE_IFEQUAL:
+      fail = CL_JIT_CC_NE;
+      break;
+    case CL_CMPTYPE_IFGREATER:
+      fail = CL_JIT_CC_LE;
+      break;
+    case CL_CMPTYPE_IFLESS:
+      fail = CL_JIT_CC_GE;
+      break;
+    default:
+      fail = CL_JIT_CC_E;
+    }
+    /* mov rax, [rsi]; cmp rax, [rdx]; jcc fail */
+    cl_jit_mem(jit, 0, 0x48, 0x8B, 1, CL_JIT_RAX, CL_JIT_RSI,
+               CL_JIT_COUNTER_VALUE);
+    cl_jit_mem(jit, 0, 0x48, 0x3B, 1, CL_JIT_RAX, CL_JIT_RDX,
+               CL_JIT_COUNTER_VALUE);
+    cl_jit_jump_to(jit, fail, ins->jump, false);
+    break;
+  }
+  case CL_ACTTYPE_ADDITION:
+  case CL_ACTTYPE_SUBTRACTION:
+  case CL_ACTTYPE_MULTIPLICATION:
+  case CL_ACTTYPE_AND:
+  case CL_ACTTYPE_OR:
+  case CL_ACTTYPE_XOR:
+  {
+    unsigned opcode;
+    unsigned opcode_size = 1;
+
+    switch (action->type)
+    {
+    case CL_ACTTYPE_ADDITION:
+      opcode = 0x03;
+      break;
+    case CL_ACTTYPE_SUBTRACTION:
+      opcode = 0x2B;
+      break;
+    case CL_ACTTYPE_MULTIPLICATION:
+      opcode = 0xAF0F;
+      opcode_size = 2;
+      break;
+    case CL_ACTTYPE_AND:
+      opcode = 0x23;
+      break;
+    case CL_ACTTYPE_OR:
+      opcode = 0x0B;
+      break;
+    default:
+      opcode = 0x33;
+    }
+
+    /* mov rax, [rsi]; op rax, [rdx]; mov [rsi], rax */
+    cl_jit_mem(jit, 0, 0x48, 0x8B, 1, CL_JIT_RAX, CL_JIT_RSI,
+               CL_JIT_COUNTER_VALUE);
+    cl_jit_mem(jit, 0, 0x48, opcode, opcode_size, CL_JIT_RAX, CL_JIT_RDX,
+               CL_JIT_COUNTER_VALUE);
+    cl_jit_mem(jit, 0, 0x48, 0x89, 1, CL_JIT_RAX, CL_JIT_RSI,
+               CL_JIT_COUNTER_VALUE);
+    break;
+  }
+  default:
+    break;
+  }
+
+  /* inc dword [rdi + executions] */
+  cl_jit_mem(jit, 0, 0, 0xFF, 1, 0, CL_JIT_RDI, CL_JIT_ACTION_EXECUTIONS);
+}
+
+/**
+ * Emits a call to an action function, exactly as the interpreter processes
+ * an instruction, followed by a jump to the next instruction to run.
+ **/
+static void cl_jit_emit_call(cl_jit_t *jit, const cl_instruction_t *ins,
+  unsigned index, unsigned epilogue)
+{
+  unsigned is_false;
+
+  cl_jit_mov_imm64(jit, CL_JIT_RDI, ins->action);
+  cl_jit_mov_imm64(jit, CL_JIT_RAX, &script.current_action);
+  /* mov [rax], rdi */
+  cl_jit_byte(jit, 0x48);
+  cl_jit_byte(jit, 0x89);
+  cl_jit_byte(jit, 0x38);
+  /* call [rdi + function]; test al, al */
+  cl_jit_mem(jit, 0, 0, 0xFF, 1, 2, CL_JIT_RDI, CL_JIT_ACTION_FUNCTION);
+  cl_jit_byte(jit, 0x84);
+  cl_jit_byte(jit, 0xC0);
+  is_false = cl_jit_jump(jit, CL_JIT_CC_E);
+
+  /* inc dword [rdi + executions] */
+  cl_jit_mov_imm64(jit, CL_JIT_RDI, ins->action);
+  cl_jit_mem(jit, 0, 0, 0xFF, 1, 0, CL_JIT_RDI, CL_JIT_ACTION_EXECUTIONS);
+  cl_jit_status_check(jit, epilogue);
+  cl_jit_jump_to(jit, -1, index + 1, false);
+
+  cl_jit_patch(jit, is_false, jit->size);
+  if (ins->opcode == CL_OPCODE_EXECUTE)
+  {
+    /* xor ebx, ebx */
+    cl_jit_byte(jit, 0x31);
+    cl_jit_byte(jit, 0xDB);
+  }
+  cl_jit_status_check(jit, epilogue);
+  cl_jit_jump_to(jit, -1, ins->opcode == CL_OPCODE_CONDITION ?
+                          ins->jump : index + 1, false);
+}
+
+bool cl_script_jit_compile(cl_page_t *page)
+{
+  cl_jit_t jit;
+  void    *code;
+  unsigned epilogue = page->action_count;
+  unsigned i;
+
+  cl_script_jit_free(page);
+  if (!page->program)
+    return false;
+
+  memset(&jit, 0, sizeof(jit));
+  jit.labels = (unsigned*)calloc(page->action_count + 1, sizeof(unsigned));
+  jit.cold_labels = (unsigned*)calloc(page->action_count + 1,
+                                      sizeof(unsigned));
+  if (!jit.labels || !jit.cold_labels)
+    jit.error = true;
+
+  /* push rbx; mov ebx, 1 */
+  cl_jit_byte(&jit, 0x53);
+  cl_jit_byte(&jit, 0xB8 + CL_JIT_RBX);
+  cl_jit_u32(&jit, 1);
+  cl_jit_status_check(&jit, epilogue);
+
+  /*
+   * Inlined actions check their operands hold integers and fall through to
+   * the next instruction. Their calls to the action function, for when the
+   * checks fail, are kept after the epilogue so the common path stays small.
+   */
+  for (i = 0; i < page->action_count && !jit.error; i++)
+  {
+    const cl_instruction_t *ins = &page->program[i];
+
+    jit.labels[i] = jit.size;
+    if (cl_jit_can_inline(ins))
+    {
+      /* Check the action was not freed since it was compiled */
+      cl_jit_mov_imm64(&jit, CL_JIT_RDI, ins->action);
+      cl_jit_mem(&jit, 0, 0, 0x81, 1, 7, CL_JIT_RDI, CL_JIT_ACTION_TYPE);
+      cl_jit_u32(&jit, ins->action->type);
+      cl_jit_jump_to(&jit, CL_JIT_CC_NE, i, true);
+
+      cl_jit_guard_counter(&jit, CL_JIT_RSI, &ins->action->operands[0], i);
+      cl_jit_guard_counter(&jit, CL_JIT_RDX, &ins->action->operands[1], i);
+      cl_jit_emit_body(&jit, ins);
+    }
+    else
+      cl_jit_emit_call(&jit, ins, i, epilogue);
+  }
+
+  /* mov eax, ebx; pop rbx; ret */
+  if (!jit.error)
+    jit.labels[epilogue] = jit.size;
+  cl_jit_byte(&jit, 0x89);
+  cl_jit_byte(&jit, 0xD8);
+  cl_jit_byte(&jit, 0x5B);
+  cl_jit_byte(&jit, 0xC3);
+
+  for (i = 0; i < page->action_count && !jit.error; i++)
+  {
+    if (cl_jit_can_inline(&page->program[i]))
+    {
+      jit.cold_labels[i] = jit.size;
+      cl_jit_emit_call(&jit, &page->program[i], i, epilogue);
+    }
+  }
+
+  for (i = 0; i < jit.fixup_count && !jit.error; i++)
+    cl_jit_patch(&jit, jit.fixups[i].position, jit.fixups[i].cold ?
+      jit.cold_labels[jit.fixups[i].instruction] :
+      jit.labels[jit.fixups[i].instruction]);
+
+  code = jit.error ? MAP_FAILED : mmap(NULL, jit.size, PROT_READ | PROT_WRITE,
+                                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (code != MAP_FAILED)
+  {
+    memcpy(code, jit.code, jit.size);
+    if (mprotect(code, jit.size, PROT_READ | PROT_EXEC) == 0)
+    {
+      page->native = (bool(*)(void))code;
+      page->native_size = jit.size;
+    }
+    else
+      munmap(code, jit.size);
+  }
+  free(jit.code);
+  free(jit.labels);
+  free(jit.cold_labels);
+  free(jit.fixups);
+
+  return page->native != NULL;
+}
+
+void cl_script_jit_free(cl_page_t *page)
+{
+  if (page->native)
+    munmap((void*)page->native, page->native_size);
+  page->native = NULL;
+  page->native_size = 0;
+}
+
+#else
+
+bool cl_script_jit_compile(cl_page_t *page)
+{
+  CL_UNUSED(page);
+  return false;
+}
+
+void cl_script_jit_free(cl_page_t *page)
+{
+  page->native = NULL;
+  page->native_size = 0;
+}
+
+#endif
+
+#if CL_TESTS
+
+#define CL_JIT_TEST_PAGES 200
+#define CL_JIT_TEST_FRAMES 64
+#define CL_JIT_TEST_NOTES 4
+#define CL_JIT_TEST_TRACE_FRAMES 16
+
+static unsigned cl_jit_test_seed;
+
+/**
+ * Memory note values recorded over a short stretch of play, replayed for
+ * every frame of a test: lives, the level, a timer and the low byte of the
+ * score.
+ **/
+static const uint8_t cl_jit_test_trace[CL_JIT_TEST_TRACE_FRAMES]
+                                      [CL_JIT_TEST_NOTES] =
+{
+  { 3, 1, 99, 0x00 }, { 3, 1, 98, 0x00 }, { 3, 1, 97, 0x64 },
+  { 3, 1, 96, 0x64 }, { 2, 1, 95, 0x64 }, { 2, 1, 94, 0xC8 },
+  { 2, 2, 99, 0xC8 }, { 2, 2, 98, 0x2C }, { 2, 2, 97, 0x90 },
+  { 1, 2, 96, 0x90 }, { 1, 2, 95, 0xF4 }, { 1, 2, 94, 0xF4 },
+  { 1, 3, 99, 0x58 }, { 0, 3, 98, 0x58 }, { 0, 0,  0, 0x58 },
+  { 3, 1, 99, 0x00 }
+};
+
+/**
+ * Hand-written pages run over the recorded trace. The first counts lives
+ * lost and sums the score on level 2, then hashes the score into a counter
+ * with a multiplication that overflows. The second doubles, squares and
+ * subtracts counters until every one of them overflows.
+ **/
+static const char *cl_jit_test_pages[] =
+{
+  "1 7 "
+  "0 f 1 0 "
+  "1 1 3 0 0 1 "
+  "0 e 5 1 1 0 2 1 "
+  "1 1 3 1 1 3 "
+  "0 2 3 2 1 2 "
+  "0 8 3 3 1 3 "
+  "0 3 3 3 0 5851f42d4c957f2d",
+
+  "1 8 "
+  "0 1 3 1 5 1 "
+  "0 1 3 1 0 1 "
+  "0 1 3 2 0 3 "
+  "0 3 3 2 5 2 "
+  "0 2 3 3 0 7fffffffffffffff "
+  "0 e 5 5 1 0 0 2 "
+  "1 1 3 0 1 2 "
+  "0 3 3 0 1 0"
+};
+
+/**
+ * Writes a random page of conditions, counter arithmetic and counter type
+ * changes. Division, modulo and shifts are left out, as the interpreter does
+ * not define their results for every input.
+ **/
+static void cl_jit_test_script(char *buffer, unsigned actions)
+{
+  unsigned i;
+
+  buffer += sprintf(buffer, "1 %x ", actions + 1);
+  for (i = 0; i < actions; i++)
+  {
+    unsigned indentation = cl_test_rand(&cl_jit_test_seed) % 3;
+    unsigned source = cl_test_rand(&cl_jit_test_seed) % 4;
+    unsigned r = cl_test_rand(&cl_jit_test_seed) % 10;
+    char operand[32];
+
+    /* A memory note, a page counter, or an integer or float immediate */
+    if (source == 0)
+      snprintf(operand, sizeof(operand), "1 %x",
+               cl_test_rand(&cl_jit_test_seed) % CL_JIT_TEST_NOTES);
+    else if (source == 1)
+      snprintf(operand, sizeof(operand), "5 %x",
+               cl_test_rand(&cl_jit_test_seed) % 4);
+    else if (source == 2)
+      snprintf(operand, sizeof(operand), "0 %x",
+               cl_test_rand(&cl_jit_test_seed) % 8);
+    else
+      snprintf(operand, sizeof(operand), "6 4000000000000000");
+
+    if (r < 4)
+      buffer += sprintf(buffer, "%x %x 5 5 %x %s %x ", indentation,
+                        CL_ACTTYPE_COMPARE,
+                        cl_test_rand(&cl_jit_test_seed) % 4, operand,
+                        1 + cl_test_rand(&cl_jit_test_seed) % 4);
+    else if (r < 5)
+      buffer += sprintf(buffer, "%x %x 1 %x ", indentation,
+                        CL_ACTTYPE_CHANGED,
+                        cl_test_rand(&cl_jit_test_seed) % CL_JIT_TEST_NOTES);
+    else if (r < 9)
+    {
+      static const unsigned types[] =
+      {
+        CL_ACTTYPE_ADDITION, CL_ACTTYPE_SUBTRACTION,
+        CL_ACTTYPE_MULTIPLICATION, CL_ACTTYPE_AND, CL_ACTTYPE_OR,
+        CL_ACTTYPE_XOR
+      };
+
+      buffer += sprintf(buffer, "%x %x 3 %x %s ", indentation,
+                        types[cl_test_rand(&cl_jit_test_seed) % 6],
+                        cl_test_rand(&cl_jit_test_seed) % 4, operand);
+    }
+    else
+      buffer += sprintf(buffer, "%x %x 2 %x %x ", indentation,
+                        CL_ACTTYPE_CHANGE_CTR_TYPE,
+                        cl_test_rand(&cl_jit_test_seed) % 4,
+                        cl_test_rand(&cl_jit_test_seed) % 2 ?
+                          CL_MEMTYPE_INT64 : CL_MEMTYPE_DOUBLE);
+  }
+  sprintf(buffer, "0 %x 3 0 0 1", CL_ACTTYPE_ADDITION);
+}
+
+/**
+ * Loads a script and runs it over a trace of memory note values.
+ * @param native Whether to process the page with native code.
+ * @param trace The recorded trace to replay, or NULL for a random one.
+ * @param counters Set to the final page counters.
+ * @param executions Set to the number of times each action ran.
+ * @param results Set to a bit for the result of each frame.
+ * @return Whether the script was run, or false if native code could not be
+ * generated.
+ **/
+static bool cl_jit_test_run(const char *source, bool native,
+  const uint8_t (*trace)[CL_JIT_TEST_NOTES], unsigned trace_seed,
+  cl_counter_t *counters, unsigned *executions, uint64_t *results)
+{
+  cl_memnote_t notes[CL_JIT_TEST_NOTES];
+  cl_memnote_values_t *values;
+  cl_page_t   *page;
+  unsigned     i, frame;
+
+  memset(notes, 0, sizeof(notes));
+  for (i = 0; i < CL_JIT_TEST_NOTES; i++)
+    notes[i].key = i;
+  memory.notes = notes;
+  memory.note_count = CL_JIT_TEST_NOTES;
+  if (!cl_memory_index_notes())
+    CL_TEST_FAIL(1);
+  values = memory.note_state.values;
+
+  memset(&script, 0, sizeof(script));
+  if (!cl_script_init(&source))
+    CL_TEST_FAIL(1);
+  page = &script.pages[0];
+  if (native && !page->native && !cl_script_jit_compile(page))
+    return false;
+  else if (!native)
+    cl_script_jit_free(page);
+
+  cl_jit_test_seed = trace_seed;
+  *results = 0;
+  for (frame = 0; frame < CL_JIT_TEST_FRAMES; frame++)
+  {
+    for (i = 0; i < CL_JIT_TEST_NOTES; i++)
+    {
+      values[i].previous = values[i].current;
+      if (trace)
+        cl_ctr_store_int(&values[i].current,
+                         trace[frame % CL_JIT_TEST_TRACE_FRAMES][i]);
+      else if (cl_test_rand(&cl_jit_test_seed) % 16 == 0)
+        cl_ctr_store_float(&values[i].current,
+                           (double)cl_test_rand(&cl_jit_test_seed) / 7.0);
+      else
+        cl_ctr_store_int(&values[i].current,
+                         cl_test_rand(&cl_jit_test_seed) % 8);
+      if (!trace && cl_test_rand(&cl_jit_test_seed) % 32 == 0)
+        cl_ctr_change_type(&values[i].current, CL_MEMTYPE_FLOAT);
+    }
+    if (cl_process_actions(page))
+      *results |= 1ULL << frame;
+  }
+
+  memcpy(counters, page->counters, sizeof(page->counters));
+  for (i = 0; i < page->action_count; i++)
+    executions[i] = page->actions[i].executions;
+  cl_script_free();
+  free(page->actions);
+  free(script.pages);
+  memset(&script, 0, sizeof(script));
+  memory.notes = NULL;
+  memory.note_count = 0;
+  cl_memory_index_notes();
+
+  return true;
+}
+
+/**
+ * Runs a script with the interpreter and with native code, and checks that
+ * they agree.
+ * @return Whether native code could be generated.
+ **/
+static bool cl_jit_test_compare(const char *source,
+  const uint8_t (*trace)[CL_JIT_TEST_NOTES], unsigned trace_seed)
+{
+  cl_counter_t counters[2][CL_COUNTERS_SIZE];
+  unsigned     executions[2][64];
+  uint64_t     interpreted, native;
+  unsigned     i;
+
+  memset(executions, 0, sizeof(executions));
+  cl_jit_test_run(source, false, trace, trace_seed, counters[0],
+                  executions[0], &interpreted);
+  if (!cl_jit_test_run(source, true, trace, trace_seed, counters[1],
+                       executions[1], &native))
+    return false;
+  else if (native != interpreted)
+    CL_TEST_FAIL(2);
+  for (i = 0; i < CL_COUNTERS_SIZE; i++)
+    if (!cl_ctr_equal_exact(&counters[0][i], &counters[1][i]) ||
+        counters[0][i].type != counters[1][i].type)
+      CL_TEST_FAIL(3);
+  if (memcmp(executions[0], executions[1], sizeof(executions[0])))
+    CL_TEST_FAIL(4);
+
+  return true;
+}
+
+int cl_script_jit_tests(void)
+{
+  static char source[8192];
+  unsigned    i;
+
+  for (i = 0; i < sizeof(cl_jit_test_pages) / sizeof(cl_jit_test_pages[0]);
+       i++)
+    if (!cl_jit_test_compare(cl_jit_test_pages[i], cl_jit_test_trace, 0))
+      return 1;
+
+  for (i = 0; i < CL_JIT_TEST_PAGES; i++)
+  {
+    cl_jit_test_seed = i + 1;
+    cl_jit_test_script(source, 1 + cl_test_rand(&cl_jit_test_seed) % 48);
+    if (!cl_jit_test_compare(source, NULL, i))
+      return 1;
+  }
+
+  return 1;
+}
+
+#endif
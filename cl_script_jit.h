@@ -0,0 +1,32 @@
+#ifndef CL_SCRIPT_JIT_H
+#define CL_SCRIPT_JIT_H
+
+#include "cl_script.h"
+
+/**
+ * Compiles a page to native code, after it was linked and compiled to
+ * instructions. Counter arithmetic and comparisons are done inline with their
+ * operands as absolute addresses, while any other action, or any counter that
+ * is not holding an integer, falls back to calling the action function.
+ * Only x86-64 hosts using the System V calling convention are supported.
+ * @param page The page to compile. Its "native" member is set on success.
+ * @return Whether native code was generated. If not, the page is processed
+ * by the interpreter.
+ **/
+bool cl_script_jit_compile(cl_page_t *page);
+
+/**
+ * Frees the native code of a page, if it has any.
+ **/
+void cl_script_jit_free(cl_page_t *page);
+
+#if CL_TESTS
+/**
+ * Runs hand-written pages over a recorded trace of memory note values, and
+ * randomly generated pages over random ones, with both the interpreter and
+ * native code, and checks that they agree.
+ **/
+int cl_script_jit_tests(void);
+#endif
+
+#endif
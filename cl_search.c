@@ -1,10 +1,15 @@
 #include <math.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "cl_common.h"
+#include "cl_config.h"
 #include "cl_frontend.h"
 #include "cl_memory.h"
 #include "cl_search.h"
+#include "cl_search_kernel.h"
+#include "cl_thread.h"
+#include "cl_writewatch.h"
 
 cl_searchbank_t* cl_searchbank_from_address(cl_search_t *search, 
   cl_addr_t address)
@@ -28,6 +33,351 @@ cl_searchbank_t* cl_searchbank_from_address(cl_search_t *search,
   }
 }
 
+/**
+ * Returns the index of the first list entry at or after the given offset.
+ */
+static cl_addr_t cl_searchbank_lower_bound(const cl_searchbank_t *sbank,
+  cl_addr_t offset)
+{
+  cl_addr_t low = 0, high = sbank->matches;
+
+  while (low < high)
+  {
+    cl_addr_t middle = low + (high - low) / 2;
+
+    if (sbank->entries[middle].offset < offset)
+      low = middle + 1;
+    else
+      high = middle;
+  }
+
+  return low;
+}
+
+/**
+ * Returns the list entry for the given offset, or NULL if it is not valid.
+ */
+static cl_searchentry_t* cl_searchbank_find_entry(const cl_searchbank_t *sbank,
+  cl_addr_t offset)
+{
+  cl_addr_t index = cl_searchbank_lower_bound(sbank, offset);
+
+  if (index < sbank->matches && sbank->entries[index].offset == offset)
+    return &sbank->entries[index];
+  else
+    return NULL;
+}
+
+/**
+ * Switches a searchbank back to a full-size snapshot and bitset. If either
+ * cannot be allocated, the searchbank keeps its sorted list.
+ */
+static bool cl_searchbank_make_dense(cl_searchbank_t *sbank)
+{
+  if (!sbank->sparse)
+    return true;
+  else
+  {
+    cl_search_bitset_t valid;
+    uint8_t *backup = (uint8_t*)malloc(sbank->region->size ?
+                                       sbank->region->size : 1);
+
+    memset(&valid, 0, sizeof(valid));
+    if (!backup || !cl_search_bitset_init(&valid, sbank->region->size))
+    {
+      free(backup);
+      cl_search_bitset_free(&valid);
+
+      return false;
+    }
+    free(sbank->entries);
+    sbank->entries = NULL;
+    sbank->sparse = false;
+    sbank->backup = backup;
+    sbank->valid = valid;
+
+    return true;
+  }
+}
+
+/**
+ * Moves the candidates of a searchbank into a sorted list, taking their
+ * previous bytes from the snapshot, then frees the snapshot and bitset.
+ */
+static bool cl_searchbank_make_sparse(cl_searchbank_t *sbank)
+{
+  if (sbank->sparse)
+    return true;
+  else
+  {
+    cl_searchentry_t *entries;
+    cl_addr_t offset = 0;
+    cl_addr_t length;
+    cl_addr_t i = 0;
+
+    entries = (cl_searchentry_t*)calloc(sbank->matches ? sbank->matches : 1,
+                                        sizeof(cl_searchentry_t));
+    if (!entries)
+      return false;
+    while (i < sbank->matches &&
+           cl_search_bitset_find(&sbank->valid, 0, &offset,
+                                 sbank->region->size))
+    {
+      length = sbank->region->size - offset;
+      if (length > sizeof(entries[i].previous))
+        length = sizeof(entries[i].previous);
+      memcpy(entries[i].previous, &sbank->backup[offset], length);
+      entries[i].offset = offset;
+      offset++;
+      i++;
+    }
+    free(sbank->backup);
+    sbank->backup = NULL;
+    cl_search_bitset_free(&sbank->valid);
+    sbank->entries = entries;
+    sbank->matches = i;
+    sbank->sparse = true;
+
+    return true;
+  }
+}
+
+#define CL_SEARCH_PAGE_WORDS (CL_SEARCH_PAGE_SIZE / CL_SEARCH_WORD_BITS)
+
+/**
+ * Returns whether the page holding a bitset word may have changed since the
+ * last copy of external memory.
+ */
+static bool cl_searchbank_page_dirty(const cl_searchbank_t *sbank,
+  cl_addr_t word)
+{
+  const cl_addr_t page = word / CL_SEARCH_PAGE_WORDS;
+
+  return (sbank->dirty[page / 64] >> (page % 64)) & 1;
+}
+
+/**
+ * Copies the current bytes of the candidates in a range of bitset words into
+ * the snapshot, leaving the bytes of weeded out addresses stale. Candidates
+ * within a block of each other are copied as one run.
+ * Nothing past the end of the range is written, so ranges can be refreshed in
+ * parallel.
+ */
+static void cl_searchbank_refresh(cl_searchbank_t *sbank, cl_addr_t word,
+  cl_addr_t word_end)
+{
+  const uint8_t *current = (const uint8_t*)sbank->region->base_host;
+  cl_addr_t start = word * CL_SEARCH_WORD_BITS;
+  cl_addr_t limit = word_end * CL_SEARCH_WORD_BITS;
+  cl_addr_t end = start;
+  cl_addr_t first, last;
+  uint64_t bits;
+
+  if (limit > sbank->region->size)
+    limit = sbank->region->size;
+
+  /* A value at the end of the range before this one may spill into it */
+  if (start)
+  {
+    end = start + sizeof(uint32_t) - 1;
+    if (end > limit)
+      end = limit;
+  }
+
+  while (cl_search_bitset_find(&sbank->valid, 1, &word, word_end))
+  {
+    /* Unchanged pages already match the snapshot */
+    if (sbank->dirty && !cl_searchbank_page_dirty(sbank, word))
+    {
+      word = (word / CL_SEARCH_PAGE_WORDS + 1) * CL_SEARCH_PAGE_WORDS;
+      continue;
+    }
+    bits  = sbank->valid.levels[0][word];
+    first = word * CL_SEARCH_WORD_BITS + cl_ctz64(bits);
+
+    /* Cover the widest value a later step may read at the last candidate */
+    last  = word * CL_SEARCH_WORD_BITS + cl_msb64(bits) + sizeof(uint32_t);
+    if (last > limit)
+      last = limit;
+
+    if (end > start && first <= end + CL_SEARCH_WORD_BITS)
+      end = last;
+    else
+    {
+      if (end > start)
+        memcpy(&sbank->backup[start], &current[start], end - start);
+      start = first;
+      end   = last;
+    }
+    word++;
+  }
+  if (end > start)
+    memcpy(&sbank->backup[start], &current[start], end - start);
+}
+
+/**
+ * The number of bytes of a bank handled by one job of a parallel step. Each
+ * chunk owns whole words at every level of the validity bitset, so chunks can
+ * update their summaries without touching each other.
+ */
+#define CL_SEARCH_CHUNK_SIZE \
+  (CL_SEARCH_WORD_BITS * CL_SEARCH_WORD_BITS * CL_SEARCH_WORD_BITS)
+#define CL_SEARCH_CHUNK_WORDS (CL_SEARCH_CHUNK_SIZE / CL_SEARCH_WORD_BITS)
+
+typedef struct cl_search_chunk_t
+{
+  cl_addr_t matches;
+  cl_addr_t first;
+  cl_addr_t last;
+} cl_search_chunk_t;
+
+typedef struct cl_search_job_t
+{
+  const cl_search_kernel_args_t *args;
+  cl_searchbank_t               *sbank;
+  cl_search_chunk_t             *chunks;
+} cl_search_job_t;
+
+/**
+ * Returns the bitset words of one chunk of a parallel step, clamped to the
+ * words the step visits.
+ */
+static void cl_search_chunk_words(const cl_search_job_t *job, unsigned index,
+  cl_addr_t *begin, cl_addr_t *end)
+{
+  const cl_addr_t first_chunk = job->args->word_begin / CL_SEARCH_CHUNK_WORDS;
+
+  *begin = (first_chunk + index) * CL_SEARCH_CHUNK_WORDS;
+  *end   = *begin + CL_SEARCH_CHUNK_WORDS;
+  if (*begin < job->args->word_begin)
+    *begin = job->args->word_begin;
+  if (*end > job->args->word_end)
+    *end = job->args->word_end;
+}
+
+static void cl_search_job_compare(void *context, unsigned index,
+  unsigned worker)
+{
+  cl_search_job_t *job = (cl_search_job_t*)context;
+  cl_search_chunk_t *chunk = &job->chunks[index];
+  cl_search_kernel_args_t args = *job->args;
+
+  CL_UNUSED(worker);
+  cl_search_chunk_words(job, index, &args.word_begin, &args.word_end);
+  chunk->matches = cl_search_kernel_run(&args);
+  chunk->first = args.first;
+  chunk->last = args.last;
+}
+
+static void cl_search_job_refresh(void *context, unsigned index,
+  unsigned worker)
+{
+  cl_search_job_t *job = (cl_search_job_t*)context;
+  cl_addr_t begin, end;
+
+  CL_UNUSED(worker);
+
+  /* Use whole chunks, so the last candidate's bytes past the step are kept */
+  begin = (job->args->word_begin / CL_SEARCH_CHUNK_WORDS + index) *
+          CL_SEARCH_CHUNK_WORDS;
+  end   = begin + CL_SEARCH_CHUNK_WORDS;
+  if (end > job->sbank->valid.words[0])
+    end = job->sbank->valid.words[0];
+  cl_searchbank_refresh(job->sbank, begin, end);
+}
+
+#if CL_TESTS
+/* Replaces the shared pool in threaded steps, so tests can use more threads
+   than the host has CPUs */
+static cl_threadpool_t *cl_search_test_pool = NULL;
+#endif
+
+/**
+ * Returns the pool a threaded search is stepped over.
+ */
+static cl_threadpool_t* cl_search_pool(const cl_search_t *search)
+{
+  if (!search->threaded)
+    return NULL;
+#if CL_TESTS
+  else if (cl_search_test_pool)
+    return cl_search_test_pool;
+#endif
+  else
+    return cl_threadpool_shared();
+}
+
+/**
+ * Runs a step over a bank kept as a bitset, then refreshes its snapshot.
+ * Banks larger than a chunk are split over the shared thread pool, with
+ * results merged in chunk order so they match a serial step exactly.
+ * @return The number of matches left in the bank.
+ */
+static cl_addr_t cl_searchbank_step_dense(const cl_search_t *search,
+  cl_searchbank_t *sbank, cl_search_kernel_args_t *args)
+{
+  cl_threadpool_t *pool = cl_search_pool(search);
+  cl_addr_t matches = 0;
+  unsigned chunk_count;
+
+  if (args->word_begin >= args->word_end)
+    return 0;
+  chunk_count = (unsigned)((args->word_end - 1) / CL_SEARCH_CHUNK_WORDS -
+                           args->word_begin / CL_SEARCH_CHUNK_WORDS + 1);
+
+  if (cl_threadpool_size(pool) < 2 || chunk_count < 2)
+  {
+    matches = cl_search_kernel_run(args);
+    cl_searchbank_refresh(sbank, 0, sbank->valid.words[0]);
+  }
+  else
+  {
+    cl_search_job_t job;
+    unsigned i;
+
+    job.args = args;
+    job.sbank = sbank;
+    job.chunks = (cl_search_chunk_t*)calloc(chunk_count,
+                                            sizeof(cl_search_chunk_t));
+    if (!job.chunks)
+      return 0;
+
+    /* Snapshots are refreshed only once every chunk has read them */
+    cl_threadpool_run(pool, cl_search_job_compare, &job, chunk_count);
+    cl_threadpool_run(pool, cl_search_job_refresh, &job, chunk_count);
+
+    for (i = 0; i < chunk_count; i++)
+    {
+      if (!job.chunks[i].matches)
+        continue;
+      else if (!matches)
+        args->first = job.chunks[i].first;
+      args->last = job.chunks[i].last;
+      matches += job.chunks[i].matches;
+    }
+    free(job.chunks);
+  }
+
+  return matches;
+}
+
+#if CL_WRITEWATCH
+/**
+ * Removes the dirty page map of every bank, so the next step compares every
+ * page, for when the pages written to are not known.
+ */
+static void cl_search_forget_dirty(cl_search_t *search)
+{
+  unsigned i;
+
+  for (i = 0; i < search->searchbank_count; i++)
+  {
+    free(search->searchbanks[i].dirty);
+    search->searchbanks[i].dirty = NULL;
+  }
+}
+#endif
+
 bool cl_search_free(cl_search_t *search)
 {
   if (!search)
@@ -39,8 +389,15 @@ bool cl_search_free(cl_search_t *search)
     for (i = 0; i < search->searchbank_count; i++)
     {
       free(search->searchbanks[i].backup);
-      free(search->searchbanks[i].valid);
+      free(search->searchbanks[i].entries);
+      free(search->searchbanks[i].dirty);
+      cl_search_bitset_free(&search->searchbanks[i].valid);
     }
+#if CL_WRITEWATCH
+    if (search->searchbanks && search->watching)
+      cl_writewatch_stop();
+#endif
+    search->watching = false;
     free(search->searchbanks);
 
     return true;
@@ -55,8 +412,12 @@ bool cl_search_init(cl_search_t *search)
   {
     uint8_t i;
 
-    cl_log("Initializing a new search...\n");
+    cl_search_kernel_init();
+    cl_log("Initializing a new search (%s kernels)...\n",
+           cl_search_kernel_name());
     search->matches = 0;
+    search->sparse_threshold = CL_SEARCH_SPARSE_THRESHOLD;
+    search->threaded = CL_HAVE_THREADS;
     search->searchbank_count = memory.region_count;
     search->searchbanks = (cl_searchbank_t*)calloc(search->searchbank_count, sizeof(cl_searchbank_t));
 
@@ -71,8 +432,13 @@ bool cl_search_init(cl_search_t *search)
       sbank->any_valid = true;
       sbank->region = &memory.regions[i];
       sbank->backup = (uint8_t*)malloc(memory.regions[i].size);
-      sbank->valid = (uint8_t*)malloc(memory.regions[i].size);
+      cl_search_bitset_init(&sbank->valid, memory.regions[i].size);
     }
+#if CL_WRITEWATCH
+    search->watching = cl_writewatch_start();
+#else
+    search->watching = false;
+#endif
     cl_search_reset(search);
   }
 
@@ -105,22 +471,87 @@ bool cl_read_search(uint32_t *value, cl_search_t *search, cl_searchbank_t *sbank
       }
     }
   }
-  if (sbank->backup)
+  if (!sbank)
+    return false;
+  else if (sbank->sparse)
+  {
+    const cl_searchentry_t *entry = cl_searchbank_find_entry(sbank, address);
+
+    if (entry && search->params.size <= sizeof(entry->previous))
+      return cl_read(value, entry->previous, 0, search->params.size,
+                     sbank->region->endianness);
+  }
+  else if (sbank->backup)
     return cl_read(value, sbank->backup, address, search->params.size, sbank->region->endianness);
 
   return false;
 }
 
+bool cl_searchbank_is_valid(const cl_searchbank_t *sbank, cl_addr_t offset)
+{
+  if (!sbank || offset >= sbank->region->size)
+    return false;
+  else if (sbank->sparse)
+    return cl_searchbank_find_entry(sbank, offset) != NULL;
+  else
+    return cl_search_bitset_test(&sbank->valid, offset);
+}
+
+bool cl_searchbank_next_valid(const cl_searchbank_t *sbank, cl_addr_t *offset)
+{
+  if (!sbank || !offset || !sbank->any_valid)
+    return false;
+  else if (sbank->sparse)
+  {
+    cl_addr_t index = cl_searchbank_lower_bound(sbank, *offset);
+
+    if (index >= sbank->matches)
+      return false;
+    *offset = sbank->entries[index].offset;
+
+    return true;
+  }
+  else
+    return cl_search_bitset_find(&sbank->valid, 0, offset,
+                                 sbank->region->size);
+}
+
 bool cl_search_remove(cl_search_t *search, cl_addr_t address)
 {
   cl_searchbank_t *sbank = cl_searchbank_from_address(search, address);
+  cl_addr_t offset;
 
-  if (!sbank || sbank->valid[address -   sbank->region->base_guest] == 0)
+  if (!sbank)
+    return false;
+  offset = address - sbank->region->base_guest;
+  if (!cl_searchbank_is_valid(sbank, offset))
     return false;
   else
   {
-    sbank->valid[address -   sbank->region->base_guest] = 0;
-    search->matches--;
+    if (sbank->sparse)
+    {
+      cl_searchentry_t *entry = cl_searchbank_find_entry(sbank, offset);
+      cl_addr_t index = (cl_addr_t)(entry - sbank->entries);
+
+      memmove(entry, entry + 1,
+              (sbank->matches - index - 1) * sizeof(cl_searchentry_t));
+      sbank->matches--;
+      sbank->any_valid = sbank->matches != 0;
+    }
+    else
+    {
+      cl_addr_t next = 0;
+
+      cl_search_bitset_unset(&sbank->valid, offset);
+      if (sbank->matches)
+        sbank->matches--;
+
+      /* Go by the bitset itself, which the count is only kept in step with */
+      sbank->any_valid = cl_search_bitset_find(&sbank->valid, 0, &next,
+                                               sbank->region->size);
+    }
+    if (search->matches)
+      search->matches--;
 
     return true;
   }
@@ -133,193 +564,97 @@ bool cl_search_reset(cl_search_t *search)
   else
   {
     cl_searchbank_t *sbank;
+    cl_addr_t matches = 0;
+    bool reset = true;
     uint8_t i;
 
 #if CL_EXTERNAL_MEMORY == true
     cl_fe_search_deep_copy(search);
+#elif CL_WRITEWATCH
+    if (!search->watching || !cl_writewatch_collect(search))
+      cl_search_forget_dirty(search);
 #endif
     for (i = 0; i < search->searchbank_count; i++)
     {
       sbank = &search->searchbanks[i];
+
+      /* A bank that cannot be reset keeps the candidates it had */
+      if (!cl_searchbank_make_dense(sbank))
+      {
+        matches += sbank->matches;
+        reset = false;
+        continue;
+      }
       memcpy(sbank->backup, sbank->region->base_host, sbank->region->size);
-      memset(sbank->valid, 1, sbank->region->size);
-      sbank->any_valid = true;
+      cl_search_bitset_fill(&sbank->valid, sbank->region->size);
+      sbank->matches = sbank->region->size;
+      sbank->any_valid = sbank->region->size != 0;
       sbank->first_valid = 0;
       sbank->last_valid = sbank->region->size - 1;
+      matches += sbank->matches;
     }
-    search->matches = 0;
-
-    return true;
-  }
-}
-
-bool compare_to_nothing(uint32_t previous, uint32_t current, uint8_t type)
-{
-  switch (type)
-  {
-  case CLE_CMPTYPE_EQUAL:
-    return previous == current;
-  case CLE_CMPTYPE_LESS:
-  case CLE_CMPTYPE_DECREASED:
-    return previous > current;
-  case CLE_CMPTYPE_GREATER:
-  case CLE_CMPTYPE_INCREASED:
-    return previous < current;
-  case CLE_CMPTYPE_NOT_EQUAL:
-    return previous != current;
-  }
-
-  return false;
-}
-
-bool compare_to_nothing_float(uint32_t previous, uint32_t current, uint8_t type)
-{
-  float fprevious, fcurrent;
-
-  /* Cast to float */
-  memcpy(&fprevious, &previous, sizeof(float));
-  memcpy(&fcurrent,  &current,  sizeof(float));
-
-  switch (type)
-  {
-  case CLE_CMPTYPE_EQUAL:
-    return (uint32_t)fprevious == (uint32_t)fcurrent;
-  case CLE_CMPTYPE_LESS:
-  case CLE_CMPTYPE_DECREASED:
-    return (uint32_t)fprevious > (uint32_t)fcurrent;
-  case CLE_CMPTYPE_GREATER:
-  case CLE_CMPTYPE_INCREASED:
-    return (uint32_t)fprevious < (uint32_t)fcurrent;
-  case CLE_CMPTYPE_NOT_EQUAL:
-    return (uint32_t)fprevious != (uint32_t)fcurrent;
-  }
-
-  return false;
-}
-
-bool compare_to_value(uint32_t previous, uint32_t current, uint8_t type, uint32_t value)
-{
-  switch (type)
-  {
-  case CLE_CMPTYPE_EQUAL:
-    return current == value;
-  case CLE_CMPTYPE_GREATER:
-    return current > value;
-  case CLE_CMPTYPE_LESS:
-    return current < value;
-  case CLE_CMPTYPE_NOT_EQUAL:
-    return current != value;
-  case CLE_CMPTYPE_INCREASED:
-    return current == previous + value;
-  case CLE_CMPTYPE_DECREASED:
-    return current + value == previous;
-  }
-
-  return false;
-}
-
-bool compare_to_value_float(uint32_t previous, uint32_t current, uint8_t type, 
-  float value)
-{
-  float fprevious, fcurrent;
-  bool has_decimal_precision;
-
-  /* Cast to float */
-  memcpy(&fprevious, &previous, sizeof(float));
-  memcpy(&fcurrent,  &current,  sizeof(float));
-
-  /* This float is NaN */
-  if (isnan(fcurrent))
-    return false;
-
-  /* Only check decimal precision on equal ops if the user has specified */
-  has_decimal_precision = floor(value) != value;
+    search->matches = matches;
 
-  switch (type)
-  {
-  case CLE_CMPTYPE_EQUAL:
-    if (has_decimal_precision)
-      return fcurrent == value;
-    else
-      return floor(fcurrent) == value;
-  case CLE_CMPTYPE_GREATER:
-    return fcurrent > value;
-  case CLE_CMPTYPE_LESS:
-    return fcurrent < value;
-  case CLE_CMPTYPE_NOT_EQUAL:
-    return fcurrent != value;
-  case CLE_CMPTYPE_INCREASED:
-    if (has_decimal_precision)
-      return fcurrent == fprevious + value;
-    else
-      return floor(fcurrent) == floor(fprevious) + value;
-  case CLE_CMPTYPE_DECREASED:
-    if (has_decimal_precision)
-      return fcurrent + value == fprevious;
-    else
-      return floor(fcurrent) + value == floor(fprevious);
+    return reset;
   }
-
-  return false;
 }
 
-bool resolve_pointerresult(cl_addr_t *final_address, const cl_pointerresult_t *result, 
-  const uint8_t passes)
+bool resolve_pointerresult(cl_ptrcache_t *cache, cl_addr_t *final_address,
+  const cl_pointerresult_t *result, const uint8_t passes)
 {
-  cl_addr_t address = result->address_initial;
-  unsigned i;
-
-  for (i = 0; i < passes; i++)
-  {
-    const cl_memory_region_t *region = cl_find_memory_region(address);
-
-    if (!region)
-      return false;
-    else if (!cl_read_memory(&address, NULL, address, region->pointer_length))
-      return false;
-    else
-      address += result->offsets[i];
-  }
-  *final_address = address;
-
-  return true;
+  return cl_ptrcache_resolve(cache, final_address, result->address_initial,
+                             result->offsets, passes);
 }
 
 uint32_t cl_search_ascii(cl_search_t *search, const char *needle, uint8_t length)
 {
-  if (!search || search->searchbank_count == 0)
+  if (!search || search->searchbank_count == 0 || length == 0)
     return 0;
   else
   {
     cl_searchbank_t *sbank;
     const char *haystack;
-    char *position;
     uint32_t matches = 0;
     uint8_t  i;
-    uint32_t j;
+    cl_addr_t j;
 
     for (i = 0; i < search->searchbank_count; i++)
     {
       uint32_t matches_this_bank = 0;
 
       sbank = &search->searchbanks[i];
-      memset(sbank->valid, 0,   sbank->region->size);
+      if (!cl_searchbank_make_dense(sbank))
+        continue;
+      memset(sbank->valid.levels[0], 0,
+             sbank->valid.words[0] * sizeof(uint64_t));
       haystack = (const char*)  sbank->region->base_host;
 
-      for (j = 0; j <   sbank->region->size; j++)
+      for (j = 0; j + length <= sbank->region->size; j++)
       {
         if (!memcmp(&haystack[j], needle, length))
         {
-          sbank->valid[j] = true;
+          if (matches_this_bank == 0)
+            sbank->first_valid = j;
+          sbank->last_valid = j;
+          sbank->valid.levels[0][j / CL_SEARCH_WORD_BITS] |=
+            1ULL << (j % CL_SEARCH_WORD_BITS);
           matches_this_bank++;
         }
       }
 
+      cl_search_bitset_summarize(&sbank->valid);
+      sbank->matches = matches_this_bank;
       if (matches_this_bank == 0)
         sbank->any_valid = false;
       else
+      {
+        sbank->any_valid = true;
         matches += matches_this_bank;
-      memcpy(sbank->backup,   sbank->region->base_host,   sbank->region->size);
+      }
+      cl_searchbank_refresh(sbank, 0, sbank->valid.words[0]);
+      if (search->sparse_threshold &&
+          matches_this_bank <= search->sparse_threshold)
+        cl_searchbank_make_sparse(sbank);
     }
     search->matches = matches;
 
@@ -333,15 +668,12 @@ uint32_t cl_search_step(cl_search_t *search, void *value)
     return 0;
   else
   {
+    cl_search_kernel_args_t args;
     cl_searchbank_t *sbank;
-    bool compare_result;
-    uint32_t left, right;
     uint32_t matches  = 0;
-    uint8_t  cmp_type = search->params.compare_type;
-    uint8_t  size    = search->params.size;
+    uint8_t  size     = search->params.size;
     uint8_t  val_type = search->params.value_type;
     uint8_t  i;
-    cl_addr_t j;
 
     if (!value)
       cl_log("Comparing to nothing...");
@@ -352,73 +684,85 @@ uint32_t cl_search_step(cl_search_t *search, void *value)
 
 #if CL_EXTERNAL_MEMORY
     cl_fe_search_deep_copy(search);
+#elif CL_WRITEWATCH
+    if (!search->watching || !cl_writewatch_collect(search))
+      cl_search_forget_dirty(search);
 #endif
 
+    /* These arguments are the same for every bank */
+    memset(&args, 0, sizeof(args));
+    args.compare_type = search->params.compare_type;
+    args.size         = size;
+    args.value_type   = val_type;
+    args.has_value    = value != NULL;
+    if (value)
+    {
+      if (val_type == CL_MEMTYPE_FLOAT)
+        args.value_float = *((float*)value);
+      else
+      {
+        args.value = *((uint32_t*)value);
+        if (size == 1)
+          args.value &= 0xFF;
+        else if (size == 2)
+          args.value &= 0xFFFF;
+      }
+    }
+
     for (i = 0; i < search->searchbank_count; i++)
     {
-      cl_addr_t matches_this_bank = 0;
-      cl_addr_t last_valid = 0;
-      bool first_found = false;
+      cl_addr_t matches_this_bank;
 
       sbank = &search->searchbanks[i];
-      if (!sbank->any_valid)
+      if (!sbank->any_valid || sbank->region->size < size)
         continue;
 
-      for (j = sbank->first_valid; j <= sbank->last_valid; j += size)
-      {
-        /* This address has been weeded out already */
-        if (!sbank->valid[j])
-          continue;
+      /* Values of 4 bytes or less are swapped as cl_read swaps them */
+      args.byteswap =
+        sbank->region->endianness == CL_ENDIAN_SWAPPED ||
+        sbank->region->endianness == CL_ENDIAN_WORD_FLIP_SWAPPED;
+      args.current    = (const uint8_t*)sbank->region->base_host;
+      args.limit      = sbank->region->size;
 
-        cl_read_search(&left, search, sbank, j);
-        cl_read_memory_internal(&right, NULL, j + sbank->region->base_guest, size);
+      /* Pick the specialized kernel once, rather than for every address */
+      cl_search_kernel_prepare(&args);
 
-        if (!value)
-        {
-          if (val_type == CL_MEMTYPE_FLOAT)
-            compare_result = compare_to_nothing_float(left, right, cmp_type);
-          else
-            compare_result = compare_to_nothing(left, right, cmp_type);
-        }
-        else
-        {
-          if (val_type == CL_MEMTYPE_FLOAT)
-            compare_result = compare_to_value_float(left, right, cmp_type, *((float*)value));
-          else
-          {
-            uint32_t* intval = (uint32_t*)value;
-
-            if (size == 1)
-              *intval &= 0xFF;
-            else if (size == 2)
-              *intval &= 0xFFFF;
-
-            compare_result = compare_to_value(left, right, cmp_type, *intval);
-          }
-        }
+      if (sbank->sparse)
+        matches_this_bank = cl_search_kernel_run_sparse(&args, sbank->entries,
+                                                        sbank->matches);
+      else
+      {
+        args.previous   = sbank->backup;
+        args.valid      = &sbank->valid;
+        args.dirty      = sbank->dirty;
 
-        if (!compare_result)
-          sbank->valid[j] = 0;
-        else
-        {
-          /* Set our new first valid offset */
-          if (!first_found)
-          {
-            sbank->first_valid = j;
-            first_found = true;
-          }
-          last_valid = j;
-          sbank->valid[j] = 1;
-          matches_this_bank++;
-        }
+        /* Only visit the words between our first and last valid offsets */
+        args.word_begin = sbank->first_valid / CL_SEARCH_WORD_BITS;
+        args.word_end   = sbank->last_valid / CL_SEARCH_WORD_BITS + 1;
+        if (args.word_end > sbank->valid.words[0])
+          args.word_end = sbank->valid.words[0];
+
+        matches_this_bank = cl_searchbank_step_dense(search, sbank, &args);
       }
+      sbank->matches = matches_this_bank;
 
       if (matches_this_bank == 0)
+      {
         sbank->any_valid = false;
+        sbank->last_valid = 0;
+      }
       else
+      {
+        /* Set our new first and last valid offsets */
+        sbank->first_valid = args.first;
+        sbank->last_valid = args.last;
         matches += matches_this_bank;
-      memcpy(sbank->backup,   sbank->region->base_host,   sbank->region->size);
-      sbank->last_valid = last_valid;
+      }
+
+      /* Both kinds of bank have had their previous values refreshed */
+      if (!sbank->sparse && search->sparse_threshold &&
+          matches_this_bank <= search->sparse_threshold)
+        cl_searchbank_make_sparse(sbank);
     }
     search->matches = matches;
     cl_log(" %u matches.\n", matches);
@@ -434,83 +778,518 @@ bool cl_pointersearch_free(cl_pointersearch_t *search)
   else
   {
     free(search->results);
+    cl_pointermap_free(&search->map);
+    cl_ptrcache_free(&search->cache);
+    search->results = NULL;
+    search->result_count = 0;
+    search->result_capacity = 0;
+    search->streaming = false;
+
     return true;
   }
 }
 
-bool add_pass(cl_pointersearch_t* search, uint32_t range, uint32_t max_results)
+/**
+ * Whether a word holding this value could be a pointer to an address within
+ * "range" bytes after it, ie. whether the value is in or shortly before a
+ * memory region.
+ */
+static bool cl_pointermap_wanted(cl_addr_t value, cl_addr_t range)
+{
+  unsigned i;
+
+  for (i = 0; i < memory.region_count; i++)
+  {
+    const cl_memory_region_t *region = &memory.regions[i];
+
+    if (value < region->base_guest + region->size &&
+        value + range >= region->base_guest)
+      return true;
+  }
+
+  return false;
+}
+
+static int cl_pointermap_compare(const void *a, const void *b)
 {
-  cl_memory_region_t *region;
-  cl_pointerresult_t *result;
-  uint32_t matches, target, value;
-  uint32_t i, j, k, l;
+  const cl_pointermapentry_t *left = (const cl_pointermapentry_t*)a;
+  const cl_pointermapentry_t *right = (const cl_pointermapentry_t*)b;
+
+  if (left->value != right->value)
+    return left->value < right->value ? -1 : 1;
+  else if (left->address != right->address)
+    return left->address < right->address ? -1 : 1;
+  else
+    return 0;
+}
 
-  cl_pointerresult_t* new_results = (cl_pointerresult_t*)calloc(
-    max_results, sizeof(cl_pointerresult_t));
-  matches = 0;
-  search->passes += 1;
+/**
+ * Returns the index of the first entry in a pointer map with a value greater
+ * than or equal to the given one.
+ */
+static cl_addr_t cl_pointermap_lower_bound(const cl_pointermap_t *map,
+  cl_addr_t value)
+{
+  cl_addr_t low = 0;
+  cl_addr_t high = map->count;
 
-  for (i = 0; i < search->result_count; i++)
+  while (low < high)
   {
-    cl_pointerresult_t *next_result = &search->results[i];
+    cl_addr_t middle = low + (high - low) / 2;
 
-    for (j = 0; j < memory.region_count; j++)
-    {
-      region = &memory.regions[j];
-      target = next_result->address_initial;
+    if (map->entries[middle].value < value)
+      low = middle + 1;
+    else
+      high = middle;
+  }
 
-      if (region->size < region->pointer_length)
-        continue;
+  return low;
+}
 
-      for (k = 0; k < region->size; k += region->pointer_length)
-      {
-        cl_read_memory(&value, region, k, region->pointer_length);
+/**
+ * Progress shared by the threads working on one stage of a pointer search.
+ */
+typedef struct cl_pointerprogress_t
+{
+  const cl_pointersearch_t *search;
+  unsigned                  pass;
+  uint32_t                  total;
+  volatile uint32_t         done;
+  volatile uint32_t         cancelled;
+} cl_pointerprogress_t;
+
+static void cl_pointerprogress_init(cl_pointerprogress_t *progress,
+  const cl_pointersearch_t *search, unsigned pass, uint32_t total)
+{
+  progress->search = search;
+  progress->pass = pass;
+  progress->total = total;
+  progress->done = 0;
+  progress->cancelled = 0;
+}
 
-        if (value <= target && value >= target - range)
-        {
-          result = &new_results[matches];
+static bool cl_pointerprogress_cancelled(cl_pointerprogress_t *progress)
+{
+  return cl_atomic_load32(&progress->cancelled) != 0;
+}
+
+/**
+ * Marks one item of a stage as done and reports it, cancelling the stage if
+ * the progress callback asks to.
+ */
+static void cl_pointerprogress_advance(cl_pointerprogress_t *progress)
+{
+  const cl_pointersearch_t *search = progress->search;
+  uint32_t done = cl_atomic_add32(&progress->done, 1);
 
-          /* Shift all offsets over by one */
-          for (l = search->passes - 1; l > 0; l--)
-            result->offsets[l] = next_result->offsets[l - 1];
+  if (search && search->progress &&
+      !search->progress(search->progress_data, progress->pass, done,
+                        progress->total))
+    cl_atomic_add32(&progress->cancelled, 1);
+}
 
-          /* Make this the new initial offset */
-          result->offsets[0] = target - value;
-          result->address_initial = region->base_guest + k;
-          matches++;
-        }
+/**
+ * The number of bytes of a region scanned by one job of a pointer map build.
+ */
+#define CL_POINTERMAP_CHUNK_SIZE CL_SEARCH_CHUNK_SIZE
 
-        /* Back out if we have too many results */
-        if (matches == max_results)
-        {
-          cl_log("Search reached maximum count of %u.\n", max_results);
-          goto end;
-        }
+typedef struct cl_pointermap_chunk_t
+{
+  const cl_memory_region_t *region;
+  cl_addr_t begin;
+  cl_addr_t end;
+} cl_pointermap_chunk_t;
+
+typedef struct cl_pointermap_job_t
+{
+  const cl_pointermap_chunk_t *chunks;
+  cl_addr_t range;
+  cl_pointerprogress_t progress;
+
+  /* Each worker adds the pointers it finds to its own buffer */
+  cl_pointermap_t buffers[CL_THREADS_MAX];
+  cl_addr_t capacities[CL_THREADS_MAX];
+  volatile uint32_t failed;
+
+  /* The buffers copied end to end, and where each sorted run starts */
+  cl_pointermapentry_t *source;
+  cl_pointermapentry_t *dest;
+  cl_addr_t bounds[CL_THREADS_MAX + 1];
+  unsigned runs;
+} cl_pointermap_job_t;
+
+static void cl_pointermap_job_scan(void *context, unsigned index,
+  unsigned worker)
+{
+  cl_pointermap_job_t *job = (cl_pointermap_job_t*)context;
+  const cl_pointermap_chunk_t *chunk = &job->chunks[index];
+  const cl_memory_region_t *region = chunk->region;
+  cl_pointermap_t *buffer = &job->buffers[worker];
+  cl_pointermapentry_t *entries;
+  cl_addr_t value, k;
+
+  if (cl_atomic_load32(&job->failed) ||
+      cl_pointerprogress_cancelled(&job->progress))
+    return;
+
+  for (k = chunk->begin; k + region->pointer_length <= chunk->end;
+       k += region->pointer_length)
+  {
+    value = 0;
+    if (!cl_read_memory(&value, region, k, region->pointer_length) ||
+        !cl_pointermap_wanted(value, job->range))
+      continue;
+
+    if (buffer->count == job->capacities[worker])
+    {
+      cl_addr_t capacity = job->capacities[worker] ?
+                           job->capacities[worker] * 2 : 4096;
+
+      entries = (cl_pointermapentry_t*)realloc(buffer->entries,
+        capacity * sizeof(cl_pointermapentry_t));
+      if (!entries)
+      {
+        cl_atomic_add32(&job->failed, 1);
+        return;
       }
+      buffer->entries = entries;
+      job->capacities[worker] = capacity;
     }
+    buffer->entries[buffer->count].value = value;
+    buffer->entries[buffer->count].address = region->base_guest + k;
+    buffer->count++;
   }
+  cl_pointerprogress_advance(&job->progress);
+}
+
+static void cl_pointermap_job_sort(void *context, unsigned index,
+  unsigned worker)
+{
+  cl_pointermap_job_t *job = (cl_pointermap_job_t*)context;
+
+  CL_UNUSED(worker);
+  qsort(&job->source[job->bounds[index]],
+        job->bounds[index + 1] - job->bounds[index],
+        sizeof(cl_pointermapentry_t), cl_pointermap_compare);
+}
+
+/**
+ * Merges a pair of neighbouring sorted runs into the other buffer. The last
+ * run is copied over alone when there is an odd number of them.
+ */
+static void cl_pointermap_job_merge(void *context, unsigned index,
+  unsigned worker)
+{
+  cl_pointermap_job_t *job = (cl_pointermap_job_t*)context;
+  const cl_pointermapentry_t *source = job->source;
+  const unsigned left = index * 2;
+  const cl_addr_t middle = job->bounds[left + 1 < job->runs ?
+                                       left + 1 : job->runs];
+  const cl_addr_t end = job->bounds[left + 2 < job->runs ?
+                                    left + 2 : job->runs];
+  cl_addr_t i = job->bounds[left];
+  cl_addr_t j = middle;
+  cl_addr_t out = i;
+
+  CL_UNUSED(worker);
+  while (i < middle && j < end)
+    job->dest[out++] = cl_pointermap_compare(&source[j], &source[i]) < 0 ?
+                       source[j++] : source[i++];
+  while (i < middle)
+    job->dest[out++] = source[i++];
+  while (j < end)
+    job->dest[out++] = source[j++];
+}
+
+/**
+ * Builds a pointer map over the shared thread pool. Regions are scanned in
+ * chunks into per-worker buffers, which are then sorted on their own and
+ * merged pairwise. External memory is scanned on the calling thread, as
+ * cl_fe_memory_read is not required to be thread-safe.
+ * @param search The search to report progress to, or NULL.
+ * @return Whether the map was built, or FALSE if it failed or was cancelled.
+ */
+static bool cl_pointermap_build(cl_pointermap_t *map, cl_addr_t range,
+  const cl_pointersearch_t *search)
+{
+  cl_threadpool_t *pool = cl_threadpool_shared();
+#if CL_EXTERNAL_MEMORY
+  cl_threadpool_t *scan_pool = NULL;
+#else
+  cl_threadpool_t *scan_pool = pool;
+#endif
+  cl_pointermap_chunk_t *chunks;
+  cl_pointermap_job_t *job;
+  cl_addr_t chunk_count = 0;
+  cl_addr_t total = 0;
+  cl_addr_t chunk_size, k;
+  unsigned i, workers;
+  bool success = false;
+
+  memset(map, 0, sizeof(*map));
+
+  /* Split every region into chunks, each a whole number of pointers */
+  for (i = 0; i < memory.region_count; i++)
+  {
+    const cl_memory_region_t *region = &memory.regions[i];
+
+    if (region->pointer_length == 0 ||
+        region->pointer_length > sizeof(cl_addr_t))
+      continue;
+    chunk_size = CL_POINTERMAP_CHUNK_SIZE -
+                 CL_POINTERMAP_CHUNK_SIZE % region->pointer_length;
+    chunk_count += (region->size + chunk_size - 1) / chunk_size;
+  }
+  chunks = (cl_pointermap_chunk_t*)calloc(chunk_count ? chunk_count : 1,
+    sizeof(cl_pointermap_chunk_t));
+  job = (cl_pointermap_job_t*)calloc(1, sizeof(cl_pointermap_job_t));
+  if (!chunks || !job)
+    goto end;
+  chunk_count = 0;
+  for (i = 0; i < memory.region_count; i++)
+  {
+    const cl_memory_region_t *region = &memory.regions[i];
+
+    if (region->pointer_length == 0 ||
+        region->pointer_length > sizeof(cl_addr_t))
+      continue;
+    chunk_size = CL_POINTERMAP_CHUNK_SIZE -
+                 CL_POINTERMAP_CHUNK_SIZE % region->pointer_length;
+    for (k = 0; k < region->size; k += chunk_size)
+    {
+      chunks[chunk_count].region = region;
+      chunks[chunk_count].begin = k;
+      chunks[chunk_count].end = k + chunk_size < region->size ?
+                                k + chunk_size : region->size;
+      chunk_count++;
+    }
+  }
+
+  /* Scan memory once, each worker keeping what it finds to itself */
+  workers = cl_threadpool_size(pool);
+  job->chunks = chunks;
+  job->range = range;
+  cl_pointerprogress_init(&job->progress, search, 0, (uint32_t)chunk_count);
+  cl_threadpool_run(scan_pool, cl_pointermap_job_scan, job,
+                    (unsigned)chunk_count);
+  if (job->failed || cl_pointerprogress_cancelled(&job->progress))
+    goto end;
+
+  /* Copy the buffers end to end, then sort each one in place */
+  for (i = 0; i < workers; i++)
+    total += job->buffers[i].count;
+  if (!total)
+  {
+    success = true;
+    goto end;
+  }
+  job->source = (cl_pointermapentry_t*)malloc(
+    total * sizeof(cl_pointermapentry_t));
+  if (!job->source)
+    goto end;
+  job->runs = workers;
+  for (i = 0, total = 0; i < workers; i++)
+  {
+    job->bounds[i] = total;
+    if (job->buffers[i].count)
+      memcpy(&job->source[total], job->buffers[i].entries,
+             job->buffers[i].count * sizeof(cl_pointermapentry_t));
+    total += job->buffers[i].count;
+    cl_pointermap_free(&job->buffers[i]);
+  }
+  job->bounds[workers] = total;
+  cl_threadpool_run(pool, cl_pointermap_job_sort, job, job->runs);
+
+  /* Merge the sorted runs pairwise until only one is left */
+  if (job->runs > 1)
+  {
+    job->dest = (cl_pointermapentry_t*)malloc(
+      total * sizeof(cl_pointermapentry_t));
+    if (!job->dest)
+      goto end;
+  }
+  while (job->runs > 1)
+  {
+    cl_pointermapentry_t *swap;
+    const unsigned pairs = (job->runs + 1) / 2;
+
+    cl_threadpool_run(pool, cl_pointermap_job_merge, job, pairs);
+    for (i = 0; i < pairs; i++)
+      job->bounds[i] = job->bounds[i * 2];
+    job->bounds[pairs] = total;
+    job->runs = pairs;
+    swap = job->source;
+    job->source = job->dest;
+    job->dest = swap;
+  }
+  map->entries = job->source;
+  map->count = total;
+  job->source = NULL;
+  success = true;
+  cl_log("Pointer map holds %u possible pointers.\n", (unsigned)total);
+
   end:
-  free(search->results);
-  search->results = new_results;
-  search->result_count = matches;
+  if (job)
+  {
+    for (i = 0; i < CL_THREADS_MAX; i++)
+      cl_pointermap_free(&job->buffers[i]);
+    free(job->source);
+    free(job->dest);
+  }
+  free(job);
+  free(chunks);
+
+  return success;
+}
+
+bool cl_pointermap_init(cl_pointermap_t *map, cl_addr_t range)
+{
+  if (!map)
+    return false;
+  else
+    return cl_pointermap_build(map, range, NULL);
+}
+
+void cl_pointermap_free(cl_pointermap_t *map)
+{
+  if (map)
+  {
+    free(map->entries);
+    map->entries = NULL;
+    map->count = 0;
+  }
+}
+
+cl_addr_t cl_pointermap_find(const cl_pointermap_t *map, cl_addr_t target,
+  cl_addr_t range, cl_addr_t *first)
+{
+  cl_addr_t begin, end;
+
+  if (!map || !map->count)
+    return 0;
+  begin = cl_pointermap_lower_bound(map, target > range ? target - range : 0);
+
+  /* Entries equal to the target are included, unless the bound overflows */
+  end = target + 1 ? cl_pointermap_lower_bound(map, target + 1) : map->count;
+  *first = begin;
+
+  return end > begin ? end - begin : 0;
+}
+
+/**
+ * Adds a result to the end of a pointer search, growing its array as needed.
+ */
+static bool cl_pointersearch_push(cl_pointersearch_t *search,
+  const cl_pointerresult_t *result)
+{
+  if (search->result_count == search->result_capacity)
+  {
+    uint32_t capacity = search->result_capacity ?
+                        search->result_capacity * 2 : 256;
+    cl_pointerresult_t *results = (cl_pointerresult_t*)realloc(
+      search->results, capacity * sizeof(cl_pointerresult_t));
+
+    if (!results)
+      return false;
+    search->results = results;
+    search->result_capacity = capacity;
+  }
+  search->results[search->result_count++] = *result;
 
   return true;
 }
 
+/**
+ * Moves a cursor back to the first chain of a pointer search.
+ */
+static void cl_pointercursor_reset(cl_pointersearch_t *search)
+{
+  cl_pointercursor_t *cursor = &search->cursor;
+  cl_addr_t first = 0;
+  cl_addr_t found;
+
+  memset(cursor, 0, sizeof(*cursor));
+  found = cl_pointermap_find(&search->map, search->address, search->range,
+                             &first);
+  cursor->next[0] = first;
+  cursor->end[0] = first + found;
+}
+
+/**
+ * Walks a pointer map depth-first to the next chain that reaches the full
+ * depth of a search. Chains that run out of pointers before then are skipped,
+ * as each level replaces the one before it.
+ * @param result Set to the chain found, leading to the searched address.
+ * @return Whether a chain was found, or FALSE once all have been walked.
+ */
+static bool cl_pointercursor_next(cl_pointersearch_t *search,
+  cl_pointerresult_t *result)
+{
+  cl_pointercursor_t *cursor = &search->cursor;
+  const cl_pointermap_t *map = &search->map;
+  const unsigned last = search->passes - 1;
+  cl_addr_t first = 0;
+  cl_addr_t found;
+  unsigned depth;
+
+  while (!cursor->done)
+  {
+    const cl_pointermapentry_t *entry;
+
+    depth = cursor->depth;
+    if (cursor->next[depth] == cursor->end[depth])
+    {
+      /* This level is used up, go back to the one above it */
+      if (depth == 0)
+        cursor->done = true;
+      else
+        cursor->depth--;
+      continue;
+    }
+    entry = &map->entries[cursor->next[depth]++];
+
+    if (depth == last)
+    {
+      cl_addr_t target = search->address;
+      unsigned i;
+
+      /* The chosen entry of each level points into the one below it */
+      memset(result, 0, sizeof(*result));
+      for (i = 0; i <= last; i++)
+      {
+        const cl_pointermapentry_t *step = i == last ? entry :
+          &map->entries[cursor->next[i] - 1];
+
+        result->offsets[last - i] = (uint32_t)(target - step->value);
+        target = step->address;
+      }
+      result->address_initial = entry->address;
+      result->address_final   = search->address;
+      result->value_current   = search->value_initial;
+      result->value_previous  = search->value_initial;
+
+      return true;
+    }
+
+    /* Descend to the pointers leading to this one */
+    found = cl_pointermap_find(map, entry->address, search->range, &first);
+    cursor->depth++;
+    cursor->next[cursor->depth] = first;
+    cursor->end[cursor->depth] = first + found;
+  }
+
+  return false;
+}
+
 bool cl_pointersearch_init(cl_pointersearch_t *search, 
   cl_addr_t address, uint8_t val_type, uint8_t passes, uint32_t range,
-  uint32_t max_results)
+  uint32_t page_size)
 {
   if (!search || address == 0 || passes == 0)
     return false;
   else
   {
-    cl_memory_region_t *region;
-    cl_pointerresult_t *result;
-    cl_addr_t target;
-    uint32_t current_match, matches, prev_value, value;
-    bool exact_only;
-    uint32_t i, j;
+    uint32_t prev_value = 0;
 
     /* Is the address we're looking for valid? */
     if (!cl_read_memory(&prev_value, NULL, address, cl_sizeof_memtype(val_type)))
@@ -518,73 +1297,89 @@ bool cl_pointersearch_init(cl_pointersearch_t *search,
       cl_log("Address %08X is invalid for a pointer search.\n", address);
       return false;
     }
+    if (passes > CL_POINTER_MAX_PASSES)
+      passes = CL_POINTER_MAX_PASSES;
 
     /* Initialize search parameters */
-    search->passes          = 1;
+    search->passes          = passes;
     search->range          = range;
     search->params.compare_type = CLE_CMPTYPE_EQUAL;
     search->params.size      = cl_sizeof_memtype(val_type);
     search->params.value_type  = val_type;
-
-    /* Only one memory bank; all pointed addresses are probably relative */
-    if (memory.region_count == 1)
-      exact_only = false;
-
-    /* We create a temporary array of max size and trim it down after */
-    search->results = (cl_pointerresult_t*)calloc(
-      max_results, sizeof(cl_pointerresult_t));
-    matches = 0;
-
-    /* Do a quick scan to see how many results we start with */
-    for (i = 0; i < memory.region_count; i++)
+    search->results = NULL;
+    search->result_count = 0;
+    search->result_capacity = 0;
+    search->address = address;
+    search->value_initial = prev_value;
+    memset(&search->cache, 0, sizeof(search->cache));
+
+    /* Find every possible pointer in memory once, for all chains to share */
+    if (!cl_pointermap_build(&search->map, range, search))
     {
-      region = &memory.regions[i];
+      cl_log("Pointer search for %08X was cancelled.\n", address);
+      return false;
+    }
+    search->streaming = true;
+    cl_pointercursor_reset(search);
 
-      /* This is where per-console hacks were being inserted */
-      target = exact_only ? region->base_guest + address : address;
+    /* Only produce the chains that will be shown for now */
+    cl_pointersearch_more(search, page_size);
+    cl_log("Pointer search for %08X found %u results%s.\n", address,
+           search->result_count,
+           cl_pointersearch_has_more(search) ? " so far" : "");
 
-      if (region->size < region->pointer_length)
-        continue;
+    return true;
+  }
+}
 
-      for (j = 0; j < region->size; j += region->pointer_length)
-      {
-        cl_read_memory(&value, region, j, region->pointer_length);
+uint32_t cl_pointersearch_more(cl_pointersearch_t *search, uint32_t count)
+{
+  cl_pointerresult_t result;
+  uint32_t added = 0;
 
-        if (value <= target && value >= target - range)
-        {
-          result = &search->results[matches];
-
-          result->offsets[0]    = address - value;
-          result->address_initial = region->base_guest + j;
-          result->address_final  = address;
-          result->value_current  = prev_value;
-          result->value_previous  = prev_value;
-          matches++;
-        }
+  if (!search || !search->streaming)
+    return 0;
+  while (added < count && cl_pointercursor_next(search, &result))
+  {
+    if (!cl_pointersearch_push(search, &result))
+      break;
+    added++;
+  }
 
-        if (matches == max_results)
-        {
-          search->result_count = max_results;
-          cl_log("Pointer search for %08X reached maximum result count of %u.\n", address, max_results);
+  return added;
+}
 
-          return true;
-        }
-      }
-    }
-    search->result_count = matches;
+bool cl_pointersearch_has_more(const cl_pointersearch_t *search)
+{
+  return search && search->streaming && !search->cursor.done;
+}
 
-    /* We've only done one pass so far. Run any extra passes */
-    for (i = passes; i > 1; i--)
-      add_pass(search, range, max_results);
+/**
+ * Resolves a pointer search result and compares the value it leads to.
+ * @return Whether the result still meets the search conditions.
+ */
+static bool cl_pointersearch_compare(cl_pointersearch_t *search,
+  cl_pointerresult_t *result, cl_search_kernel_args_t *args,
+  cl_search_compare_t compare)
+{
+  cl_addr_t address;
+  uint32_t final_value = 0;
 
-    /* Clear the unneeded memory */
-    search->result_count = matches;
-    search->results = (cl_pointerresult_t*)realloc(
-      search->results, matches * sizeof(cl_pointerresult_t));
+  if (!resolve_pointerresult(&search->cache, &address, result,
+                             search->passes))
+    return false;
+  else if (!cl_read_memory(&final_value, NULL, address, search->params.size))
+    return false;
+  else
+  {
+    bool matched;
 
-    cl_log("Pointer search for %08X found %u results.\n", address, matches);
+    result->address_final = address;
+    result->value_current = final_value;
+    matched = compare(args, result->value_previous, result->value_current);
+    result->value_previous = result->value_current;
 
-    return true;
+    return matched;
   }
 }
 
@@ -594,54 +1389,108 @@ uint32_t cl_pointersearch_step(cl_pointersearch_t *search, void *value)
     return false;
   else
   {
-    cl_pointerresult_t *result;
-    cl_addr_t address;
-    uint32_t matches, final_value, valid_pointers;
-    bool compare_result;
-    uint8_t cmp_type = search->params.compare_type;
+    cl_search_kernel_args_t args;
+    cl_search_compare_t compare;
+    cl_pointerresult_t result;
+    uint32_t matches;
     uint32_t i;
 
     matches = 0;
-    valid_pointers = 0;
-    cl_log("Result count at start: %u\n", search->result_count);
-    for (i = 0; i < search->result_count; i++)
-    {
-      result  = &search->results[i];
 
-      if (!resolve_pointerresult(&address, result, search->passes))
-        continue;
-      else if (!cl_read_memory(&final_value, NULL, address, search->params.size))
-        continue;
+    /* Values are read in host byte order, so only the compare is needed */
+    memset(&args, 0, sizeof(args));
+    args.compare_type = search->params.compare_type;
+    args.size         = search->params.size;
+    args.value_type   = search->params.value_type;
+    args.has_value    = value != NULL;
+    if (value)
+    {
+      if (args.value_type == CL_MEMTYPE_FLOAT)
+        args.value_float = *((float*)value);
       else
-      {
-        result->value_current = final_value;
+        args.value = *((uint32_t*)value);
+    }
+    cl_search_kernel_prepare(&args);
+    compare = cl_search_kernel_compare(&args);
+
+    /* Memory has changed since any pointers were last read */
+    cl_ptrcache_invalidate(&search->cache);
 
-        if (!value)
+    if (search->streaming)
+    {
+      cl_pointerresult_t *produced = search->results;
+      const uint32_t produced_count = search->result_count;
+      const uint32_t produced_capacity = search->result_capacity;
+      const cl_pointercursor_t cursor = search->cursor;
+      cl_pointerprogress_t progress;
+      cl_addr_t top;
+      bool failed = false;
+
+      /* Walk every chain from the start, keeping only those that match.
+         Each chain has to be read now, while memory holds the values being
+         compared, so this cannot wait for the chains to be shown. */
+      cl_log("Comparing every chain in the pointer map...\n");
+      search->results = NULL;
+      search->result_count = 0;
+      search->result_capacity = 0;
+      cl_pointercursor_reset(search);
+      top = search->cursor.next[0];
+      cl_pointerprogress_init(&progress, search, 1,
+        (uint32_t)(search->cursor.end[0] - top));
+      while (!cl_pointerprogress_cancelled(&progress) &&
+             cl_pointercursor_next(search, &result))
+      {
+        /* Report each pointer to the searched address once it is left */
+        for (; top + 1 < search->cursor.next[0]; top++)
+          cl_pointerprogress_advance(&progress);
+        if (cl_pointersearch_compare(search, &result, &args, compare) &&
+            !cl_pointersearch_push(search, &result))
         {
-          compare_result = search->params.value_type == CL_MEMTYPE_FLOAT ?
-            compare_to_nothing_float(result->value_previous, result->value_current, cmp_type) :
-            compare_to_nothing(result->value_previous, result->value_current, cmp_type);
+          failed = true;
+          break;
         }
+      }
+
+      if (failed || cl_pointerprogress_cancelled(&progress))
+      {
+        /* Leave the search as it was before the step */
+        free(search->results);
+        search->results = produced;
+        search->result_count = produced_count;
+        search->result_capacity = produced_capacity;
+        search->cursor = cursor;
+        if (failed)
+          cl_log("Pointer search step ran out of memory.\n");
         else
-        {
-          compare_result = search->params.value_type == CL_MEMTYPE_FLOAT ?
-            compare_to_value_float(result->value_previous, result->value_current, cmp_type, *((float*)value)) :
-            compare_to_value(result->value_previous, result->value_current, cmp_type, *((uint32_t*)value));
-        }
+          cl_log("Pointer search step was cancelled.\n");
 
-        if (compare_result)
-        {
-          memcpy(&search->results[matches], result, sizeof(cl_pointerresult_t));
-          matches++;
-        }
-        result->value_previous = result->value_current;
-        valid_pointers++;
+        return produced_count;
+      }
+      free(produced);
+      search->streaming = false;
+      cl_pointermap_free(&search->map);
+      matches = search->result_count;
+    }
+    else
+    {
+      cl_log("Result count at start: %u\n", search->result_count);
+      for (i = 0; i < search->result_count; i++)
+      {
+        if (cl_pointersearch_compare(search, &search->results[i], &args,
+                                     compare))
+          search->results[matches++] = search->results[i];
       }
+      search->result_count = matches;
     }
+
     /* All of the still valid results are grouped together, the rest of memory can be cleared */
-    search->result_count = matches;
-    search->results = (cl_pointerresult_t*)realloc(search->results, matches * sizeof(cl_pointerresult_t));
-    cl_log("Pointer search now has %u matches across %u valid pointers.\n", matches, valid_pointers);
+    if (matches)
+    {
+      search->results = (cl_pointerresult_t*)realloc(search->results,
+        matches * sizeof(cl_pointerresult_t));
+      search->result_capacity = matches;
+    }
+    cl_log("Pointer search now has %u matches.\n", matches);
 
     return matches;
   }
@@ -656,14 +1505,200 @@ void cl_pointersearch_update(cl_pointersearch_t *search)
     cl_pointerresult_t *result;
     uint32_t i;
 
+    cl_ptrcache_invalidate(&search->cache);
     for (i = 0; i < search->result_count; i++)
     {
       result = &search->results[i];
 
-      if (!resolve_pointerresult(&result->address_final, result, search->passes))
+      if (!resolve_pointerresult(&search->cache, &result->address_final,
+                                 result, search->passes))
         continue;
       else
         cl_read_memory(&result->value_current, NULL, result->address_final, search->params.size);
     }
   }
 }
+
+#if CL_TESTS
+
+/**
+ * The size of the memory region used by the search tests. Spans several
+ * chunks of a parallel step, and ends partway through one.
+ */
+#define CL_SEARCH_TEST_SIZE (2 * CL_SEARCH_CHUNK_SIZE + 12345)
+
+/**
+ * Steps a serial and a threaded search together with a naive reference that
+ * compares every address on its own, as searches did before compare kernels.
+ * The reference reads values with cl_read, in the byte order of the region.
+ */
+static void cl_search_test_steps(unsigned *seed, uint8_t size,
+  unsigned endianness)
+{
+  const cl_addr_t length = CL_SEARCH_TEST_SIZE;
+  cl_memory_region_t region;
+  cl_search_t searches[2];
+  uint8_t *data = (uint8_t*)malloc(length);
+  uint8_t *previous = (uint8_t*)malloc(length);
+  bool *valid = (bool*)malloc(length * sizeof(bool));
+  unsigned step, i;
+  cl_addr_t j;
+
+  if (!data || !previous || !valid)
+    CL_TEST_FAIL(1);
+  memset(&region, 0, sizeof(region));
+  region.base_host = data;
+  region.size = length;
+  region.endianness = endianness;
+  memory.regions = &region;
+  memory.region_count = 1;
+
+  for (i = 0; i < 2; i++)
+  {
+    if (!cl_search_init(&searches[i]))
+      CL_TEST_FAIL(2);
+    searches[i].threaded = i == 1;
+    searches[i].sparse_threshold = 4096;
+    searches[i].params.size = size;
+    searches[i].params.value_type = size == 1 ? CL_MEMTYPE_UINT8 :
+                                    size == 2 ? CL_MEMTYPE_UINT16 :
+                                                CL_MEMTYPE_UINT32;
+  }
+  for (j = 0; j < length; j++)
+  {
+    data[j] = (uint8_t)cl_test_rand(seed);
+    valid[j] = true;
+  }
+  memcpy(previous, data, length);
+  cl_search_reset(&searches[0]);
+  cl_search_reset(&searches[1]);
+
+  for (step = 0; step < 32; step++)
+  {
+    const uint32_t mask = size == 4 ? 0xFFFFFFFF : (1u << (size * 8)) - 1;
+    const bool has_value = step % 4 == 1 || step % 4 == 2;
+    uint8_t compare_type;
+    uint32_t value = 0, left, right, expected = 0;
+
+    /* Halve the candidates on every fourth step, then keep the ones that
+       change, moving the banks from bitsets into lists */
+    for (i = 0; i < length / 64; i++)
+    {
+      j = (cl_addr_t)cl_test_rand(seed) * 64;
+      data[(j + cl_test_rand(seed) % 64) % length]++;
+    }
+    if (step % 4 == 1)
+    {
+      compare_type = CLE_CMPTYPE_LESS;
+      value = mask >> (step / 4 + 1);
+    }
+    else if (step % 4 == 2)
+      compare_type = CLE_CMPTYPE_GREATER;
+    else
+      compare_type = step >= 24 ? CLE_CMPTYPE_INCREASED : CLE_CMPTYPE_EQUAL;
+
+    for (j = 0; j < length; j++)
+    {
+      if (!valid[j])
+        continue;
+      else if (j % size || j + size > length)
+        valid[j] = false;
+      else
+      {
+        left = right = 0;
+        cl_read(&left, previous, j, size, endianness);
+        cl_read(&right, data, j, size, endianness);
+        valid[j] = has_value ?
+          compare_to_value(left, right, compare_type, value) :
+          compare_to_nothing(left, right, compare_type);
+        expected += valid[j];
+      }
+    }
+    memcpy(previous, data, length);
+
+    for (i = 0; i < 2; i++)
+    {
+      uint32_t step_value = value;
+
+      searches[i].params.compare_type = compare_type;
+      if (cl_search_step(&searches[i], has_value ? &step_value : NULL) !=
+          expected)
+        CL_TEST_FAIL(3);
+      for (j = 0; j < length; j++)
+        if (cl_searchbank_is_valid(&searches[i].searchbanks[0], j) != valid[j])
+          CL_TEST_FAIL(4);
+    }
+  }
+
+  cl_search_free(&searches[0]);
+  cl_search_free(&searches[1]);
+  memory.regions = NULL;
+  memory.region_count = 0;
+  free(data);
+  free(previous);
+  free(valid);
+}
+
+/**
+ * Removes one address right after a reset, which must leave every other
+ * address of the bank a candidate.
+ */
+static void cl_search_test_remove(void)
+{
+  const cl_addr_t length = 0x10000;
+  cl_memory_region_t region;
+  cl_search_t search;
+  uint8_t *data = (uint8_t*)calloc(length, 1);
+
+  if (!data)
+    CL_TEST_FAIL(5);
+  memset(&region, 0, sizeof(region));
+  region.base_host = data;
+  region.base_guest = 0x80000;
+  region.size = length;
+  memory.regions = &region;
+  memory.region_count = 1;
+
+  if (!cl_search_init(&search))
+    CL_TEST_FAIL(6);
+  if (search.matches != length)
+    CL_TEST_FAIL(7);
+  if (!cl_search_remove(&search, 0x80010) ||
+      cl_search_remove(&search, 0x80010))
+    CL_TEST_FAIL(8);
+  if (search.matches != length - 1 || !search.searchbanks[0].any_valid)
+    CL_TEST_FAIL(9);
+  search.params.compare_type = CLE_CMPTYPE_EQUAL;
+  if (cl_search_step(&search, NULL) != length - 1)
+    CL_TEST_FAIL(10);
+
+  cl_search_free(&search);
+  memory.regions = NULL;
+  memory.region_count = 0;
+  free(data);
+}
+
+int cl_search_tests(void)
+{
+  cl_memory_region_t *regions = memory.regions;
+  unsigned region_count = memory.region_count;
+  unsigned seed = 1;
+
+  cl_search_test_pool = cl_threadpool_init(4);
+  cl_search_test_steps(&seed, 1, CL_ENDIAN_NATIVE);
+  cl_search_test_steps(&seed, 2, CL_ENDIAN_NATIVE);
+  cl_search_test_steps(&seed, 4, CL_ENDIAN_NATIVE);
+  cl_search_test_steps(&seed, 2, CL_ENDIAN_SWAPPED);
+  cl_search_test_steps(&seed, 4, CL_ENDIAN_SWAPPED);
+  cl_search_test_steps(&seed, 2, CL_ENDIAN_WORD_FLIP_NATIVE);
+  cl_search_test_steps(&seed, 4, CL_ENDIAN_WORD_FLIP_SWAPPED);
+  cl_search_test_remove();
+  cl_threadpool_free(cl_search_test_pool);
+  cl_search_test_pool = NULL;
+  memory.regions = regions;
+  memory.region_count = region_count;
+
+  return 1;
+}
+
+#endif
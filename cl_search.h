@@ -2,6 +2,7 @@
 #define CL_SEARCH_H
 
 #include "cl_memory.h"
+#include "cl_search_kernel.h"
 #include "cl_types.h"
 
 #define CL_POINTER_MAX_PASSES 4
@@ -17,10 +18,27 @@ typedef struct cl_searchbank_t
 {
    cl_memory_region_t *region;
    uint8_t *backup;
-   uint8_t *valid;
+
+   /* One bit per byte address in the region, with block and page summaries */
+   cl_search_bitset_t valid;
+   cl_addr_t matches;
+
+   /* Once narrowed down, a sorted list replaces "backup" and "valid" */
+   bool sparse;
+   cl_searchentry_t *entries;
+
    bool any_valid;
    cl_addr_t first_valid;
    cl_addr_t last_valid;
+
+   /* For external memory: one bit per CL_SEARCH_PAGE_SIZE page of the region,
+      set by cl_fe_search_deep_copy for pages that may have changed since the
+      bank's last copy. NULL if unknown. Allocated with malloc, and freed with
+      the search. */
+   uint64_t *dirty;
+
+   /* For cl_fe_search_deep_copy to tell which copy the bank last saw */
+   unsigned copy_generation;
 } cl_searchbank_t;
 
 typedef struct cl_search_t
@@ -29,6 +47,16 @@ typedef struct cl_search_t
    cl_search_params_t  params;
    unsigned            searchbank_count;
    cl_addr_t           matches;
+
+   /* Banks with this many matches or fewer switch to a sorted list */
+   cl_addr_t           sparse_threshold;
+
+   /* Whether large banks are stepped over the shared thread pool */
+   bool                threaded;
+
+   /* Whether cl_writewatch_start succeeded for this search, so it is one of
+      the watch's users until freed */
+   bool                watching;
 } cl_search_t;
 
 typedef struct cl_pointerresult_t
@@ -40,6 +68,49 @@ typedef struct cl_pointerresult_t
    uint32_t  offsets[CL_POINTER_MAX_PASSES];
 } cl_pointerresult_t;
 
+/*
+   A word in memory that may be a pointer, keyed by the address it points to.
+*/
+typedef struct cl_pointermapentry_t
+{
+   cl_addr_t value;
+   cl_addr_t address;
+} cl_pointermapentry_t;
+
+/*
+   Every pointer-sized word in memory that points at or shortly before a
+   memory region, sorted by value and then address. Finding every pointer to
+   a range of addresses is then a binary search instead of a memory scan.
+*/
+typedef struct cl_pointermap_t
+{
+   cl_pointermapentry_t *entries;
+   cl_addr_t             count;
+} cl_pointermap_t;
+
+/*
+   Called as a pointer search is built, with the stage being run (0 while
+   pointers are mapped, 1 while the first step compares every chain) and how
+   many of its items are done out of a total.
+   May be called from any thread running the search. Returning FALSE cancels
+   the search, or the step.
+*/
+typedef bool (*cl_pointersearch_progress_t)(void *data, unsigned pass,
+   uint32_t done, uint32_t total);
+
+/*
+   A position in the depth-first walk over a pointer map that produces the
+   chains of a pointer search. Each level holds the range of map entries
+   pointing into the entry chosen on the level above it.
+*/
+typedef struct cl_pointercursor_t
+{
+   cl_addr_t next[CL_POINTER_MAX_PASSES];
+   cl_addr_t end[CL_POINTER_MAX_PASSES];
+   unsigned  depth;
+   bool      done;
+} cl_pointercursor_t;
+
 typedef struct cl_pointersearch_t
 {
    cl_search_params_t  params;
@@ -47,8 +118,40 @@ typedef struct cl_pointersearch_t
    uint32_t            range; 
    cl_pointerresult_t *results;
    uint32_t            result_count;
+   uint32_t            result_capacity;
+
+   /* The address searched for, and the value it held when the search began */
+   cl_addr_t           address;
+   uint32_t            value_initial;
+
+   /*
+      Until the first step, results are only the chains produced so far from
+      the pointer map. The step then walks every chain and keeps the matches.
+   */
+   bool                streaming;
+   cl_pointermap_t     map;
+   cl_pointercursor_t  cursor;
+
+   /* The pointers read while resolving chains, shared by every result */
+   cl_ptrcache_t       cache;
+
+   /* Optional, set before cl_pointersearch_init */
+   cl_pointersearch_progress_t progress;
+   void                       *progress_data;
 } cl_pointersearch_t;
 
+/*
+   Returns TRUE if the given offset into a searchbank is still a candidate.
+*/
+bool cl_searchbank_is_valid(const cl_searchbank_t *sbank, cl_addr_t offset);
+
+/*
+   Moves "offset" forward to the next candidate in a searchbank, starting with
+   the given offset itself.
+   Returns FALSE if there are no more candidates.
+*/
+bool cl_searchbank_next_valid(const cl_searchbank_t *sbank, cl_addr_t *offset);
+
 bool cl_read_search (uint32_t *value, cl_search_t *search, 
    cl_searchbank_t *bank, cl_addr_t address);
 
@@ -63,8 +166,9 @@ bool     cl_search_init  (cl_search_t *search);
 bool cl_search_remove(cl_search_t *search, cl_addr_t address);
 
 /*
-   Sets the validity of all addresses to true.
-   Returns TRUE if it succeeds.
+   Sets the validity of all addresses to true. A bank that cannot allocate
+   its snapshot keeps the candidates it had.
+   Returns TRUE if every bank was reset.
 */
 bool cl_search_reset(cl_search_t *search);
 
@@ -74,11 +178,54 @@ bool cl_search_reset(cl_search_t *search);
 */
 uint32_t cl_search_step(cl_search_t *search, void *value);
 
+/*
+   Builds a pointer map over all memory regions in one pass. Words pointing
+   more than "range" bytes before a region are left out.
+   Returns TRUE if it succeeds.
+*/
+bool cl_pointermap_init(cl_pointermap_t *map, cl_addr_t range);
+
+void cl_pointermap_free(cl_pointermap_t *map);
+
+/*
+   Finds the pointers in a map holding an address from "target - range" to
+   "target", inclusive. Sets "first" to the index of the first one.
+   Returns the number of pointers found, which follow one another in the map.
+*/
+cl_addr_t cl_pointermap_find(const cl_pointermap_t *map, cl_addr_t target,
+   cl_addr_t range, cl_addr_t *first);
+
 bool cl_pointersearch_free(cl_pointersearch_t *search);
 
+/*
+   Starts a search for the pointer chains of "passes" levels that lead to an
+   address. Memory is mapped over the shared thread pool, then the first
+   "page_size" chains are produced as results.
+   Returns FALSE if the address is invalid or the search was cancelled.
+*/
 bool cl_pointersearch_init(cl_pointersearch_t *search, cl_addr_t address, 
-   uint8_t size, uint8_t passes, uint32_t range, uint32_t max_results);
+   uint8_t size, uint8_t passes, uint32_t range, uint32_t page_size);
+
+/*
+   Produces up to "count" more chains as results, if the search has not been
+   stepped yet.
+   Returns the number of results added.
+*/
+uint32_t cl_pointersearch_more(cl_pointersearch_t *search, uint32_t count);
+
+/*
+   Returns TRUE if there are chains left that have not been produced yet.
+*/
+bool cl_pointersearch_has_more(const cl_pointersearch_t *search);
 
+/*
+   Removes the results that no longer meet the search conditions. The first
+   step compares every chain in the pointer map, not only those produced so
+   far, reporting its progress, and frees the map afterwards. If that is
+   cancelled or runs out of memory, the search is left as it was, with
+   "streaming" still set.
+   Returns the number of results left.
+*/
 uint32_t cl_pointersearch_step(cl_pointersearch_t *search, void *value);
 
 /*
@@ -86,4 +233,12 @@ uint32_t cl_pointersearch_step(cl_pointersearch_t *search, void *value);
 */
 void cl_pointersearch_update(cl_pointersearch_t *search);
 
+#if CL_TESTS
+/*
+   Checks serial, threaded and narrowed-down searches in each byte order
+   against a naive reference that compares every address on its own.
+*/
+int cl_search_tests(void);
+#endif
+
 #endif
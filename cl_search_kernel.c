@@ -0,0 +1,1616 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cl_common.h"
+#include "cl_config.h"
+#include "cl_memory.h"
+#include "cl_search_kernel.h"
+
+#if CL_SEARCH_SIMD && (defined(__x86_64__) || defined(__i386__) || \
+    defined(_M_X64) || defined(_M_IX86))
+#define CL_SEARCH_X86 true
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define CL_TARGET_SSE2
+#define CL_TARGET_AVX2
+#else
+#define CL_TARGET_SSE2 __attribute__((target("sse2")))
+#define CL_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#else
+#define CL_SEARCH_X86 false
+#endif
+
+#ifdef _MSC_VER
+#define CL_INLINE static __forceinline
+#else
+#define CL_INLINE static inline __attribute__((always_inline))
+#endif
+
+/**
+ * The comparison a kernel performs, resolved once from the compare type and
+ * whether or not a value was given.
+ */
+typedef enum
+{
+  CL_KOP_NONE = 0,
+
+  /* Compare the current value to a given value */
+  CL_KOP_VALUE_EQUAL,
+  CL_KOP_VALUE_NOT_EQUAL,
+  CL_KOP_VALUE_GREATER,
+  CL_KOP_VALUE_LESS,
+  CL_KOP_VALUE_INCREASED,
+  CL_KOP_VALUE_DECREASED,
+
+  /* Compare the current value to the previous value */
+  CL_KOP_EQUAL,
+  CL_KOP_NOT_EQUAL,
+  CL_KOP_INCREASED,
+  CL_KOP_DECREASED,
+
+  CL_KOP_SIZE
+} cl_kernel_op;
+
+enum
+{
+  CL_KERNEL_SCALAR = 0,
+  CL_KERNEL_SSE2,
+  CL_KERNEL_AVX2
+};
+
+bool compare_to_nothing(uint32_t previous, uint32_t current, uint8_t type)
+{
+  switch (type)
+  {
+  case CLE_CMPTYPE_EQUAL:
+    return previous == current;
+  case CLE_CMPTYPE_LESS:
+  case CLE_CMPTYPE_DECREASED:
+    return previous > current;
+  case CLE_CMPTYPE_GREATER:
+  case CLE_CMPTYPE_INCREASED:
+    return previous < current;
+  case CLE_CMPTYPE_NOT_EQUAL:
+    return previous != current;
+  }
+
+  return false;
+}
+
+bool compare_to_nothing_float(uint32_t previous, uint32_t current, uint8_t type)
+{
+  float fprevious, fcurrent;
+
+  /* Cast to float */
+  memcpy(&fprevious, &previous, sizeof(float));
+  memcpy(&fcurrent,  &current,  sizeof(float));
+
+  switch (type)
+  {
+  case CLE_CMPTYPE_EQUAL:
+    return (uint32_t)fprevious == (uint32_t)fcurrent;
+  case CLE_CMPTYPE_LESS:
+  case CLE_CMPTYPE_DECREASED:
+    return (uint32_t)fprevious > (uint32_t)fcurrent;
+  case CLE_CMPTYPE_GREATER:
+  case CLE_CMPTYPE_INCREASED:
+    return (uint32_t)fprevious < (uint32_t)fcurrent;
+  case CLE_CMPTYPE_NOT_EQUAL:
+    return (uint32_t)fprevious != (uint32_t)fcurrent;
+  }
+
+  return false;
+}
+
+bool compare_to_value(uint32_t previous, uint32_t current, uint8_t type, uint32_t value)
+{
+  switch (type)
+  {
+  case CLE_CMPTYPE_EQUAL:
+    return current == value;
+  case CLE_CMPTYPE_GREATER:
+    return current > value;
+  case CLE_CMPTYPE_LESS:
+    return current < value;
+  case CLE_CMPTYPE_NOT_EQUAL:
+    return current != value;
+  case CLE_CMPTYPE_INCREASED:
+    return current == previous + value;
+  case CLE_CMPTYPE_DECREASED:
+    return current + value == previous;
+  }
+
+  return false;
+}
+
+bool compare_to_value_float(uint32_t previous, uint32_t current, uint8_t type,
+  float value)
+{
+  float fprevious, fcurrent;
+  bool has_decimal_precision;
+
+  /* Cast to float */
+  memcpy(&fprevious, &previous, sizeof(float));
+  memcpy(&fcurrent,  &current,  sizeof(float));
+
+  /* This float is NaN */
+  if (isnan(fcurrent))
+    return false;
+
+  /* Only check decimal precision on equal ops if the user has specified */
+  has_decimal_precision = floor(value) != value;
+
+  switch (type)
+  {
+  case CLE_CMPTYPE_EQUAL:
+    if (has_decimal_precision)
+      return fcurrent == value;
+    else
+      return floor(fcurrent) == value;
+  case CLE_CMPTYPE_GREATER:
+    return fcurrent > value;
+  case CLE_CMPTYPE_LESS:
+    return fcurrent < value;
+  case CLE_CMPTYPE_NOT_EQUAL:
+    return fcurrent != value;
+  case CLE_CMPTYPE_INCREASED:
+    if (has_decimal_precision)
+      return fcurrent == fprevious + value;
+    else
+      return floor(fcurrent) == floor(fprevious) + value;
+  case CLE_CMPTYPE_DECREASED:
+    if (has_decimal_precision)
+      return fcurrent + value == fprevious;
+    else
+      return floor(fcurrent) + value == floor(fprevious);
+  }
+
+  return false;
+}
+
+bool cl_search_bitset_init(cl_search_bitset_t *bitset, cl_addr_t size)
+{
+  if (!bitset)
+    return false;
+  else
+  {
+    cl_addr_t words = size;
+    unsigned i;
+
+    for (i = 0; i < CL_SEARCH_LEVELS; i++)
+    {
+      words = (words + CL_SEARCH_WORD_BITS - 1) / CL_SEARCH_WORD_BITS;
+      bitset->words[i] = words;
+      bitset->levels[i] = (uint64_t*)calloc(words ? words : 1,
+                                            sizeof(uint64_t));
+      if (!bitset->levels[i])
+        return false;
+    }
+
+    return true;
+  }
+}
+
+void cl_search_bitset_free(cl_search_bitset_t *bitset)
+{
+  unsigned i;
+
+  for (i = 0; i < CL_SEARCH_LEVELS; i++)
+  {
+    free(bitset->levels[i]);
+    bitset->levels[i] = NULL;
+    bitset->words[i] = 0;
+  }
+}
+
+void cl_search_bitset_summarize(cl_search_bitset_t *bitset)
+{
+  cl_addr_t i;
+  unsigned level;
+
+  for (level = 1; level < CL_SEARCH_LEVELS; level++)
+  {
+    const uint64_t *below = bitset->levels[level - 1];
+    uint64_t *above = bitset->levels[level];
+
+    memset(above, 0, bitset->words[level] * sizeof(uint64_t));
+    for (i = 0; i < bitset->words[level - 1]; i++)
+      if (below[i])
+        above[i / CL_SEARCH_WORD_BITS] |= 1ULL << (i % CL_SEARCH_WORD_BITS);
+  }
+}
+
+void cl_search_bitset_fill(cl_search_bitset_t *bitset, cl_addr_t size)
+{
+  const cl_addr_t full = size / CL_SEARCH_WORD_BITS;
+  uint64_t *words = bitset->levels[0];
+
+  memset(words, 0, bitset->words[0] * sizeof(uint64_t));
+  memset(words, 0xFF, full * sizeof(uint64_t));
+
+  /* Addresses past the given size are never set */
+  if (size % CL_SEARCH_WORD_BITS)
+    words[full] = (1ULL << (size % CL_SEARCH_WORD_BITS)) - 1;
+  cl_search_bitset_summarize(bitset);
+}
+
+bool cl_search_bitset_test(const cl_search_bitset_t *bitset, cl_addr_t offset)
+{
+  if (offset / CL_SEARCH_WORD_BITS >= bitset->words[0])
+    return false;
+  else
+    return (bitset->levels[0][offset / CL_SEARCH_WORD_BITS] >>
+            (offset % CL_SEARCH_WORD_BITS)) & 1;
+}
+
+void cl_search_bitset_set(cl_search_bitset_t *bitset, cl_addr_t offset)
+{
+  unsigned level;
+
+  for (level = 0; level < CL_SEARCH_LEVELS; level++)
+  {
+    bitset->levels[level][offset / CL_SEARCH_WORD_BITS] |=
+      1ULL << (offset % CL_SEARCH_WORD_BITS);
+    offset /= CL_SEARCH_WORD_BITS;
+  }
+}
+
+void cl_search_bitset_unset_word(cl_search_bitset_t *bitset, cl_addr_t word)
+{
+  unsigned level;
+
+  for (level = 1; level < CL_SEARCH_LEVELS; level++)
+  {
+    uint64_t *bits = &bitset->levels[level][word / CL_SEARCH_WORD_BITS];
+
+    *bits &= ~(1ULL << (word % CL_SEARCH_WORD_BITS));
+
+    /* Other words under this summary word are still set */
+    if (*bits)
+      break;
+    word /= CL_SEARCH_WORD_BITS;
+  }
+}
+
+void cl_search_bitset_unset(cl_search_bitset_t *bitset, cl_addr_t offset)
+{
+  uint64_t *bits = &bitset->levels[0][offset / CL_SEARCH_WORD_BITS];
+
+  *bits &= ~(1ULL << (offset % CL_SEARCH_WORD_BITS));
+  if (!*bits)
+    cl_search_bitset_unset_word(bitset, offset / CL_SEARCH_WORD_BITS);
+}
+
+bool cl_search_bitset_find(const cl_search_bitset_t *bitset, unsigned level,
+  cl_addr_t *position, cl_addr_t end)
+{
+  cl_addr_t word = *position / CL_SEARCH_WORD_BITS;
+  uint64_t bits;
+
+  if (level >= CL_SEARCH_LEVELS || *position >= end ||
+      word >= bitset->words[level])
+    return false;
+
+  /* Ignore the bits before the starting position in the first word */
+  bits = bitset->levels[level][word] &
+    (~0ULL << (*position % CL_SEARCH_WORD_BITS));
+  if (!bits)
+  {
+    /* Use the level above to jump to the next non-zero word */
+    if (level + 1 < CL_SEARCH_LEVELS)
+    {
+      word++;
+      if (!cl_search_bitset_find(bitset, level + 1, &word,
+            (end + CL_SEARCH_WORD_BITS - 1) / CL_SEARCH_WORD_BITS))
+        return false;
+    }
+    else
+    {
+      do
+      {
+        if (++word >= bitset->words[level] ||
+            word * CL_SEARCH_WORD_BITS >= end)
+          return false;
+      } while (!bitset->levels[level][word]);
+    }
+    bits = bitset->levels[level][word];
+  }
+  *position = word * CL_SEARCH_WORD_BITS + cl_ctz64(bits);
+
+  return *position < end;
+}
+
+/**
+ * Returns a mask of the bits in a bitset word that can hold a candidate of the
+ * given size, as candidates are aligned to their size.
+ */
+static uint64_t cl_search_stride_mask(unsigned size)
+{
+  switch (size)
+  {
+  case 2:
+    return 0x5555555555555555ULL;
+  case 4:
+    return 0x1111111111111111ULL;
+  default:
+    return 0xFFFFFFFFFFFFFFFFULL;
+  }
+}
+
+/**
+ * Records the valid candidates left in a bitset word into the output range.
+ * @return The number of valid candidates in the word.
+ */
+static cl_addr_t cl_search_kernel_account(cl_search_kernel_args_t *args,
+  cl_addr_t word, uint64_t bits, cl_addr_t matches)
+{
+  if (!bits)
+    return 0;
+  else
+  {
+    const cl_addr_t base = word * CL_SEARCH_WORD_BITS;
+
+    if (!matches)
+      args->first = base + cl_ctz64(bits);
+    args->last = base + cl_msb64(bits);
+
+    return cl_popcount64(bits);
+  }
+}
+
+CL_INLINE uint32_t cl_load_value(const uint8_t *src, const unsigned size,
+  const bool byteswap)
+{
+  switch (size)
+  {
+  case 1:
+    return *src;
+  case 2:
+  {
+    uint16_t value;
+
+    memcpy(&value, src, sizeof(value));
+    if (byteswap)
+#ifdef _MSC_VER
+      value = _byteswap_ushort(value);
+#else
+      value = __builtin_bswap16(value);
+#endif
+    return value;
+  }
+  case 4:
+  {
+    uint32_t value;
+
+    memcpy(&value, src, sizeof(value));
+    if (byteswap)
+#ifdef _MSC_VER
+      value = _byteswap_ulong(value);
+#else
+      value = __builtin_bswap32(value);
+#endif
+    return value;
+  }
+  }
+
+  return 0;
+}
+
+static cl_kernel_op cl_kernel_op_from_args(const cl_search_kernel_args_t *args)
+{
+  if (args->has_value)
+  {
+    switch (args->compare_type)
+    {
+    case CLE_CMPTYPE_EQUAL:
+      return CL_KOP_VALUE_EQUAL;
+    case CLE_CMPTYPE_NOT_EQUAL:
+      return CL_KOP_VALUE_NOT_EQUAL;
+    case CLE_CMPTYPE_GREATER:
+      return CL_KOP_VALUE_GREATER;
+    case CLE_CMPTYPE_LESS:
+      return CL_KOP_VALUE_LESS;
+    case CLE_CMPTYPE_INCREASED:
+      return CL_KOP_VALUE_INCREASED;
+    case CLE_CMPTYPE_DECREASED:
+      return CL_KOP_VALUE_DECREASED;
+    }
+  }
+  else
+  {
+    switch (args->compare_type)
+    {
+    case CLE_CMPTYPE_EQUAL:
+      return CL_KOP_EQUAL;
+    case CLE_CMPTYPE_NOT_EQUAL:
+      return CL_KOP_NOT_EQUAL;
+    case CLE_CMPTYPE_GREATER:
+    case CLE_CMPTYPE_INCREASED:
+      return CL_KOP_INCREASED;
+    case CLE_CMPTYPE_LESS:
+    case CLE_CMPTYPE_DECREASED:
+      return CL_KOP_DECREASED;
+    }
+  }
+
+  return CL_KOP_NONE;
+}
+
+/**
+ * Compares one candidate with the original compare functions. Used for the
+ * combinations of size and type that have no specialized kernel.
+ */
+static bool cl_search_kernel_generic_compare(
+  const cl_search_kernel_args_t *args, uint32_t previous, uint32_t current)
+{
+  if (args->value_type == CL_MEMTYPE_FLOAT)
+    return args->has_value ?
+      compare_to_value_float(previous, current, args->compare_type,
+                             args->value_float) :
+      compare_to_nothing_float(previous, current, args->compare_type);
+  else
+    return args->has_value ?
+      compare_to_value(previous, current, args->compare_type, args->value) :
+      compare_to_nothing(previous, current, args->compare_type);
+}
+
+/**
+ * Compares two loaded values for a constant operation. Once inlined into a
+ * loop with constant arguments, only the code for one comparison remains.
+ * Floats follow compare_to_value_float and compare_to_nothing_float, with
+ * the check for decimal precision done once per step instead of per value.
+ */
+CL_INLINE bool cl_scalar_compare(const unsigned op, const bool is_float,
+  const cl_search_kernel_args_t *args, uint32_t previous, uint32_t current)
+{
+  if (is_float)
+  {
+    const float value = args->value_float;
+    float fprevious, fcurrent;
+
+    memcpy(&fprevious, &previous, sizeof(float));
+    memcpy(&fcurrent,  &current,  sizeof(float));
+
+    /* This float is NaN */
+    if (op < CL_KOP_EQUAL && isnan(fcurrent))
+      return false;
+
+    switch (op)
+    {
+    case CL_KOP_VALUE_EQUAL:
+      return args->value_has_decimal ? fcurrent == value :
+                                       floor(fcurrent) == value;
+    case CL_KOP_VALUE_NOT_EQUAL:
+      return fcurrent != value;
+    case CL_KOP_VALUE_GREATER:
+      return fcurrent > value;
+    case CL_KOP_VALUE_LESS:
+      return fcurrent < value;
+    case CL_KOP_VALUE_INCREASED:
+      return args->value_has_decimal ? fcurrent == fprevious + value :
+                                       floor(fcurrent) == floor(fprevious) + value;
+    case CL_KOP_VALUE_DECREASED:
+      return args->value_has_decimal ? fcurrent + value == fprevious :
+                                       floor(fcurrent) + value == floor(fprevious);
+    case CL_KOP_EQUAL:
+      return (uint32_t)fprevious == (uint32_t)fcurrent;
+    case CL_KOP_NOT_EQUAL:
+      return (uint32_t)fprevious != (uint32_t)fcurrent;
+    case CL_KOP_INCREASED:
+      return (uint32_t)fprevious < (uint32_t)fcurrent;
+    case CL_KOP_DECREASED:
+      return (uint32_t)fprevious > (uint32_t)fcurrent;
+    }
+  }
+  else
+  {
+    const uint32_t value = args->value;
+
+    switch (op)
+    {
+    case CL_KOP_VALUE_EQUAL:
+      return current == value;
+    case CL_KOP_VALUE_NOT_EQUAL:
+      return current != value;
+    case CL_KOP_VALUE_GREATER:
+      return current > value;
+    case CL_KOP_VALUE_LESS:
+      return current < value;
+    case CL_KOP_VALUE_INCREASED:
+      return current == previous + value;
+    case CL_KOP_VALUE_DECREASED:
+      return current + value == previous;
+    case CL_KOP_EQUAL:
+      return previous == current;
+    case CL_KOP_NOT_EQUAL:
+      return previous != current;
+    case CL_KOP_INCREASED:
+      return previous < current;
+    case CL_KOP_DECREASED:
+      return previous > current;
+    }
+  }
+
+  return false;
+}
+
+/**
+ * Compares candidates one at a time, starting at a given bitset word. Only the
+ * set bits of each word are visited.
+ * Used on its own when no vector kernels are available, or to finish the
+ * words a vector kernel could not cover.
+ * @param matches The number of valid candidates found before this word.
+ * @return The number of valid candidates found in total.
+ */
+CL_INLINE cl_addr_t cl_scalar_loop(cl_search_kernel_args_t *args,
+  cl_addr_t word, cl_addr_t matches, const unsigned op, const bool is_float,
+  const unsigned size, const bool byteswap, const bool generic)
+{
+  const uint64_t stride = cl_search_stride_mask(size);
+  uint64_t *valid = args->valid->levels[0];
+  uint32_t previous, current;
+  uint64_t bits, kept;
+  cl_addr_t offset;
+  unsigned bit;
+
+  /* Skip over blocks and pages that have been weeded out already */
+  for (; cl_search_bitset_find(args->valid, 1, &word, args->word_end); word++)
+  {
+    bits = valid[word] & stride;
+    kept = bits;
+    while (bits)
+    {
+      bit = cl_ctz64(bits);
+      bits &= bits - 1;
+      offset = word * CL_SEARCH_WORD_BITS + bit;
+
+      /* Only compare values that fit entirely within the bank */
+      if (offset + size > args->limit)
+      {
+        kept &= ~(1ULL << bit);
+        continue;
+      }
+      previous = cl_load_value(&args->previous[offset], size, byteswap);
+      current  = cl_load_value(&args->current[offset], size, byteswap);
+      if (generic ?
+          !cl_search_kernel_generic_compare(args, previous, current) :
+          !cl_scalar_compare(op, is_float, args, previous, current))
+        kept &= ~(1ULL << bit);
+    }
+    valid[word] = kept;
+    if (!kept)
+      cl_search_bitset_unset_word(args->valid, word);
+    else
+      matches += cl_search_kernel_account(args, word, kept, matches);
+  }
+
+  return matches;
+}
+
+/**
+ * Compares the candidates in a sorted list, dropping those that fail and
+ * updating the previous bytes of the rest.
+ * @return The number of candidates left at the start of the list.
+ */
+CL_INLINE cl_addr_t cl_sparse_loop(cl_search_kernel_args_t *args,
+  cl_searchentry_t *entries, cl_addr_t count, const unsigned op,
+  const bool is_float, const unsigned size, const bool byteswap,
+  const bool generic)
+{
+  uint32_t previous, current;
+  cl_addr_t matches = 0;
+  cl_addr_t i, length;
+
+  for (i = 0; i < count; i++)
+  {
+    cl_searchentry_t *entry = &entries[i];
+
+    /* Candidates must be aligned and fit entirely within the bank */
+    if (entry->offset % size || entry->offset + size > args->limit)
+      continue;
+    previous = cl_load_value(entry->previous, size, byteswap);
+    current  = cl_load_value(&args->current[entry->offset], size, byteswap);
+    if (generic ?
+        !cl_search_kernel_generic_compare(args, previous, current) :
+        !cl_scalar_compare(op, is_float, args, previous, current))
+      continue;
+
+    /* Keep this candidate, along with its current bytes */
+    length = args->limit - entry->offset;
+    if (length > sizeof(entry->previous))
+      length = sizeof(entry->previous);
+    memcpy(entries[matches].previous, &args->current[entry->offset], length);
+    entries[matches].offset = entry->offset;
+    matches++;
+  }
+  if (matches)
+  {
+    args->first = entries[0].offset;
+    args->last  = entries[matches - 1].offset;
+  }
+
+  return matches;
+}
+
+/**
+ * A set of scalar loops specialized for one combination of value size, value
+ * type, comparison and byte order.
+ */
+struct cl_search_kernel_t
+{
+  cl_search_compare_t compare;
+  cl_addr_t (*loop)(cl_search_kernel_args_t *args, cl_addr_t word,
+                    cl_addr_t matches);
+  cl_addr_t (*sparse)(cl_search_kernel_args_t *args,
+                      cl_searchentry_t *entries, cl_addr_t count);
+};
+
+/* The fallback for value sizes and types without a specialized kernel */
+static cl_addr_t cl_scalar_generic(cl_search_kernel_args_t *args,
+  cl_addr_t word, cl_addr_t matches)
+{
+  return cl_scalar_loop(args, word, matches, CL_KOP_NONE, false, args->size,
+                        args->byteswap, true);
+}
+
+static cl_addr_t cl_sparse_generic(cl_search_kernel_args_t *args,
+  cl_searchentry_t *entries, cl_addr_t count)
+{
+  return cl_sparse_loop(args, entries, count, CL_KOP_NONE, false, args->size,
+                        args->byteswap, true);
+}
+
+static const struct cl_search_kernel_t cl_search_kernel_generic =
+{
+  cl_search_kernel_generic_compare,
+  cl_scalar_generic,
+  cl_sparse_generic
+};
+
+/**
+ * Lists every specialized kernel as X(name, operation, type, is float,
+ * size, byteswap). Types are listed in the order of cl_kernel_type.
+ */
+#define CL_KERNEL_OPS(X, T, F, S, B) \
+  X(value_equal,     CL_KOP_VALUE_EQUAL,     T, F, S, B) \
+  X(value_not_equal, CL_KOP_VALUE_NOT_EQUAL, T, F, S, B) \
+  X(value_greater,   CL_KOP_VALUE_GREATER,   T, F, S, B) \
+  X(value_less,      CL_KOP_VALUE_LESS,      T, F, S, B) \
+  X(value_increased, CL_KOP_VALUE_INCREASED, T, F, S, B) \
+  X(value_decreased, CL_KOP_VALUE_DECREASED, T, F, S, B) \
+  X(equal,           CL_KOP_EQUAL,           T, F, S, B) \
+  X(not_equal,       CL_KOP_NOT_EQUAL,       T, F, S, B) \
+  X(increased,       CL_KOP_INCREASED,       T, F, S, B) \
+  X(decreased,       CL_KOP_DECREASED,       T, F, S, B)
+#define CL_KERNEL_TYPES(X, B) \
+  CL_KERNEL_OPS(X, u8,  false, 1, B) \
+  CL_KERNEL_OPS(X, u16, false, 2, B) \
+  CL_KERNEL_OPS(X, u32, false, 4, B) \
+  CL_KERNEL_OPS(X, f32, true,  4, B)
+#define CL_KERNEL_ALL(X) \
+  CL_KERNEL_TYPES(X, 0) \
+  CL_KERNEL_TYPES(X, 1)
+
+typedef enum
+{
+  CL_KTYPE_U8 = 0,
+  CL_KTYPE_U16,
+  CL_KTYPE_U32,
+  CL_KTYPE_F32,
+
+  CL_KTYPE_SIZE
+} cl_kernel_type;
+
+#define CL_DEFINE_SCALAR_KERNEL(NAME, OP, T, F, S, B) \
+static cl_addr_t cl_scalar_##NAME##_##T##_##B(cl_search_kernel_args_t *args, \
+  cl_addr_t word, cl_addr_t matches) \
+{ \
+  return cl_scalar_loop(args, word, matches, OP, F, S, B, false); \
+} \
+\
+static cl_addr_t cl_sparse_##NAME##_##T##_##B(cl_search_kernel_args_t *args, \
+  cl_searchentry_t *entries, cl_addr_t count) \
+{ \
+  return cl_sparse_loop(args, entries, count, OP, F, S, B, false); \
+}
+
+/* Value compares do not depend on size or byte order */
+#define CL_DEFINE_COMPARE(NAME, OP, T, F, S, B) \
+static bool cl_compare_##NAME##_##T(const cl_search_kernel_args_t *args, \
+  uint32_t previous, uint32_t current) \
+{ \
+  return cl_scalar_compare(OP, F, args, previous, current); \
+}
+
+#define CL_SCALAR_KERNEL_ENTRY(NAME, OP, T, F, S, B) \
+  { \
+    cl_compare_##NAME##_##T, \
+    cl_scalar_##NAME##_##T##_##B, \
+    cl_sparse_##NAME##_##T##_##B \
+  },
+
+CL_KERNEL_ALL(CL_DEFINE_SCALAR_KERNEL)
+CL_KERNEL_TYPES(CL_DEFINE_COMPARE, 0)
+
+/**
+ * Every specialized kernel, indexed by byte order, then type, then operation.
+ */
+static const struct cl_search_kernel_t cl_search_kernels[] =
+{
+  CL_KERNEL_ALL(CL_SCALAR_KERNEL_ENTRY)
+};
+
+void cl_search_kernel_prepare(cl_search_kernel_args_t *args)
+{
+  cl_kernel_type type;
+
+  args->op = (uint8_t)cl_kernel_op_from_args(args);
+  args->value_has_decimal = args->value_type == CL_MEMTYPE_FLOAT &&
+                            floor(args->value_float) != args->value_float;
+  args->kernel = &cl_search_kernel_generic;
+
+  if (args->op == CL_KOP_NONE)
+    return;
+  else if (args->value_type == CL_MEMTYPE_FLOAT)
+  {
+    if (args->size != 4)
+      return;
+    type = CL_KTYPE_F32;
+  }
+  else if (args->size == 1)
+    type = CL_KTYPE_U8;
+  else if (args->size == 2)
+    type = CL_KTYPE_U16;
+  else if (args->size == 4)
+    type = CL_KTYPE_U32;
+  else
+    return;
+
+  args->kernel = &cl_search_kernels[
+    ((args->byteswap ? 1 : 0) * CL_KTYPE_SIZE + type) * (CL_KOP_SIZE - 1) +
+    args->op - 1];
+}
+
+cl_search_compare_t cl_search_kernel_compare(
+  const cl_search_kernel_args_t *args)
+{
+  return args->kernel ? args->kernel->compare :
+                        cl_search_kernel_generic_compare;
+}
+
+#if CL_SEARCH_X86
+
+/**
+ * Vector primitives. Values are compared as unsigned integers of 8, 16 or 32
+ * bits, zero-extended to 32 bits, to match the scalar compare functions.
+ */
+
+/* SSE2 */
+CL_TARGET_SSE2 CL_INLINE __m128i cl_sse2_load(const uint8_t *src)
+{
+  return _mm_loadu_si128((const __m128i*)src);
+}
+
+CL_TARGET_SSE2 CL_INLINE uint32_t cl_sse2_movemask(__m128i value)
+{
+  return (uint32_t)_mm_movemask_epi8(value);
+}
+
+CL_TARGET_SSE2 CL_INLINE __m128i cl_sse2_zero(void)
+{
+  return _mm_setzero_si128();
+}
+
+CL_TARGET_SSE2 CL_INLINE __m128i cl_sse2_not(__m128i a)
+{
+  return _mm_xor_si128(a, _mm_cmpeq_epi8(a, a));
+}
+
+CL_TARGET_SSE2 CL_INLINE __m128i cl_sse2_set8(uint32_t value)
+{
+  return _mm_set1_epi8((char)value);
+}
+
+CL_TARGET_SSE2 CL_INLINE __m128i cl_sse2_set16(uint32_t value)
+{
+  return _mm_set1_epi16((short)value);
+}
+
+CL_TARGET_SSE2 CL_INLINE __m128i cl_sse2_set32(uint32_t value)
+{
+  return _mm_set1_epi32((int)value);
+}
+
+CL_TARGET_SSE2 CL_INLINE __m128i cl_sse2_eq8(__m128i a, __m128i b)
+{
+  return _mm_cmpeq_epi8(a, b);
+}
+
+CL_TARGET_SSE2 CL_INLINE __m128i cl_sse2_eq16(__m128i a, __m128i b)
+{
+  return _mm_cmpeq_epi16(a, b);
+}
+
+CL_TARGET_SSE2 CL_INLINE __m128i cl_sse2_eq32(__m128i a, __m128i b)
+{
+  return _mm_cmpeq_epi32(a, b);
+}
+
+/* Unsigned greater-than, by flipping the sign bit of both sides */
+CL_TARGET_SSE2 CL_INLINE __m128i cl_sse2_gtu8(__m128i a, __m128i b)
+{
+  const __m128i sign = _mm_set1_epi8((char)0x80);
+
+  return _mm_cmpgt_epi8(_mm_xor_si128(a, sign), _mm_xor_si128(b, sign));
+}
+
+CL_TARGET_SSE2 CL_INLINE __m128i cl_sse2_gtu16(__m128i a, __m128i b)
+{
+  const __m128i sign = _mm_set1_epi16((short)0x8000);
+
+  return _mm_cmpgt_epi16(_mm_xor_si128(a, sign), _mm_xor_si128(b, sign));
+}
+
+CL_TARGET_SSE2 CL_INLINE __m128i cl_sse2_gtu32(__m128i a, __m128i b)
+{
+  const __m128i sign = _mm_set1_epi32((int)0x80000000);
+
+  return _mm_cmpgt_epi32(_mm_xor_si128(a, sign), _mm_xor_si128(b, sign));
+}
+
+/**
+ * current == previous + value, evaluated without wrapping at the lane width.
+ * This holds when the lane difference equals the value and current did not
+ * borrow from previous.
+ */
+CL_TARGET_SSE2 CL_INLINE __m128i cl_sse2_inc8(__m128i prev, __m128i cur,
+  __m128i val)
+{
+  return _mm_and_si128(_mm_cmpeq_epi8(_mm_sub_epi8(cur, prev), val),
+    _mm_cmpeq_epi8(_mm_subs_epu8(prev, cur), _mm_setzero_si128()));
+}
+
+CL_TARGET_SSE2 CL_INLINE __m128i cl_sse2_inc16(__m128i prev, __m128i cur,
+  __m128i val)
+{
+  return _mm_and_si128(_mm_cmpeq_epi16(_mm_sub_epi16(cur, prev), val),
+    _mm_cmpeq_epi16(_mm_subs_epu16(prev, cur), _mm_setzero_si128()));
+}
+
+/* 32-bit values wrap the same way the scalar compare does */
+CL_TARGET_SSE2 CL_INLINE __m128i cl_sse2_inc32(__m128i prev, __m128i cur,
+  __m128i val)
+{
+  return _mm_cmpeq_epi32(cur, _mm_add_epi32(prev, val));
+}
+
+CL_TARGET_SSE2 CL_INLINE __m128i cl_sse2_bswap8(__m128i a)
+{
+  return a;
+}
+
+CL_TARGET_SSE2 CL_INLINE __m128i cl_sse2_bswap16(__m128i a)
+{
+  return _mm_or_si128(_mm_slli_epi16(a, 8), _mm_srli_epi16(a, 8));
+}
+
+CL_TARGET_SSE2 CL_INLINE __m128i cl_sse2_bswap32(__m128i a)
+{
+  a = _mm_shufflelo_epi16(a, _MM_SHUFFLE(2, 3, 0, 1));
+  a = _mm_shufflehi_epi16(a, _MM_SHUFFLE(2, 3, 0, 1));
+
+  return cl_sse2_bswap16(a);
+}
+
+/* AVX2 */
+CL_TARGET_AVX2 CL_INLINE __m256i cl_avx2_load(const uint8_t *src)
+{
+  return _mm256_loadu_si256((const __m256i*)src);
+}
+
+CL_TARGET_AVX2 CL_INLINE uint32_t cl_avx2_movemask(__m256i value)
+{
+  return (uint32_t)_mm256_movemask_epi8(value);
+}
+
+CL_TARGET_AVX2 CL_INLINE __m256i cl_avx2_zero(void)
+{
+  return _mm256_setzero_si256();
+}
+
+CL_TARGET_AVX2 CL_INLINE __m256i cl_avx2_not(__m256i a)
+{
+  return _mm256_xor_si256(a, _mm256_cmpeq_epi8(a, a));
+}
+
+CL_TARGET_AVX2 CL_INLINE __m256i cl_avx2_set8(uint32_t value)
+{
+  return _mm256_set1_epi8((char)value);
+}
+
+CL_TARGET_AVX2 CL_INLINE __m256i cl_avx2_set16(uint32_t value)
+{
+  return _mm256_set1_epi16((short)value);
+}
+
+CL_TARGET_AVX2 CL_INLINE __m256i cl_avx2_set32(uint32_t value)
+{
+  return _mm256_set1_epi32((int)value);
+}
+
+CL_TARGET_AVX2 CL_INLINE __m256i cl_avx2_eq8(__m256i a, __m256i b)
+{
+  return _mm256_cmpeq_epi8(a, b);
+}
+
+CL_TARGET_AVX2 CL_INLINE __m256i cl_avx2_eq16(__m256i a, __m256i b)
+{
+  return _mm256_cmpeq_epi16(a, b);
+}
+
+CL_TARGET_AVX2 CL_INLINE __m256i cl_avx2_eq32(__m256i a, __m256i b)
+{
+  return _mm256_cmpeq_epi32(a, b);
+}
+
+/* AVX2 has unsigned min/max for every lane width we use */
+CL_TARGET_AVX2 CL_INLINE __m256i cl_avx2_gtu8(__m256i a, __m256i b)
+{
+  return cl_avx2_not(_mm256_cmpeq_epi8(_mm256_max_epu8(a, b), b));
+}
+
+CL_TARGET_AVX2 CL_INLINE __m256i cl_avx2_gtu16(__m256i a, __m256i b)
+{
+  return cl_avx2_not(_mm256_cmpeq_epi16(_mm256_max_epu16(a, b), b));
+}
+
+CL_TARGET_AVX2 CL_INLINE __m256i cl_avx2_gtu32(__m256i a, __m256i b)
+{
+  return cl_avx2_not(_mm256_cmpeq_epi32(_mm256_max_epu32(a, b), b));
+}
+
+CL_TARGET_AVX2 CL_INLINE __m256i cl_avx2_inc8(__m256i prev, __m256i cur,
+  __m256i val)
+{
+  return _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_sub_epi8(cur, prev), val),
+    _mm256_cmpeq_epi8(_mm256_max_epu8(prev, cur), cur));
+}
+
+CL_TARGET_AVX2 CL_INLINE __m256i cl_avx2_inc16(__m256i prev, __m256i cur,
+  __m256i val)
+{
+  return _mm256_and_si256(_mm256_cmpeq_epi16(_mm256_sub_epi16(cur, prev), val),
+    _mm256_cmpeq_epi16(_mm256_max_epu16(prev, cur), cur));
+}
+
+CL_TARGET_AVX2 CL_INLINE __m256i cl_avx2_inc32(__m256i prev, __m256i cur,
+  __m256i val)
+{
+  return _mm256_cmpeq_epi32(cur, _mm256_add_epi32(prev, val));
+}
+
+CL_TARGET_AVX2 CL_INLINE __m256i cl_avx2_bswap8(__m256i a)
+{
+  return a;
+}
+
+CL_TARGET_AVX2 CL_INLINE __m256i cl_avx2_bswap16(__m256i a)
+{
+  return _mm256_shuffle_epi8(a, _mm256_setr_epi8(
+    1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14,
+    1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14));
+}
+
+CL_TARGET_AVX2 CL_INLINE __m256i cl_avx2_bswap32(__m256i a)
+{
+  return _mm256_shuffle_epi8(a, _mm256_setr_epi8(
+    3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+    3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12));
+}
+
+/**
+ * Defines the vector kernels for one instruction set and lane width.
+ * The compare and loop functions are always inlined with constant operations,
+ * so every (operation, byte order) pair gets its own branch-free loop.
+ * Each bitset word covers 64 bytes, which are compared a vector at a time.
+ * Byte masks of the results line up with the bits of the word, with every
+ * byte of a passing lane set, so ANDing with the word and stride mask keeps
+ * only the candidates that start a passing lane.
+ */
+#define CL_DEFINE_SIMD_KERNEL(X, TARGET, T, W) \
+TARGET CL_INLINE T cl_##X##_compare##W(const unsigned op, T prev, \
+  T cur, T val) \
+{ \
+  switch (op) \
+  { \
+  case CL_KOP_VALUE_EQUAL:     return cl_##X##_eq##W(cur, val); \
+  case CL_KOP_VALUE_NOT_EQUAL: return cl_##X##_not(cl_##X##_eq##W(cur, val)); \
+  case CL_KOP_VALUE_GREATER:   return cl_##X##_gtu##W(cur, val); \
+  case CL_KOP_VALUE_LESS:      return cl_##X##_gtu##W(val, cur); \
+  case CL_KOP_VALUE_INCREASED: return cl_##X##_inc##W(prev, cur, val); \
+  case CL_KOP_VALUE_DECREASED: return cl_##X##_inc##W(cur, prev, val); \
+  case CL_KOP_EQUAL:           return cl_##X##_eq##W(prev, cur); \
+  case CL_KOP_NOT_EQUAL:       return cl_##X##_not(cl_##X##_eq##W(prev, cur)); \
+  case CL_KOP_INCREASED:       return cl_##X##_gtu##W(cur, prev); \
+  case CL_KOP_DECREASED:       return cl_##X##_gtu##W(prev, cur); \
+  default:                     return cl_##X##_zero(); \
+  } \
+} \
+\
+TARGET CL_INLINE uint64_t cl_##X##_block##W(const unsigned op, \
+  const bool byteswap, const uint8_t *previous, const uint8_t *current, \
+  T val) \
+{ \
+  uint64_t mask = 0; \
+  unsigned i; \
+\
+  for (i = 0; i < CL_SEARCH_WORD_BITS; i += sizeof(T)) \
+  { \
+    T prev = cl_##X##_load(&previous[i]); \
+    T cur  = cl_##X##_load(&current[i]); \
+\
+    if (byteswap) \
+    { \
+      prev = cl_##X##_bswap##W(prev); \
+      cur  = cl_##X##_bswap##W(cur); \
+    } \
+    mask |= (uint64_t)cl_##X##_movemask( \
+      cl_##X##_compare##W(op, prev, cur, val)) << i; \
+  } \
+\
+  return mask; \
+} \
+\
+TARGET CL_INLINE cl_addr_t cl_##X##_loop##W( \
+  cl_search_kernel_args_t *args, const unsigned op, const bool byteswap, \
+  cl_addr_t *word) \
+{ \
+  const uint64_t stride = cl_search_stride_mask(W / 8); \
+  const T val = cl_##X##_set##W(args->value); \
+  uint64_t *valid = args->valid->levels[0]; \
+  cl_addr_t matches = 0; \
+  cl_addr_t base; \
+  uint64_t bits; \
+  cl_addr_t i; \
+\
+  /* Only visit blocks that still hold a candidate */ \
+  for (i = args->word_begin; \
+       cl_search_bitset_find(args->valid, 1, &i, args->word_end); i++) \
+  { \
+    /* The last word may run past the bank; leave it to the scalar kernel */ \
+    base = i * CL_SEARCH_WORD_BITS; \
+    if (base + CL_SEARCH_WORD_BITS > args->limit) \
+      break; \
+\
+    bits = valid[i] & stride & cl_##X##_block##W(op, byteswap, \
+      &args->previous[base], &args->current[base], val); \
+    valid[i] = bits; \
+    if (!bits) \
+      cl_search_bitset_unset_word(args->valid, i); \
+    else \
+      matches += cl_search_kernel_account(args, i, bits, matches); \
+  } \
+  *word = i; \
+\
+  return matches; \
+} \
+\
+TARGET static cl_addr_t cl_##X##_kernel##W( \
+  cl_search_kernel_args_t *args, const unsigned op, cl_addr_t *word) \
+{ \
+  if (args->byteswap) \
+  { \
+    switch (op) \
+    { \
+    case CL_KOP_VALUE_EQUAL: \
+      return cl_##X##_loop##W(args, CL_KOP_VALUE_EQUAL, true, word); \
+    case CL_KOP_VALUE_NOT_EQUAL: \
+      return cl_##X##_loop##W(args, CL_KOP_VALUE_NOT_EQUAL, true, word); \
+    case CL_KOP_VALUE_GREATER: \
+      return cl_##X##_loop##W(args, CL_KOP_VALUE_GREATER, true, word); \
+    case CL_KOP_VALUE_LESS: \
+      return cl_##X##_loop##W(args, CL_KOP_VALUE_LESS, true, word); \
+    case CL_KOP_VALUE_INCREASED: \
+      return cl_##X##_loop##W(args, CL_KOP_VALUE_INCREASED, true, word); \
+    case CL_KOP_VALUE_DECREASED: \
+      return cl_##X##_loop##W(args, CL_KOP_VALUE_DECREASED, true, word); \
+    case CL_KOP_EQUAL: \
+      return cl_##X##_loop##W(args, CL_KOP_EQUAL, true, word); \
+    case CL_KOP_NOT_EQUAL: \
+      return cl_##X##_loop##W(args, CL_KOP_NOT_EQUAL, true, word); \
+    case CL_KOP_INCREASED: \
+      return cl_##X##_loop##W(args, CL_KOP_INCREASED, true, word); \
+    case CL_KOP_DECREASED: \
+      return cl_##X##_loop##W(args, CL_KOP_DECREASED, true, word); \
+    } \
+  } \
+  else \
+  { \
+    switch (op) \
+    { \
+    case CL_KOP_VALUE_EQUAL: \
+      return cl_##X##_loop##W(args, CL_KOP_VALUE_EQUAL, false, word); \
+    case CL_KOP_VALUE_NOT_EQUAL: \
+      return cl_##X##_loop##W(args, CL_KOP_VALUE_NOT_EQUAL, false, word); \
+    case CL_KOP_VALUE_GREATER: \
+      return cl_##X##_loop##W(args, CL_KOP_VALUE_GREATER, false, word); \
+    case CL_KOP_VALUE_LESS: \
+      return cl_##X##_loop##W(args, CL_KOP_VALUE_LESS, false, word); \
+    case CL_KOP_VALUE_INCREASED: \
+      return cl_##X##_loop##W(args, CL_KOP_VALUE_INCREASED, false, word); \
+    case CL_KOP_VALUE_DECREASED: \
+      return cl_##X##_loop##W(args, CL_KOP_VALUE_DECREASED, false, word); \
+    case CL_KOP_EQUAL: \
+      return cl_##X##_loop##W(args, CL_KOP_EQUAL, false, word); \
+    case CL_KOP_NOT_EQUAL: \
+      return cl_##X##_loop##W(args, CL_KOP_NOT_EQUAL, false, word); \
+    case CL_KOP_INCREASED: \
+      return cl_##X##_loop##W(args, CL_KOP_INCREASED, false, word); \
+    case CL_KOP_DECREASED: \
+      return cl_##X##_loop##W(args, CL_KOP_DECREASED, false, word); \
+    } \
+  } \
+\
+  return cl_##X##_loop##W(args, CL_KOP_NONE, false, word); \
+}
+
+CL_DEFINE_SIMD_KERNEL(sse2, CL_TARGET_SSE2, __m128i, 8)
+CL_DEFINE_SIMD_KERNEL(sse2, CL_TARGET_SSE2, __m128i, 16)
+CL_DEFINE_SIMD_KERNEL(sse2, CL_TARGET_SSE2, __m128i, 32)
+CL_DEFINE_SIMD_KERNEL(avx2, CL_TARGET_AVX2, __m256i, 8)
+CL_DEFINE_SIMD_KERNEL(avx2, CL_TARGET_AVX2, __m256i, 16)
+CL_DEFINE_SIMD_KERNEL(avx2, CL_TARGET_AVX2, __m256i, 32)
+
+static unsigned cl_search_kernel_detect(void)
+{
+#ifdef _MSC_VER
+  int info[4];
+  bool has_avx = false;
+
+  __cpuid(info, 0);
+  if (info[0] >= 7)
+  {
+    __cpuid(info, 1);
+
+    /* The CPU supports AVX, and the OS saves the AVX registers */
+    if ((info[2] & (1 << 27)) && (info[2] & (1 << 28)))
+      has_avx = (_xgetbv(0) & 6) == 6;
+    __cpuidex(info, 7, 0);
+    if (has_avx && (info[1] & (1 << 5)))
+      return CL_KERNEL_AVX2;
+  }
+  __cpuid(info, 1);
+
+  return (info[3] & (1 << 26)) ? CL_KERNEL_SSE2 : CL_KERNEL_SCALAR;
+#else
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+    return CL_KERNEL_AVX2;
+  else if (__builtin_cpu_supports("sse2"))
+    return CL_KERNEL_SSE2;
+  else
+    return CL_KERNEL_SCALAR;
+#endif
+}
+
+#endif
+
+/**
+ * The kernel set to use. Only written by cl_search_kernel_init, before any
+ * kernels run on worker threads.
+ */
+static unsigned cl_search_kernel_level = CL_KERNEL_SCALAR;
+
+void cl_search_kernel_init(void)
+{
+#if CL_SEARCH_X86
+  static bool detected = false;
+
+  if (!detected)
+  {
+    cl_search_kernel_level = cl_search_kernel_detect();
+    detected = true;
+  }
+#endif
+}
+
+const char* cl_search_kernel_name(void)
+{
+  switch (cl_search_kernel_level)
+  {
+  case CL_KERNEL_AVX2:
+    return "AVX2";
+  case CL_KERNEL_SSE2:
+    return "SSE2";
+  default:
+    return "scalar";
+  }
+}
+
+/**
+ * Runs the kernel chosen for the arguments over their range of words.
+ */
+static cl_addr_t cl_search_kernel_run_range(cl_search_kernel_args_t *args)
+{
+  cl_addr_t word = args->word_begin;
+  cl_addr_t matches = 0;
+
+#if CL_SEARCH_X86
+  /* Floats are compared by value, not by their bit patterns */
+  if (args->value_type != CL_MEMTYPE_FLOAT)
+  {
+    switch (cl_search_kernel_level)
+    {
+    case CL_KERNEL_AVX2:
+      if (args->size == 1)
+        matches = cl_avx2_kernel8(args, args->op, &word);
+      else if (args->size == 2)
+        matches = cl_avx2_kernel16(args, args->op, &word);
+      else if (args->size == 4)
+        matches = cl_avx2_kernel32(args, args->op, &word);
+      break;
+    case CL_KERNEL_SSE2:
+      if (args->size == 1)
+        matches = cl_sse2_kernel8(args, args->op, &word);
+      else if (args->size == 2)
+        matches = cl_sse2_kernel16(args, args->op, &word);
+      else if (args->size == 4)
+        matches = cl_sse2_kernel32(args, args->op, &word);
+      break;
+    }
+  }
+#endif
+
+  /* Finish any words that did not fit a whole vector block */
+  return args->kernel->loop(args, word, matches);
+}
+
+static bool cl_search_page_dirty(const uint64_t *dirty, cl_addr_t page)
+{
+  return (dirty[page / 64] >> (page % 64)) & 1;
+}
+
+/**
+ * Whether unchanged pages can be skipped. Comparing to nothing gives the same
+ * result for every candidate holding its previous value, and candidates
+ * aligned to a size of 1, 2 or 4 never span two pages.
+ */
+static bool cl_search_kernel_skips_clean(const cl_search_kernel_args_t *args)
+{
+  return args->dirty && !args->has_value &&
+         (args->size == 1 || args->size == 2 || args->size == 4) &&
+         (args->op == CL_KOP_EQUAL || args->op == CL_KOP_NOT_EQUAL ||
+          args->op == CL_KOP_INCREASED || args->op == CL_KOP_DECREASED);
+}
+
+/**
+ * Applies a comparison to nothing to candidates on unchanged pages. Each
+ * holds its previous value, so only an equality check keeps them.
+ * @param matches The number of valid candidates found before this word.
+ * @return The number of valid candidates found in total.
+ */
+static cl_addr_t cl_search_kernel_clean(cl_search_kernel_args_t *args,
+  cl_addr_t word, cl_addr_t word_end, cl_addr_t matches)
+{
+  const uint64_t stride = cl_search_stride_mask(args->size);
+  const bool keep = args->op == CL_KOP_EQUAL;
+  uint64_t *valid = args->valid->levels[0];
+  uint64_t kept;
+  cl_addr_t base;
+  unsigned bit;
+
+  for (; cl_search_bitset_find(args->valid, 1, &word, word_end); word++)
+  {
+    kept = keep ? valid[word] & stride : 0;
+    base = word * CL_SEARCH_WORD_BITS;
+
+    /* Only keep values that fit entirely within the bank */
+    if (kept && base + CL_SEARCH_WORD_BITS + args->size > args->limit)
+      for (bit = 0; bit < CL_SEARCH_WORD_BITS; bit++)
+        if (base + bit + args->size > args->limit)
+          kept &= ~(1ULL << bit);
+
+    valid[word] = kept;
+    if (!kept)
+      cl_search_bitset_unset_word(args->valid, word);
+    else
+      matches += cl_search_kernel_account(args, word, kept, matches);
+  }
+
+  return matches;
+}
+
+/**
+ * Runs a compare over runs of changed pages with the usual kernels, and over
+ * runs of unchanged pages with cl_search_kernel_clean.
+ */
+static cl_addr_t cl_search_kernel_run_dirty(cl_search_kernel_args_t *args)
+{
+  const cl_addr_t words_per_page = CL_SEARCH_PAGE_SIZE / CL_SEARCH_WORD_BITS;
+  const cl_addr_t begin = args->word_begin;
+  const cl_addr_t end = args->word_end;
+  cl_addr_t matches = 0;
+  cl_addr_t first = 0, last = 0;
+  cl_addr_t word = begin;
+
+  while (word < end)
+  {
+    const bool dirty = cl_search_page_dirty(args->dirty,
+                                            word / words_per_page);
+    cl_addr_t run_end = word;
+    cl_addr_t run_matches;
+
+    do
+      run_end = (run_end / words_per_page + 1) * words_per_page;
+    while (run_end < end &&
+           cl_search_page_dirty(args->dirty, run_end / words_per_page) ==
+           dirty);
+    if (run_end > end)
+      run_end = end;
+
+    if (dirty)
+    {
+      args->word_begin = word;
+      args->word_end = run_end;
+      run_matches = cl_search_kernel_run_range(args);
+    }
+    else
+      run_matches = cl_search_kernel_clean(args, word, run_end, 0);
+
+    /* Each run reports its own range, so merge them in order */
+    if (run_matches)
+    {
+      if (!matches)
+        first = args->first;
+      last = args->last;
+      matches += run_matches;
+    }
+    word = run_end;
+  }
+  args->word_begin = begin;
+  args->word_end = end;
+  if (matches)
+  {
+    args->first = first;
+    args->last = last;
+  }
+
+  return matches;
+}
+
+cl_addr_t cl_search_kernel_run(cl_search_kernel_args_t *args)
+{
+  if (!args || args->word_begin >= args->word_end)
+    return 0;
+  else if (!args->kernel)
+    cl_search_kernel_prepare(args);
+
+  if (cl_search_kernel_skips_clean(args))
+    return cl_search_kernel_run_dirty(args);
+  else
+    return cl_search_kernel_run_range(args);
+}
+
+cl_addr_t cl_search_kernel_run_sparse(cl_search_kernel_args_t *args,
+  cl_searchentry_t *entries, cl_addr_t count)
+{
+  if (!args || !count)
+    return 0;
+  else if (!args->kernel)
+    cl_search_kernel_prepare(args);
+
+  return args->kernel->sparse(args, entries, count);
+}
+
+#if CL_TESTS
+
+/**
+ * The size of the memory compared by the kernel tests. Not a multiple of a
+ * vector or bitset word, so the tails of every kernel are run.
+ */
+#define CL_SEARCH_KERNEL_TEST_SIZE (3 * CL_SEARCH_PAGE_SIZE + 77)
+
+static uint32_t cl_search_kernel_test_load(const uint8_t *src, unsigned size,
+  bool byteswap)
+{
+  uint16_t value16;
+  uint32_t value32;
+
+  switch (size)
+  {
+  case 2:
+    memcpy(&value16, src, sizeof(value16));
+    return byteswap ? cl_bswap16(value16) : value16;
+  case 4:
+    memcpy(&value32, src, sizeof(value32));
+    return byteswap ? cl_bswap32(value32) : value32;
+  default:
+    return *src;
+  }
+}
+
+/**
+ * Compares one candidate the way a serial search step did before compare
+ * kernels, with the per-value comparison functions.
+ */
+static bool cl_search_kernel_test_compare(const cl_search_kernel_args_t *args,
+  cl_addr_t offset)
+{
+  uint32_t previous, current;
+
+  if (offset % args->size || offset + args->size > args->limit)
+    return false;
+  previous = cl_search_kernel_test_load(&args->previous[offset], args->size,
+                                        args->byteswap);
+  current = cl_search_kernel_test_load(&args->current[offset], args->size,
+                                       args->byteswap);
+  if (!args->has_value)
+    return args->value_type == CL_MEMTYPE_FLOAT ?
+      compare_to_nothing_float(previous, current, args->compare_type) :
+      compare_to_nothing(previous, current, args->compare_type);
+  else
+    return args->value_type == CL_MEMTYPE_FLOAT ?
+      compare_to_value_float(previous, current, args->compare_type,
+                             args->value_float) :
+      compare_to_value(previous, current, args->compare_type, args->value);
+}
+
+/**
+ * Runs the kernel for one set of arguments over random candidates and checks
+ * the bitset, matches and range against the reference comparison.
+ */
+static void cl_search_kernel_test_args(cl_search_kernel_args_t *args,
+  unsigned *seed, uint8_t *previous, uint8_t *current, uint64_t *dirty)
+{
+  const cl_addr_t size = CL_SEARCH_KERNEL_TEST_SIZE;
+  cl_search_bitset_t valid;
+  uint64_t *expected;
+  cl_addr_t matches = 0, first = 0, last = 0;
+  cl_addr_t found, i, word;
+  unsigned level;
+
+  /* Current values are mostly unchanged, or nearly so */
+  for (i = 0; i < size; i++)
+  {
+    previous[i] = (uint8_t)cl_test_rand(seed);
+    switch (cl_test_rand(seed) % 8)
+    {
+    case 0:
+      current[i] = (uint8_t)cl_test_rand(seed);
+      break;
+    case 1:
+      current[i] = (uint8_t)(previous[i] + 1);
+      break;
+    case 2:
+      current[i] = (uint8_t)(previous[i] - 1);
+      break;
+    default:
+      current[i] = previous[i];
+    }
+  }
+  if (args->dirty)
+  {
+    dirty[0] = (uint64_t)cl_test_rand(seed);
+    for (i = 0; i < size; i++)
+      if (!((dirty[0] >> (i / CL_SEARCH_PAGE_SIZE)) & 1))
+        current[i] = previous[i];
+  }
+
+  if (!cl_search_bitset_init(&valid, size))
+    CL_TEST_FAIL(1);
+  cl_search_bitset_fill(&valid, size);
+  for (i = 0; i < valid.words[0]; i++)
+    if (cl_test_rand(seed) % 4 == 0)
+      valid.levels[0][i] &= (uint64_t)cl_test_rand(seed) *
+                            0x0001000100010001ULL;
+  cl_search_bitset_summarize(&valid);
+
+  args->previous = previous;
+  args->current = current;
+  args->valid = &valid;
+  args->limit = size;
+  args->word_begin = cl_test_rand(seed) % 8;
+  args->word_end = valid.words[0] - cl_test_rand(seed) % 8;
+  args->kernel = NULL;
+
+  /* Words outside of the range are left alone */
+  expected = (uint64_t*)malloc(valid.words[0] * sizeof(uint64_t));
+  if (!expected)
+    CL_TEST_FAIL(2);
+  memcpy(expected, valid.levels[0], valid.words[0] * sizeof(uint64_t));
+  for (i = args->word_begin * CL_SEARCH_WORD_BITS;
+       i < args->word_end * CL_SEARCH_WORD_BITS; i++)
+  {
+    uint64_t bit = 1ULL << (i % CL_SEARCH_WORD_BITS);
+
+    if (!(expected[i / CL_SEARCH_WORD_BITS] & bit))
+      continue;
+    else if (i < size && cl_search_kernel_test_compare(args, i))
+    {
+      if (!matches)
+        first = i;
+      last = i;
+      matches++;
+    }
+    else
+      expected[i / CL_SEARCH_WORD_BITS] &= ~bit;
+  }
+
+  found = cl_search_kernel_run(args);
+  if (found != matches)
+    CL_TEST_FAIL(3);
+  if (matches && (args->first != first || args->last != last))
+    CL_TEST_FAIL(4);
+  if (memcmp(expected, valid.levels[0], valid.words[0] * sizeof(uint64_t)))
+    CL_TEST_FAIL(5);
+
+  /* The summary levels still have a bit for every non-zero word below */
+  for (level = 1; level < CL_SEARCH_LEVELS; level++)
+    for (word = 0; word < valid.words[level - 1]; word++)
+      if (((valid.levels[level][word / CL_SEARCH_WORD_BITS] >>
+            (word % CL_SEARCH_WORD_BITS)) & 1) !=
+          (valid.levels[level - 1][word] != 0))
+        CL_TEST_FAIL(6);
+
+  free(expected);
+  cl_search_bitset_free(&valid);
+}
+
+int cl_search_kernel_tests(void)
+{
+  static const uint8_t sizes[] = { 1, 2, 4, 4 };
+  static const uint8_t types[] =
+  {
+    CL_MEMTYPE_UINT8, CL_MEMTYPE_UINT16, CL_MEMTYPE_UINT32, CL_MEMTYPE_FLOAT
+  };
+  const unsigned original = cl_search_kernel_level;
+  uint8_t *previous = (uint8_t*)malloc(CL_SEARCH_KERNEL_TEST_SIZE);
+  uint8_t *current = (uint8_t*)malloc(CL_SEARCH_KERNEL_TEST_SIZE);
+  uint64_t dirty = 0;
+  unsigned seed = 1;
+  unsigned level, highest, i, compare_type, swap, has_value, use_dirty;
+
+  if (!previous || !current)
+    CL_TEST_FAIL(7);
+#if CL_SEARCH_X86
+  highest = cl_search_kernel_detect();
+#else
+  highest = CL_KERNEL_SCALAR;
+#endif
+
+  /* Every kernel set the host supports gives the same results */
+  for (level = CL_KERNEL_SCALAR; level <= highest; level++)
+  {
+    cl_search_kernel_level = level;
+    for (i = 0; i < sizeof(sizes); i++)
+    for (compare_type = CLE_CMPTYPE_EQUAL;
+         compare_type <= CLE_CMPTYPE_DECREASED; compare_type++)
+    for (swap = 0; swap < 2; swap++)
+    for (has_value = 0; has_value < 2; has_value++)
+    for (use_dirty = 0; use_dirty < (has_value ? 1u : 2u); use_dirty++)
+    {
+      cl_search_kernel_args_t args;
+
+      memset(&args, 0, sizeof(args));
+      args.compare_type = (uint8_t)compare_type;
+      args.size = sizes[i];
+      args.value_type = types[i];
+      args.has_value = has_value != 0;
+      args.byteswap = swap != 0;
+      args.dirty = use_dirty ? &dirty : NULL;
+      args.value = cl_test_rand(&seed) % 3;
+      args.value_float = (float)args.value;
+      cl_search_kernel_test_args(&args, &seed, previous, current, &dirty);
+    }
+  }
+  cl_search_kernel_level = original;
+  free(previous);
+  free(current);
+
+  return 1;
+}
+
+#endif
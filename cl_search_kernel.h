@@ -0,0 +1,240 @@
+#ifndef CL_SEARCH_KERNEL_H
+#define CL_SEARCH_KERNEL_H
+
+#include "cl_types.h"
+
+/**
+ * The number of addresses covered by one word of a search validity bitset.
+ */
+#define CL_SEARCH_WORD_BITS 64
+
+/**
+ * The number of levels in a search validity bitset. Level 0 has one bit per
+ * address, level 1 one bit per 64-byte block, and level 2 one bit per 4 KB
+ * page.
+ */
+#define CL_SEARCH_LEVELS 3
+
+/**
+ * The number of addresses covered by one word of level 1 of a search validity
+ * bitset, and by one bit of a map of changed pages.
+ */
+#define CL_SEARCH_PAGE_SIZE (CL_SEARCH_WORD_BITS * CL_SEARCH_WORD_BITS)
+
+/**
+ * A set of search candidates, one bit per byte address. Each summary level
+ * has a bit set for every non-zero word in the level below it, so empty blocks
+ * and pages can be skipped without looking at them.
+ */
+typedef struct cl_search_bitset_t
+{
+  uint64_t *levels[CL_SEARCH_LEVELS];
+  cl_addr_t words[CL_SEARCH_LEVELS];
+} cl_search_bitset_t;
+
+/**
+ * A candidate of a narrowed search, kept along with the bytes it held on the
+ * last search step.
+ */
+typedef struct cl_searchentry_t
+{
+  cl_addr_t offset;
+  uint8_t   previous[4];
+} cl_searchentry_t;
+
+struct cl_search_kernel_args_t;
+struct cl_search_kernel_t;
+
+/**
+ * Compares a previous and current value, loaded into host byte order and
+ * zero-extended to 32 bits, or holding the bits of a float.
+ */
+typedef bool (*cl_search_compare_t)(
+  const struct cl_search_kernel_args_t *args, uint32_t previous,
+  uint32_t current);
+
+/**
+ * The arguments for one run of a search compare kernel. A kernel walks a range
+ * of words in a validity bitset and unsets the bit of every candidate that no
+ * longer meets the search conditions.
+ */
+typedef struct cl_search_kernel_args_t
+{
+  /** The snapshot of the bank taken on the last search step. */
+  const uint8_t *previous;
+
+  /** The live memory of the bank, holding the current values. */
+  const uint8_t *current;
+
+  /** The validity bitset of the bank, one bit per byte address. */
+  cl_search_bitset_t *valid;
+
+  /**
+   * One bit per CL_SEARCH_PAGE_SIZE page of the bank, set for pages whose
+   * current values may differ from the snapshot, or NULL if any may. When
+   * comparing to nothing, candidates on other pages pass or fail as a whole
+   * without being loaded.
+   */
+  const uint64_t *dirty;
+
+  /** The index of the first bitset word to process. */
+  cl_addr_t word_begin;
+
+  /** The index one past the last bitset word to process. */
+  cl_addr_t word_end;
+
+  /** The size, in bytes, of the bank. Values must fit entirely within it. */
+  cl_addr_t limit;
+
+  /** The value to compare to, already masked to the candidate size. */
+  uint32_t value;
+
+  /** The value to compare to, used when value_type is CL_MEMTYPE_FLOAT. */
+  float value_float;
+
+  /** A comparison type. For example, CLE_CMPTYPE_EQUAL. */
+  uint8_t compare_type;
+
+  /**
+   * The size, in bytes, of each candidate. One of 1, 2 or 4. Candidates are
+   * aligned to their size; bits at other offsets are cleared.
+   */
+  uint8_t size;
+
+  /** The data type of each candidate. For example, CL_MEMTYPE_UINT16. */
+  uint8_t value_type;
+
+  /** Whether to compare to a value, or only previous against current. */
+  bool has_value;
+
+  /** Whether candidates are stored in the opposite byte order of the host. */
+  bool byteswap;
+
+  /** Set by cl_search_kernel_prepare: the resolved comparison. */
+  uint8_t op;
+
+  /** Set by cl_search_kernel_prepare: whether value_float has decimals. */
+  bool value_has_decimal;
+
+  /** Set by cl_search_kernel_prepare: the specialized kernel to run. */
+  const struct cl_search_kernel_t *kernel;
+
+  /** Output: byte offset of the first still valid candidate. */
+  cl_addr_t first;
+
+  /** Output: byte offset of the last still valid candidate. */
+  cl_addr_t last;
+} cl_search_kernel_args_t;
+
+/**
+ * Allocates an empty bitset large enough to hold the given number of
+ * addresses.
+ * @return Whether the allocation succeeded.
+ */
+bool cl_search_bitset_init(cl_search_bitset_t *bitset, cl_addr_t size);
+
+void cl_search_bitset_free(cl_search_bitset_t *bitset);
+
+/**
+ * Sets the bits of every address below "size", or unsets every bit if size is
+ * zero.
+ */
+void cl_search_bitset_fill(cl_search_bitset_t *bitset, cl_addr_t size);
+
+/**
+ * Rebuilds the summary levels of a bitset after its level 0 words were
+ * written to directly.
+ */
+void cl_search_bitset_summarize(cl_search_bitset_t *bitset);
+
+bool cl_search_bitset_test(const cl_search_bitset_t *bitset, cl_addr_t offset);
+void cl_search_bitset_set(cl_search_bitset_t *bitset, cl_addr_t offset);
+void cl_search_bitset_unset(cl_search_bitset_t *bitset, cl_addr_t offset);
+
+/**
+ * Clears the summary bits above a level 0 word that has become zero.
+ */
+void cl_search_bitset_unset_word(cl_search_bitset_t *bitset, cl_addr_t word);
+
+/**
+ * Finds the next set bit at a given level of a bitset, skipping empty words
+ * using the levels above it. No word past the one holding bit "end - 1" is
+ * read at any level, so threads searching disjoint chunks do not race.
+ * @param level The level to search. 0 finds addresses, 1 finds non-zero
+ * level 0 words, and so on.
+ * @param position The bit to start from, inclusive. Set to the bit found.
+ * @param end The bit to stop at, exclusive.
+ * @return Whether a set bit was found.
+ */
+bool cl_search_bitset_find(const cl_search_bitset_t *bitset, unsigned level,
+  cl_addr_t *position, cl_addr_t end);
+
+/**
+ * Resolves the comparison and picks the kernel specialized for the value
+ * size, type, comparison and byte order of a set of arguments. Call once the
+ * other arguments are set, and again whenever any of them change.
+ * Kernels prepare arguments they are given with no kernel set.
+ */
+void cl_search_kernel_prepare(cl_search_kernel_args_t *args);
+
+/**
+ * Returns a function comparing two values under prepared arguments, for
+ * callers that load values themselves.
+ */
+cl_search_compare_t cl_search_kernel_compare(
+  const cl_search_kernel_args_t *args);
+
+/**
+ * Runs the fastest compare kernel the host CPU supports over a set of search
+ * candidates. Vectorized kernels are used for integer values, with a scalar
+ * fallback for floats and unsupported hosts.
+ * @param args The kernel arguments. "first" and "last" are written to.
+ * @return The number of candidates that are still valid.
+ */
+cl_addr_t cl_search_kernel_run(cl_search_kernel_args_t *args);
+
+/**
+ * Runs a compare over a sorted list of candidates instead of a bitset. Only
+ * "current", "limit" and the compare arguments are used.
+ * Candidates that fail are removed from the list, and the rest have their
+ * previous bytes updated to their current ones.
+ * @param args The kernel arguments. "first" and "last" are written to.
+ * @return The number of candidates left at the start of the list.
+ */
+cl_addr_t cl_search_kernel_run_sparse(cl_search_kernel_args_t *args,
+  cl_searchentry_t *entries, cl_addr_t count);
+
+/**
+ * Detects the features of the host CPU and chooses the kernel set to use.
+ * Call from one thread before kernels run on several; until then, only the
+ * scalar kernels are used. cl_search_init calls this.
+ */
+void cl_search_kernel_init(void);
+
+/**
+ * Returns a human-readable name for the kernel set chosen for this host.
+ */
+const char* cl_search_kernel_name(void);
+
+#if CL_TESTS
+/**
+ * Checks every compare kernel the host supports against the per-value
+ * comparison functions, over random candidates.
+ */
+int cl_search_kernel_tests(void);
+#endif
+
+/**
+ * The per-value comparisons used by memory and pointer searches.
+ * "previous" and "current" hold raw values, or IEEE-754 floats for the float
+ * variants.
+ */
+bool compare_to_nothing(uint32_t previous, uint32_t current, uint8_t type);
+bool compare_to_nothing_float(uint32_t previous, uint32_t current,
+  uint8_t type);
+bool compare_to_value(uint32_t previous, uint32_t current, uint8_t type,
+  uint32_t value);
+bool compare_to_value_float(uint32_t previous, uint32_t current, uint8_t type,
+  float value);
+
+#endif
@@ -0,0 +1,471 @@
+#include <stdlib.h>
+
+#include "cl_common.h"
+#include "cl_config.h"
+#include "cl_thread.h"
+
+#if CL_HAVE_THREADS
+
+#if CL_HOST_PLATFORM == CL_PLATFORM_WINDOWS
+#include <windows.h>
+
+typedef HANDLE             cl_thread_handle_t;
+typedef CRITICAL_SECTION   cl_mutex_t;
+typedef CONDITION_VARIABLE cl_cond_t;
+
+#define cl_mutex_init(a)    InitializeCriticalSection(a)
+#define cl_mutex_free(a)    DeleteCriticalSection(a)
+#define cl_mutex_lock(a)    EnterCriticalSection(a)
+#define cl_mutex_unlock(a)  LeaveCriticalSection(a)
+#define cl_cond_init(a)     InitializeConditionVariable(a)
+#define cl_cond_free(a)
+#define cl_cond_wait(a, b)  SleepConditionVariableCS(a, b, INFINITE)
+#define cl_cond_signal(a)   WakeConditionVariable(a)
+#define cl_cond_broadcast(a) WakeAllConditionVariable(a)
+
+typedef SRWLOCK cl_static_mutex_t;
+
+#define CL_STATIC_MUTEX_INIT SRWLOCK_INIT
+#define cl_static_mutex_lock(a)   AcquireSRWLockExclusive(a)
+#define cl_static_mutex_unlock(a) ReleaseSRWLockExclusive(a)
+#else
+#include <pthread.h>
+#include <unistd.h>
+
+typedef pthread_t       cl_thread_handle_t;
+typedef pthread_mutex_t cl_mutex_t;
+typedef pthread_cond_t  cl_cond_t;
+
+#define cl_mutex_init(a)    pthread_mutex_init(a, NULL)
+#define cl_mutex_free(a)    pthread_mutex_destroy(a)
+#define cl_mutex_lock(a)    pthread_mutex_lock(a)
+#define cl_mutex_unlock(a)  pthread_mutex_unlock(a)
+#define cl_cond_init(a)     pthread_cond_init(a, NULL)
+#define cl_cond_free(a)     pthread_cond_destroy(a)
+#define cl_cond_wait(a, b)  pthread_cond_wait(a, b)
+#define cl_cond_signal(a)   pthread_cond_signal(a)
+#define cl_cond_broadcast(a) pthread_cond_broadcast(a)
+
+typedef pthread_mutex_t cl_static_mutex_t;
+
+#define CL_STATIC_MUTEX_INIT PTHREAD_MUTEX_INITIALIZER
+#define cl_static_mutex_lock(a)   pthread_mutex_lock(a)
+#define cl_static_mutex_unlock(a) pthread_mutex_unlock(a)
+#endif
+
+/**
+ * The indices a worker has left to run, packed as the first index in the low
+ * 32 bits and one past the last in the high 32 bits, so both can be swapped
+ * in one atomic operation.
+ */
+typedef struct cl_threadpool_range_t
+{
+  volatile uint64_t value;
+
+  /* Keep each worker's range on its own cache line */
+  uint8_t padding[64 - sizeof(uint64_t)];
+} cl_threadpool_range_t;
+
+typedef struct cl_threadpool_worker_t
+{
+  cl_threadpool_t    *pool;
+  cl_thread_handle_t  handle;
+  unsigned            index;
+} cl_threadpool_worker_t;
+
+struct cl_threadpool_t
+{
+  cl_threadpool_worker_t workers[CL_THREADS_MAX];
+  cl_threadpool_range_t  ranges[CL_THREADS_MAX];
+  unsigned               size;
+
+  cl_mutex_t mutex;
+  cl_cond_t  wake;
+  cl_cond_t  done;
+
+  /* The job being run. Only changed while no worker is running. */
+  cl_threadpool_job_t job;
+  void               *context;
+
+  /* Bumped to wake the workers for a new job */
+  unsigned generation;
+
+  /* The number of started threads that have not finished the current job */
+  unsigned pending;
+
+  bool busy;
+  bool quit;
+};
+
+static cl_threadpool_t *cl_shared_pool = NULL;
+static bool cl_shared_pool_tried = false;
+
+/* Guards the shared pool, which may first be asked for by several threads */
+static cl_static_mutex_t cl_shared_pool_mutex = CL_STATIC_MUTEX_INIT;
+
+static uint64_t cl_atomic_load64(volatile uint64_t *value)
+{
+#ifdef _MSC_VER
+  return (uint64_t)InterlockedCompareExchange64((volatile LONG64*)value, 0, 0);
+#else
+  return __atomic_load_n(value, __ATOMIC_ACQUIRE);
+#endif
+}
+
+static void cl_atomic_store64(volatile uint64_t *value, uint64_t desired)
+{
+#ifdef _MSC_VER
+  InterlockedExchange64((volatile LONG64*)value, (LONG64)desired);
+#else
+  __atomic_store_n(value, desired, __ATOMIC_RELEASE);
+#endif
+}
+
+static bool cl_atomic_cas64(volatile uint64_t *value, uint64_t expected,
+  uint64_t desired)
+{
+#ifdef _MSC_VER
+  return (uint64_t)InterlockedCompareExchange64((volatile LONG64*)value,
+    (LONG64)desired, (LONG64)expected) == expected;
+#else
+  return __atomic_compare_exchange_n(value, &expected, desired, false,
+    __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+#endif
+}
+
+uint32_t cl_atomic_add32(volatile uint32_t *value, uint32_t amount)
+{
+#ifdef _MSC_VER
+  return (uint32_t)InterlockedExchangeAdd((volatile LONG*)value,
+    (LONG)amount) + amount;
+#else
+  return __atomic_add_fetch(value, amount, __ATOMIC_ACQ_REL);
+#endif
+}
+
+uint32_t cl_atomic_load32(volatile uint32_t *value)
+{
+#ifdef _MSC_VER
+  return (uint32_t)InterlockedCompareExchange((volatile LONG*)value, 0, 0);
+#else
+  return __atomic_load_n(value, __ATOMIC_ACQUIRE);
+#endif
+}
+
+#define CL_RANGE(begin, end) ((uint64_t)(begin) | ((uint64_t)(end) << 32))
+#define CL_RANGE_BEGIN(a) ((uint32_t)(a))
+#define CL_RANGE_END(a) ((uint32_t)((a) >> 32))
+
+/**
+ * Takes the next index from the front of a worker's own range.
+ */
+static bool cl_threadpool_take(cl_threadpool_t *pool, unsigned worker,
+  unsigned *index)
+{
+  volatile uint64_t *range = &pool->ranges[worker].value;
+  uint64_t current;
+
+  do
+  {
+    current = cl_atomic_load64(range);
+    if (CL_RANGE_BEGIN(current) >= CL_RANGE_END(current))
+      return false;
+  } while (!cl_atomic_cas64(range, current,
+             CL_RANGE(CL_RANGE_BEGIN(current) + 1, CL_RANGE_END(current))));
+  *index = CL_RANGE_BEGIN(current);
+
+  return true;
+}
+
+/**
+ * Takes the back half of another worker's remaining range. The first index of
+ * it is returned, and the rest becomes the worker's own range.
+ */
+static bool cl_threadpool_steal(cl_threadpool_t *pool, unsigned worker,
+  unsigned *index)
+{
+  unsigned i;
+
+  for (i = 1; i < pool->size; i++)
+  {
+    volatile uint64_t *range = &pool->ranges[(worker + i) % pool->size].value;
+    uint64_t current;
+    uint32_t begin, end, half;
+
+    do
+    {
+      current = cl_atomic_load64(range);
+      begin = CL_RANGE_BEGIN(current);
+      end = CL_RANGE_END(current);
+      if (begin >= end)
+        break;
+      half = (end - begin + 1) / 2;
+    } while (!cl_atomic_cas64(range, current, CL_RANGE(begin, end - half)));
+
+    if (begin < end)
+    {
+      cl_atomic_store64(&pool->ranges[worker].value,
+                        CL_RANGE(end - half + 1, end));
+      *index = end - half;
+
+      return true;
+    }
+  }
+
+  return false;
+}
+
+static void cl_threadpool_work(cl_threadpool_t *pool, unsigned worker)
+{
+  unsigned index;
+
+  while (cl_threadpool_take(pool, worker, &index) ||
+         cl_threadpool_steal(pool, worker, &index))
+    pool->job(pool->context, index, worker);
+}
+
+static void cl_threadpool_loop(cl_threadpool_worker_t *worker)
+{
+  cl_threadpool_t *pool = worker->pool;
+  unsigned generation = 0;
+
+  for (;;)
+  {
+    cl_mutex_lock(&pool->mutex);
+    while (pool->generation == generation && !pool->quit)
+      cl_cond_wait(&pool->wake, &pool->mutex);
+    if (pool->quit)
+    {
+      cl_mutex_unlock(&pool->mutex);
+      break;
+    }
+    generation = pool->generation;
+    cl_mutex_unlock(&pool->mutex);
+
+    cl_threadpool_work(pool, worker->index);
+
+    cl_mutex_lock(&pool->mutex);
+    if (--pool->pending == 0)
+      cl_cond_signal(&pool->done);
+    cl_mutex_unlock(&pool->mutex);
+  }
+}
+
+#if CL_HOST_PLATFORM == CL_PLATFORM_WINDOWS
+static DWORD WINAPI cl_threadpool_entry(LPVOID worker)
+{
+  cl_threadpool_loop((cl_threadpool_worker_t*)worker);
+  return 0;
+}
+#else
+static void* cl_threadpool_entry(void *worker)
+{
+  cl_threadpool_loop((cl_threadpool_worker_t*)worker);
+  return NULL;
+}
+#endif
+
+static unsigned cl_threadpool_cpu_count(void)
+{
+#if CL_HOST_PLATFORM == CL_PLATFORM_WINDOWS
+  SYSTEM_INFO info;
+
+  GetSystemInfo(&info);
+
+  return info.dwNumberOfProcessors;
+#else
+  long count = sysconf(_SC_NPROCESSORS_ONLN);
+
+  return count > 0 ? (unsigned)count : 1;
+#endif
+}
+
+cl_threadpool_t* cl_threadpool_init(unsigned size)
+{
+  cl_threadpool_t *pool;
+  unsigned i;
+
+  if (!size)
+    size = cl_threadpool_cpu_count();
+  if (size > CL_THREADS_MAX)
+    size = CL_THREADS_MAX;
+
+  pool = (cl_threadpool_t*)calloc(1, sizeof(cl_threadpool_t));
+  if (!pool)
+    return NULL;
+  cl_mutex_init(&pool->mutex);
+  cl_cond_init(&pool->wake);
+  cl_cond_init(&pool->done);
+  pool->size = 1;
+
+  /* Worker 0 is whichever thread calls cl_threadpool_run */
+  for (i = 1; i < size; i++)
+  {
+    cl_threadpool_worker_t *worker = &pool->workers[i];
+
+    worker->pool = pool;
+    worker->index = i;
+#if CL_HOST_PLATFORM == CL_PLATFORM_WINDOWS
+    worker->handle = CreateThread(NULL, 0, cl_threadpool_entry, worker, 0,
+                                  NULL);
+    if (!worker->handle)
+      break;
+#else
+    if (pthread_create(&worker->handle, NULL, cl_threadpool_entry, worker))
+      break;
+#endif
+    pool->size++;
+  }
+
+  return pool;
+}
+
+void cl_threadpool_free(cl_threadpool_t *pool)
+{
+  unsigned i;
+
+  if (!pool)
+    return;
+
+  cl_mutex_lock(&pool->mutex);
+  pool->quit = true;
+  cl_cond_broadcast(&pool->wake);
+  cl_mutex_unlock(&pool->mutex);
+
+  for (i = 1; i < pool->size; i++)
+  {
+#if CL_HOST_PLATFORM == CL_PLATFORM_WINDOWS
+    WaitForSingleObject(pool->workers[i].handle, INFINITE);
+    CloseHandle(pool->workers[i].handle);
+#else
+    pthread_join(pool->workers[i].handle, NULL);
+#endif
+  }
+  cl_cond_free(&pool->done);
+  cl_cond_free(&pool->wake);
+  cl_mutex_free(&pool->mutex);
+  free(pool);
+}
+
+cl_threadpool_t* cl_threadpool_shared(void)
+{
+  cl_threadpool_t *pool;
+
+  cl_static_mutex_lock(&cl_shared_pool_mutex);
+  if (!cl_shared_pool_tried)
+  {
+    cl_shared_pool = cl_threadpool_init(0);
+    cl_shared_pool_tried = true;
+  }
+  pool = cl_shared_pool;
+  cl_static_mutex_unlock(&cl_shared_pool_mutex);
+
+  return pool;
+}
+
+void cl_threadpool_shared_free(void)
+{
+  cl_static_mutex_lock(&cl_shared_pool_mutex);
+  cl_threadpool_free(cl_shared_pool);
+  cl_shared_pool = NULL;
+  cl_shared_pool_tried = false;
+  cl_static_mutex_unlock(&cl_shared_pool_mutex);
+}
+
+unsigned cl_threadpool_size(const cl_threadpool_t *pool)
+{
+  return pool ? pool->size : 1;
+}
+
+void cl_threadpool_run(cl_threadpool_t *pool, cl_threadpool_job_t job,
+  void *context, unsigned count)
+{
+  unsigned i;
+
+  if (pool && pool->size > 1 && count > 1)
+  {
+    cl_mutex_lock(&pool->mutex);
+    if (!pool->busy)
+    {
+      pool->busy = true;
+      pool->job = job;
+      pool->context = context;
+
+      /* Split the indices evenly to start with */
+      for (i = 0; i < pool->size; i++)
+        cl_atomic_store64(&pool->ranges[i].value,
+          CL_RANGE((uint64_t)count * i / pool->size,
+                   (uint64_t)count * (i + 1) / pool->size));
+      pool->pending = pool->size - 1;
+      pool->generation++;
+      cl_cond_broadcast(&pool->wake);
+      cl_mutex_unlock(&pool->mutex);
+
+      cl_threadpool_work(pool, 0);
+
+      cl_mutex_lock(&pool->mutex);
+      while (pool->pending)
+        cl_cond_wait(&pool->done, &pool->mutex);
+      pool->busy = false;
+      cl_mutex_unlock(&pool->mutex);
+
+      return;
+    }
+    cl_mutex_unlock(&pool->mutex);
+  }
+
+  /* No pool, or it is in use; run everything here */
+  for (i = 0; i < count; i++)
+    job(context, i, 0);
+}
+
+#else
+
+cl_threadpool_t* cl_threadpool_init(unsigned size)
+{
+  CL_UNUSED(size);
+  return NULL;
+}
+
+void cl_threadpool_free(cl_threadpool_t *pool)
+{
+  CL_UNUSED(pool);
+}
+
+cl_threadpool_t* cl_threadpool_shared(void)
+{
+  return NULL;
+}
+
+void cl_threadpool_shared_free(void)
+{
+}
+
+unsigned cl_threadpool_size(const cl_threadpool_t *pool)
+{
+  CL_UNUSED(pool);
+  return 1;
+}
+
+uint32_t cl_atomic_add32(volatile uint32_t *value, uint32_t amount)
+{
+  *value += amount;
+  return *value;
+}
+
+uint32_t cl_atomic_load32(volatile uint32_t *value)
+{
+  return *value;
+}
+
+void cl_threadpool_run(cl_threadpool_t *pool, cl_threadpool_job_t job,
+  void *context, unsigned count)
+{
+  unsigned i;
+
+  CL_UNUSED(pool);
+  for (i = 0; i < count; i++)
+    job(context, i, 0);
+}
+
+#endif
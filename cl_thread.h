@@ -0,0 +1,75 @@
+#ifndef CL_THREAD_H
+#define CL_THREAD_H
+
+#include "cl_types.h"
+
+/**
+ * The most threads a pool will use, including the thread calling into it.
+ */
+#define CL_THREADS_MAX 64
+
+/**
+ * A job run over a range of indices by a thread pool.
+ * @param context The context pointer given to cl_threadpool_run.
+ * @param index The index of the item to process.
+ * @param worker Which thread is running the item, from 0 to the pool size.
+ * Items run by the same worker never run at the same time, so this can be used
+ * to index per-thread buffers.
+ */
+typedef void (*cl_threadpool_job_t)(void *context, unsigned index,
+  unsigned worker);
+
+typedef struct cl_threadpool_t cl_threadpool_t;
+
+/**
+ * Creates a thread pool. The thread calling cl_threadpool_run always takes
+ * part, so "size - 1" threads are started.
+ * @param size The number of threads to use, or 0 to use one per CPU.
+ * @return The new pool, or NULL if threads are unavailable.
+ */
+cl_threadpool_t* cl_threadpool_init(unsigned size);
+
+/**
+ * Stops and joins the threads of a pool, then frees it.
+ */
+void cl_threadpool_free(cl_threadpool_t *pool);
+
+/**
+ * Returns the pool shared by search functions, creating it on first use. Safe
+ * to call from any thread. Returns NULL if threads are unavailable.
+ */
+cl_threadpool_t* cl_threadpool_shared(void);
+
+/**
+ * Frees the pool returned by cl_threadpool_shared, if one was created.
+ */
+void cl_threadpool_shared_free(void);
+
+/**
+ * Returns the number of threads a job can be spread over, or 1 for a NULL
+ * pool.
+ */
+unsigned cl_threadpool_size(const cl_threadpool_t *pool);
+
+/**
+ * Atomically adds to a value shared between threads.
+ * @return The new value.
+ */
+uint32_t cl_atomic_add32(volatile uint32_t *value, uint32_t amount);
+
+/**
+ * Atomically reads a value shared between threads.
+ */
+uint32_t cl_atomic_load32(volatile uint32_t *value);
+
+/**
+ * Runs a job once for every index in [0, count) and waits for all of them to
+ * finish. Indices start evenly split between the threads, and a thread that
+ * runs out takes half of the remaining indices of another.
+ * If the pool is NULL or already running a job, the indices are run in order
+ * on the calling thread.
+ */
+void cl_threadpool_run(cl_threadpool_t *pool, cl_threadpool_job_t job,
+  void *context, unsigned count);
+
+#endif
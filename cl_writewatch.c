@@ -0,0 +1,460 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include "cl_writewatch.h"
+
+#if CL_HOST_PLATFORM == CL_PLATFORM_LINUX
+#include <sched.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "cl_common.h"
+#include "cl_memory.h"
+
+/**
+ * The whole pages of one watched region.
+ **/
+typedef struct cl_writewatch_range_t
+{
+  const cl_memory_region_t *region;
+
+  /* The first whole page inside the region, and one past the last */
+  uintptr_t begin;
+  uintptr_t end;
+
+  /* One bit per page, set by the fault handler once the page is written */
+  uint64_t *written;
+
+  /* The generation of the collection each page was last found written on */
+  unsigned *generations;
+} cl_writewatch_range_t;
+
+typedef struct cl_writewatch_t
+{
+  cl_writewatch_range_t *ranges;
+  unsigned               range_count;
+  unsigned               users;
+
+  /* Incremented on every collection */
+  unsigned generation;
+
+  /* The number of fault handlers running, so ranges are not freed under one */
+  unsigned handlers;
+
+  uintptr_t        page_size;
+  struct sigaction previous;
+} cl_writewatch_t;
+
+static cl_writewatch_t cl_writewatch;
+
+static void cl_writewatch_chain(int signal, siginfo_t *info, void *context)
+{
+  const struct sigaction *previous = &cl_writewatch.previous;
+
+  if (previous->sa_flags & SA_SIGINFO)
+    previous->sa_sigaction(signal, info, context);
+  else if (previous->sa_handler != SIG_DFL && previous->sa_handler != SIG_IGN)
+    previous->sa_handler(signal);
+  else
+    /* Fault again with the default action */
+    sigaction(SIGSEGV, previous, NULL);
+}
+
+static void cl_writewatch_handler(int signal, siginfo_t *info, void *context)
+{
+  const uintptr_t address = (uintptr_t)info->si_addr;
+  const uintptr_t page_size = cl_writewatch.page_size;
+  unsigned count;
+  bool     ours = false;
+  unsigned i;
+
+  __atomic_add_fetch(&cl_writewatch.handlers, 1, __ATOMIC_SEQ_CST);
+  count = __atomic_load_n(&cl_writewatch.range_count, __ATOMIC_SEQ_CST);
+
+  /* Regions can share memory, so mark the page in every range holding it */
+  for (i = 0; i < count && info->si_code == SEGV_ACCERR; i++)
+  {
+    cl_writewatch_range_t *range = &cl_writewatch.ranges[i];
+    uintptr_t page;
+
+    if (address < range->begin || address >= range->end)
+      continue;
+    page = (address - range->begin) / page_size;
+
+    /* Unprotect before marking, so a collection that takes the mark always
+       protects the page after it was unprotected */
+    if (!ours && mprotect((void*)(range->begin + page * page_size),
+                          page_size, PROT_READ | PROT_WRITE))
+      break;
+    __atomic_fetch_or(&range->written[page / 64], 1ULL << (page % 64),
+                      __ATOMIC_ACQ_REL);
+    ours = true;
+  }
+
+  /* While stopping, the page may already be writable again, so retry */
+  if (!ours && count)
+    cl_writewatch_chain(signal, info, context);
+  __atomic_sub_fetch(&cl_writewatch.handlers, 1, __ATOMIC_SEQ_CST);
+}
+
+static void cl_writewatch_free_ranges(void)
+{
+  unsigned i;
+
+  for (i = 0; i < cl_writewatch.range_count; i++)
+  {
+    free(cl_writewatch.ranges[i].written);
+    free(cl_writewatch.ranges[i].generations);
+  }
+  free(cl_writewatch.ranges);
+  cl_writewatch.ranges = NULL;
+  cl_writewatch.range_count = 0;
+}
+
+/**
+ * Adds a range for the whole pages of a region, if it has any.
+ * @return Whether the region could be watched, or had nothing to watch.
+ **/
+static bool cl_writewatch_add(const cl_memory_region_t *region)
+{
+  const uintptr_t page_size = cl_writewatch.page_size;
+  const uintptr_t base = (uintptr_t)region->base_host;
+  cl_writewatch_range_t *range;
+  uintptr_t pages;
+
+  if (!region->base_host || !region->flags.bits.write ||
+      (base + region->size) / page_size <= (base + page_size - 1) / page_size)
+    return true;
+
+  range = &cl_writewatch.ranges[cl_writewatch.range_count];
+  range->region = region;
+  range->begin = (base + page_size - 1) / page_size * page_size;
+  range->end = (base + region->size) / page_size * page_size;
+  pages = (range->end - range->begin) / page_size;
+  range->written = (uint64_t*)calloc((pages + 63) / 64, sizeof(uint64_t));
+  range->generations = (unsigned*)calloc(pages, sizeof(unsigned));
+  if (!range->written || !range->generations ||
+      mprotect((void*)range->begin, range->end - range->begin, PROT_READ))
+  {
+    free(range->written);
+    free(range->generations);
+    return false;
+  }
+  __atomic_store_n(&cl_writewatch.range_count, cl_writewatch.range_count + 1,
+                   __ATOMIC_SEQ_CST);
+
+  return true;
+}
+
+bool cl_writewatch_start(void)
+{
+  struct sigaction action;
+  unsigned i;
+
+  if (cl_writewatch.users)
+  {
+    cl_writewatch.users++;
+    return true;
+  }
+  cl_writewatch.page_size = (uintptr_t)sysconf(_SC_PAGESIZE);
+  cl_writewatch.ranges = (cl_writewatch_range_t*)calloc(
+    memory.region_count + 1, sizeof(cl_writewatch_range_t));
+  if (!cl_writewatch.ranges)
+    return false;
+
+  memset(&action, 0, sizeof(action));
+  action.sa_sigaction = cl_writewatch_handler;
+  action.sa_flags = SA_SIGINFO | SA_RESTART;
+  sigemptyset(&action.sa_mask);
+  if (sigaction(SIGSEGV, &action, &cl_writewatch.previous))
+  {
+    cl_writewatch_free_ranges();
+    return false;
+  }
+
+  /* Handlers only look at ranges once they are counted */
+  for (i = 0; i < memory.region_count; i++)
+  {
+    if (!cl_writewatch_add(&memory.regions[i]))
+    {
+      cl_writewatch.users = 1;
+      cl_writewatch_stop();
+      return false;
+    }
+  }
+  cl_writewatch.users = 1;
+
+  return true;
+}
+
+void cl_writewatch_stop(void)
+{
+  cl_writewatch_range_t *ranges = cl_writewatch.ranges;
+  unsigned count = cl_writewatch.range_count;
+  unsigned i;
+
+  if (!cl_writewatch.users || --cl_writewatch.users)
+    return;
+
+  /* Let writes through, then wait for any handler still looking at ranges */
+  for (i = 0; i < count; i++)
+    mprotect((void*)ranges[i].begin, ranges[i].end - ranges[i].begin,
+             PROT_READ | PROT_WRITE);
+  __atomic_store_n(&cl_writewatch.range_count, 0, __ATOMIC_SEQ_CST);
+  while (__atomic_load_n(&cl_writewatch.handlers, __ATOMIC_SEQ_CST))
+    sched_yield();
+  sigaction(SIGSEGV, &cl_writewatch.previous, NULL);
+
+  cl_writewatch.range_count = count;
+  cl_writewatch_free_ranges();
+}
+
+/**
+ * Takes the marks of a range's written pages and protects them again,
+ * stamping them with the current generation.
+ **/
+static void cl_writewatch_reprotect(cl_writewatch_range_t *range)
+{
+  const uintptr_t page_size = cl_writewatch.page_size;
+  const uintptr_t pages = (range->end - range->begin) / page_size;
+  uintptr_t run_begin = 0, run_end = 0;
+  uintptr_t word;
+
+  for (word = 0; word < (pages + 63) / 64; word++)
+  {
+    uint64_t bits;
+
+    if (!__atomic_load_n(&range->written[word], __ATOMIC_ACQUIRE))
+      continue;
+    bits = __atomic_exchange_n(&range->written[word], 0, __ATOMIC_ACQ_REL);
+    while (bits)
+    {
+      uintptr_t page = word * 64 + cl_ctz64(bits);
+
+      bits &= bits - 1;
+      range->generations[page] = cl_writewatch.generation;
+
+      /* Protect neighbouring pages with one call */
+      if (page != run_end)
+      {
+        if (run_end > run_begin)
+          mprotect((void*)(range->begin + run_begin * page_size),
+                   (run_end - run_begin) * page_size, PROT_READ);
+        run_begin = page;
+      }
+      run_end = page + 1;
+    }
+  }
+  if (run_end > run_begin)
+    mprotect((void*)(range->begin + run_begin * page_size),
+             (run_end - run_begin) * page_size, PROT_READ);
+}
+
+/**
+ * Returns whether a page of a search bank may have been written since the
+ * bank was last collected.
+ **/
+static bool cl_writewatch_page_dirty(const cl_writewatch_range_t *range,
+  const cl_searchbank_t *sbank, cl_addr_t search_page)
+{
+  const uintptr_t page_size = cl_writewatch.page_size;
+  uintptr_t first = (uintptr_t)sbank->region->base_host +
+                    search_page * CL_SEARCH_PAGE_SIZE;
+  uintptr_t last = first + CL_SEARCH_PAGE_SIZE - 1;
+  uintptr_t page;
+
+  /* Partial pages at the ends of the region are never protected */
+  if (first < range->begin || last >= range->end)
+    return true;
+  for (page = (first - range->begin) / page_size;
+       page <= (last - range->begin) / page_size; page++)
+    if (range->generations[page] > sbank->copy_generation)
+      return true;
+
+  return false;
+}
+
+bool cl_writewatch_collect(cl_search_t *search)
+{
+  unsigned i;
+
+  if (!cl_writewatch.users || !search)
+    return false;
+
+  cl_writewatch.generation++;
+  for (i = 0; i < cl_writewatch.range_count; i++)
+    cl_writewatch_reprotect(&cl_writewatch.ranges[i]);
+
+  for (i = 0; i < search->searchbank_count; i++)
+  {
+    cl_searchbank_t *sbank = &search->searchbanks[i];
+    const cl_writewatch_range_t *range = NULL;
+    cl_addr_t pages, page;
+    unsigned j;
+
+    for (j = 0; j < cl_writewatch.range_count && !range; j++)
+      if (cl_writewatch.ranges[j].region == sbank->region)
+        range = &cl_writewatch.ranges[j];
+    pages = (sbank->region->size + CL_SEARCH_PAGE_SIZE - 1) /
+            CL_SEARCH_PAGE_SIZE;
+    if (range && !sbank->dirty)
+      sbank->dirty = (uint64_t*)malloc((pages + 63) / 64 * sizeof(uint64_t));
+    if (!range || !sbank->dirty)
+    {
+      /* Every page may have changed */
+      free(sbank->dirty);
+      sbank->dirty = NULL;
+      continue;
+    }
+
+    memset(sbank->dirty, 0, (pages + 63) / 64 * sizeof(uint64_t));
+    for (page = 0; page < pages; page++)
+      if (cl_writewatch_page_dirty(range, sbank, page))
+        sbank->dirty[page / 64] |= 1ULL << (page % 64);
+    sbank->copy_generation = cl_writewatch.generation;
+  }
+
+  return true;
+}
+
+#if CL_TESTS
+#include <pthread.h>
+
+#define CL_WRITEWATCH_TEST_PAGES 64
+#define CL_WRITEWATCH_TEST_ROUNDS 200
+
+typedef struct cl_writewatch_test_t
+{
+  uint8_t *data;
+  unsigned seed;
+
+  /* The round the core should write in, and the last round it finished */
+  unsigned go;
+  unsigned done;
+  bool     quit;
+} cl_writewatch_test_t;
+
+/**
+ * Stands in for an emulator core: writes to random pages of the region once
+ * per round, from its own thread.
+ **/
+static void* cl_writewatch_test_core(void *context)
+{
+  cl_writewatch_test_t *test = (cl_writewatch_test_t*)context;
+  unsigned done = 0;
+  unsigned go;
+  unsigned i;
+
+  for (;;)
+  {
+    while ((go = __atomic_load_n(&test->go, __ATOMIC_ACQUIRE)) == done &&
+           !__atomic_load_n(&test->quit, __ATOMIC_ACQUIRE))
+      sched_yield();
+    if (__atomic_load_n(&test->quit, __ATOMIC_ACQUIRE))
+      return NULL;
+    for (i = 0; i < 64; i++)
+    {
+      test->data[rand_r(&test->seed) % (CL_WRITEWATCH_TEST_PAGES * 4096)]++;
+      if (i % 8 == 0)
+        sched_yield();
+    }
+    done = go;
+    __atomic_store_n(&test->done, done, __ATOMIC_RELEASE);
+  }
+}
+
+int cl_writewatch_tests(void)
+{
+  const size_t size = CL_WRITEWATCH_TEST_PAGES * 4096;
+  cl_memory_region_t *regions = memory.regions;
+  unsigned region_count = memory.region_count;
+  cl_memory_region_t region;
+  cl_writewatch_test_t test;
+  cl_searchbank_t bank;
+  cl_search_t search;
+  uint8_t  *snapshot;
+  uint64_t  dirty = 0;
+  pthread_t thread;
+  unsigned  i, j;
+  int       result = 0;
+
+  memset(&region, 0, sizeof(region));
+  region.base_host = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  region.size = size;
+  region.flags.bits.read = 1;
+  region.flags.bits.write = 1;
+  snapshot = (uint8_t*)malloc(size);
+  if (region.base_host == MAP_FAILED || !snapshot)
+    return 0;
+
+  memset(&bank, 0, sizeof(bank));
+  memset(&search, 0, sizeof(search));
+  bank.region = &region;
+  search.searchbanks = &bank;
+  search.searchbank_count = 1;
+  memory.regions = &region;
+  memory.region_count = 1;
+  if (!cl_writewatch_start())
+    CL_TEST_FAIL(1);
+  cl_writewatch_collect(&search);
+  memcpy(snapshot, region.base_host, size);
+
+  memset(&test, 0, sizeof(test));
+  test.data = (uint8_t*)region.base_host;
+  test.seed = 1;
+  if (pthread_create(&thread, NULL, cl_writewatch_test_core, &test))
+    CL_TEST_FAIL(2);
+
+  for (i = 0; i < CL_WRITEWATCH_TEST_ROUNDS && !result; i++)
+  {
+    /* Collect while the core is writing, as search steps would */
+    __atomic_store_n(&test.go, i + 1, __ATOMIC_RELEASE);
+    do
+    {
+      cl_writewatch_collect(&search);
+      dirty |= bank.dirty ? bank.dirty[0] : ~0ULL;
+      sched_yield();
+    } while (__atomic_load_n(&test.done, __ATOMIC_ACQUIRE) != i + 1);
+    cl_writewatch_collect(&search);
+    dirty |= bank.dirty ? bank.dirty[0] : ~0ULL;
+
+    /* Every page that changed since the last check must have been reported */
+    for (j = 0; j < CL_WRITEWATCH_TEST_PAGES; j++)
+      if (memcmp(&snapshot[j * 4096], &test.data[j * 4096], 4096) &&
+          !((dirty >> j) & 1))
+        result = 3;
+    memcpy(snapshot, test.data, size);
+    dirty = 0;
+  }
+  __atomic_store_n(&test.quit, true, __ATOMIC_RELEASE);
+  pthread_join(thread, NULL);
+
+  /* Pages not written to since the last collection are clean */
+  cl_writewatch_collect(&search);
+  if (!result && (!bank.dirty || bank.dirty[0]))
+    result = 4;
+  test.data[4096 * 5] = 1;
+  cl_writewatch_collect(&search);
+  if (!result && bank.dirty[0] != 1ULL << 5)
+    result = 5;
+
+  cl_writewatch_stop();
+  test.data[0] = 1;
+  free(bank.dirty);
+  free(snapshot);
+  munmap(region.base_host, size);
+  memory.regions = regions;
+  memory.region_count = region_count;
+  if (result)
+    CL_TEST_FAIL(result);
+
+  return 1;
+}
+#endif
+
+#endif
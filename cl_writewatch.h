@@ -0,0 +1,60 @@
+#ifndef CL_WRITEWATCH_H
+#define CL_WRITEWATCH_H
+
+#include "cl_config.h"
+#include "cl_search.h"
+
+/**
+ * @file cl_writewatch.h
+ * Tracks which pages of local memory regions are written to, so memory
+ * searches only need to look at those. The pages of each watched region are
+ * write-protected; the first write to one raises a fault, which marks the
+ * page and lifts the protection. Collecting the marks protects the pages
+ * again.
+ *
+ * Only pages that lie entirely within a region are protected. The partial
+ * pages at either end of a region are always reported as written.
+ */
+
+/**
+ * Whether memory searches use write tracking. See CL_SEARCH_WRITE_TRACKING.
+ */
+#define CL_WRITEWATCH (CL_SEARCH_WRITE_TRACKING && !CL_EXTERNAL_MEMORY && \
+  CL_HOST_PLATFORM == CL_PLATFORM_LINUX)
+
+#if CL_HOST_PLATFORM == CL_PLATFORM_LINUX
+
+/**
+ * Starts watching the writable regions of the global memory context, or adds
+ * a user to the watch already running. The regions must not change until the
+ * last user stops.
+ * @return Whether the watch is running.
+ **/
+bool cl_writewatch_start(void);
+
+/**
+ * Removes a user of the watch, and stops it once there are none left,
+ * restoring the protection of every watched page.
+ **/
+void cl_writewatch_stop(void);
+
+/**
+ * Protects the pages written to since the last collection again, then sets
+ * the "dirty" map of each bank of a search to the pages written to since that
+ * bank was last collected. Banks of regions not being watched have their map
+ * removed. Should only be called from one thread at a time.
+ * @return Whether the watch is running.
+ **/
+bool cl_writewatch_collect(cl_search_t *search);
+
+#if CL_TESTS
+/**
+ * Watches a region while another thread writes to it, checking that no
+ * written page is ever missed.
+ **/
+int cl_writewatch_tests(void);
+#endif
+
+#endif
+
+#endif
@@ -37,7 +37,7 @@ CleActionBlockCtrBinary::CleActionBlockCtrBinary(uint8_t type, QWidget* parent)
   /* TODO: Have this refresh when the combobox is clicked */
   m_ModifierValueComboBox = new QComboBox(this);
   for (int i = 0; i < memory.note_count; i++)
-    m_ModifierValueComboBox->addItem(memory.notes[i].title);
+    m_ModifierValueComboBox->addItem(memory.note_meta[i].title);
 
   /* Right operand value stacker */
   m_ModifierStack = new QStackedWidget(this);
@@ -311,7 +311,7 @@ void CleMemoryInspector::requestAddMemoryNote(cl_addr_t address)
 {
    cl_memnote_t note;
 
-   note.address         = address;
+   note.address_initial = address;
    note.type            = getCurrentSizeType();
    note.pointer_offsets = NULL;
    note.pointer_passes  = 0;
@@ -332,7 +332,7 @@ void CleMemoryInspector::requestPointerSearch(cl_addr_t address)
          getCurrentSizeType(),
          3,
          0x10000,
-         100000
+         1000
       );
 
       m_TabCount++;
@@ -20,7 +20,7 @@ CleMemoryNoteSubmit::CleMemoryNoteSubmit(cl_memnote_t note)
 
    m_Footer = new QLabel(this);
    snprintf(footer_text, sizeof(footer_text), "0x%08X - %u pointer passes",
-      note.address, note.pointer_passes);
+      note.address_initial, note.pointer_passes);
    m_Footer->setText(footer_text);
 
    Layout->addWidget(m_Title,        0, 0, 1, 2);
@@ -71,7 +71,7 @@ void CleMemoryNoteSubmit::onClickSubmit(void)
       snprintf(post_data, sizeof(post_data), 
          "game_id=%u&address=%u&type=%u&offsets=%s&title=%s%s%s",
          session.game_id,
-         m_MemoryNote.address,
+         m_MemoryNote.address_initial,
          m_MemoryNote.type,
          pointer_data,
          title,
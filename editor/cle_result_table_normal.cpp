@@ -85,7 +85,7 @@ void CleResultTableNormal::onClickResultAddMemoryNote()
 {
    cl_memnote_t note;
 
-   note.address         = getClickedResultAddress();
+   note.address_initial = getClickedResultAddress();
    note.type            = m_Search.params.value_type;
    note.pointer_offsets = NULL;
    note.pointer_passes  = 0;
@@ -141,7 +141,8 @@ void CleResultTableNormal::rebuild()
 {
    char     temp_string[32];
    uint8_t  size, val_type;
-   uint32_t current_row, matches, temp_value, i, j;
+   uint32_t current_row, matches, temp_value, i;
+   cl_addr_t j;
 
    /* (De)allocate rows */
    matches = m_Search.matches;
@@ -162,12 +163,9 @@ void CleResultTableNormal::rebuild()
       if (!m_Search.searchbanks[i].any_valid)
          continue;
 
-      for (j = 0; j < memory.regions[i].size; j += size)
+      /* Jump straight from one valid value to the next */
+      for (j = 0; cl_searchbank_next_valid(&m_Search.searchbanks[i], &j); j++)
       {
-         /* This value was filtered out */
-         if (!m_Search.searchbanks[i].valid[j])
-            continue;
-
          /* This value is still valid; add a new row */
          m_Table->insertRow(current_row);
 
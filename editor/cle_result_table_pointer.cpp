@@ -1,11 +1,73 @@
 #include <QMenu>
+#include <QMessageBox>
 #include <QScrollBar>
 
 #include "cle_result_table_pointer.h"
 #include "cle_common.h"
 
+extern "C"
+{
+   #include "../cl_frontend.h"
+}
+
+/*
+   Builds a pointer search, or runs its first step, away from the Qt event
+   loop.
+*/
+class ClePointerSearchThread : public QThread
+{
+public:
+   ClePointerSearchThread(cl_pointersearch_t *search, uint32_t address,
+      uint8_t size, uint8_t passes, uint32_t range, uint32_t page_size)
+   {
+      m_Search     = search;
+      m_Address    = address;
+      m_Size       = size;
+      m_Passes     = passes;
+      m_Range      = range;
+      m_PageSize   = page_size;
+      m_Step       = false;
+      m_StepValue  = NULL;
+   }
+
+   /*
+      Steps a search, comparing to "value" if it is not NULL.
+   */
+   ClePointerSearchThread(cl_pointersearch_t *search, void *value)
+   {
+      m_Search     = search;
+      m_Address    = 0;
+      m_Size       = 0;
+      m_Passes     = 0;
+      m_Range      = 0;
+      m_PageSize   = 0;
+      m_Step       = true;
+      m_StepValue  = value;
+   }
+
+protected:
+   void run() override
+   {
+      if (m_Step)
+         cl_pointersearch_step(m_Search, m_StepValue);
+      else
+         cl_pointersearch_init(m_Search, m_Address, m_Size, m_Passes, m_Range,
+            m_PageSize);
+   }
+
+private:
+   cl_pointersearch_t *m_Search;
+   uint32_t m_Address;
+   uint8_t  m_Size;
+   uint8_t  m_Passes;
+   uint32_t m_Range;
+   uint32_t m_PageSize;
+   bool     m_Step;
+   void    *m_StepValue;
+};
+
 CleResultTablePointer::CleResultTablePointer(QWidget *parent, uint32_t address,
-   uint8_t size, uint8_t passes, uint32_t range, uint32_t max_results)
+   uint8_t size, uint8_t passes, uint32_t range, uint32_t page_size)
 {
    char offset_str[16];
    uint8_t i;
@@ -38,15 +100,130 @@ CleResultTablePointer::CleResultTablePointer(QWidget *parent, uint32_t address,
    connect(this, SIGNAL(requestPointerSearch(cl_addr_t)),
       parent, SLOT(requestPointerSearch(cl_addr_t)));
 
-   cl_pointersearch_init(&m_Search, address, size, passes, range, max_results);
-   rebuild();
+   /* Run the search on another thread, showing its progress until done */
+   memset(&m_Search, 0, sizeof(m_Search));
+   m_Search.progress      = onSearchProgress;
+   m_Search.progress_data = this;
+   m_PageSize = page_size;
+   m_Stepping = false;
+
+   m_ProgressTimer = new QTimer(this);
+   connect(m_ProgressTimer, SIGNAL(timeout()),
+      this, SLOT(onSearchProgressTimer()));
+
+   startSearchThread(new ClePointerSearchThread(&m_Search, address, size,
+      passes, range, page_size), tr("Mapping pointers..."), parent);
+
+   /* Produce more chains as the user scrolls to the bottom of the table */
+   connect(m_Table->verticalScrollBar(), SIGNAL(valueChanged(int)),
+      this, SLOT(onScrollResults(int)));
 }
 
 CleResultTablePointer::~CleResultTablePointer()
 {
+   if (m_SearchThread)
+   {
+      m_Cancelled.storeRelease(1);
+      m_SearchThread->wait();
+      delete m_SearchThread;
+   }
+   if (m_Stepping)
+      cl_fe_unpause();
+   delete m_ProgressDialog;
    cl_pointersearch_free(&m_Search);
 }
 
+bool CleResultTablePointer::onSearchProgress(void *data, unsigned pass,
+   uint32_t done, uint32_t total)
+{
+   CleResultTablePointer *table = (CleResultTablePointer*)data;
+
+   table->m_ProgressPass.storeRelease(pass);
+   table->m_ProgressDone.storeRelease(done);
+   table->m_ProgressTotal.storeRelease(total);
+
+   return !table->m_Cancelled.loadAcquire();
+}
+
+void CleResultTablePointer::startSearchThread(QThread *thread,
+   const QString& label, QWidget *parent)
+{
+   m_Ready = false;
+   m_Cancelled.storeRelease(0);
+   m_ProgressDone.storeRelease(0);
+   m_ProgressTotal.storeRelease(0);
+
+   m_ProgressDialog = new QProgressDialog(label, tr("Cancel"), 0, 100,
+      parent);
+   m_ProgressDialog->setWindowTitle(tr("Pointer search"));
+   m_ProgressDialog->setMinimumDuration(500);
+   connect(m_ProgressDialog, SIGNAL(canceled()),
+      this, SLOT(onSearchCancelled()));
+   m_ProgressTimer->start(100);
+
+   m_SearchThread = thread;
+   connect(m_SearchThread, SIGNAL(finished()),
+      this, SLOT(onSearchFinished()));
+   m_SearchThread->start();
+}
+
+void CleResultTablePointer::onSearchCancelled()
+{
+   m_Cancelled.storeRelease(1);
+}
+
+void CleResultTablePointer::onSearchFinished()
+{
+   m_ProgressTimer->stop();
+   if (m_ProgressDialog)
+   {
+      m_ProgressDialog->deleteLater();
+      m_ProgressDialog = NULL;
+   }
+   if (m_SearchThread)
+   {
+      m_SearchThread->deleteLater();
+      m_SearchThread = NULL;
+   }
+   m_Ready = true;
+   if (m_Stepping)
+   {
+      m_Stepping = false;
+      cl_fe_unpause();
+
+      /* A step that was not cancelled leaves the search streaming only if it
+         ran out of memory */
+      if (m_Search.streaming && !m_Cancelled.loadAcquire())
+         QMessageBox::warning(this, tr("Pointer search"),
+            tr("There is not enough memory to compare every pointer chain. "
+               "The results were left as they were."));
+   }
+   rebuild();
+}
+
+void CleResultTablePointer::onSearchProgressTimer()
+{
+   int done  = m_ProgressDone.loadAcquire();
+   int total = m_ProgressTotal.loadAcquire();
+
+   /* Each stage reports its own total, so only the current one is shown */
+   if (!m_ProgressDialog || m_Cancelled.loadAcquire())
+      return;
+   m_ProgressDialog->setValue(total ? done * 100 / total : 0);
+}
+
+void CleResultTablePointer::onScrollResults(int value)
+{
+   uint32_t added;
+
+   if (!m_Ready || value < m_Table->verticalScrollBar()->maximum())
+      return;
+   else if (!cl_pointersearch_has_more(&m_Search))
+      return;
+   added = cl_pointersearch_more(&m_Search, m_PageSize);
+   appendRows(m_Search.result_count - added);
+}
+
 cl_addr_t CleResultTablePointer::getClickedResultAddress()
 {
    return m_Search.results[m_Table->currentRow()].address_final;
@@ -61,7 +238,7 @@ void CleResultTablePointer::onClickResultAddMemoryNote()
 {
    cl_memnote_t note;
 
-   note.address         = m_Search.results[m_ClickedResult].address_initial;
+   note.address_initial = m_Search.results[m_ClickedResult].address_initial;
    note.type            = m_Search.params.value_type;
    note.pointer_offsets = m_Search.results[m_ClickedResult].offsets;
    note.pointer_passes  = m_Search.passes;
@@ -132,26 +309,23 @@ void CleResultTablePointer::onResultEdited(QTableWidgetItem *item)
    }
 }
 
-void CleResultTablePointer::rebuild()
+void CleResultTablePointer::appendRows(uint32_t first)
 {
    char     temp_string[32];
    uint8_t  size;
-   uint32_t current_row, temp_value, i, j;
+   uint32_t i, j;
 
    size = m_Search.params.value_type;
-   m_Table->setColumnCount(3 + m_Search.passes);
-   m_Table->setRowCount(0);
-
-   for (i = 0; i < m_Search.result_count; i++)
+   for (i = first; i < m_Search.result_count; i++)
    {
       m_Table->insertRow(i);
 
-      snprintf(temp_string, 256, "%08X", m_Search.results[i].address_initial);
+      snprintf(temp_string, sizeof(temp_string), "%08X", m_Search.results[i].address_initial);
       m_Table->setItem(i, m_ColAddress, new QTableWidgetItem(QString(temp_string)));
 
       for (j = 0; j < m_Search.passes; j++)
       {
-         snprintf(temp_string, 256, "%02X", m_Search.results[i].offsets[j]);
+         snprintf(temp_string, sizeof(temp_string), "%02X", m_Search.results[i].offsets[j]);
          m_Table->setItem(i, j + 1, new QTableWidgetItem(QString(temp_string)));
       }
 
@@ -163,9 +337,19 @@ void CleResultTablePointer::rebuild()
    }
 }
 
+void CleResultTablePointer::rebuild()
+{
+   if (!m_Ready)
+      return;
+   m_Table->setColumnCount(3 + m_Search.passes);
+   m_Table->setRowCount(0);
+   appendRows(0);
+}
+
 void CleResultTablePointer::reset(uint8_t value_type)
 {
-   cl_pointersearch_free(&m_Search);
+   if (m_Ready)
+      cl_pointersearch_free(&m_Search);
 }
 
 void CleResultTablePointer::run()
@@ -175,6 +359,9 @@ void CleResultTablePointer::run()
    uint8_t  val_type;
    uint32_t address, value_curr, value_prev, i;
 
+   /* Results are still being searched for on another thread */
+   if (!m_Ready)
+      return;
    val_type = m_Search.params.value_type;
 
    /* The C code updates all of the pointer results */
@@ -217,27 +404,35 @@ void CleResultTablePointer::run()
 
 bool CleResultTablePointer::step(const QString& text)
 {
-   void *compare_value;
-   bool  no_input = text.isEmpty();
-   bool  ok = true;
+   bool no_input = text.isEmpty();
+   bool ok = true;
 
+   if (!m_Ready)
+      return false;
    if (m_Search.params.value_type == CL_MEMTYPE_FLOAT)
-      compare_value = new float(text.toFloat(&ok));
-   else
-      compare_value = new uint32_t(stringToValue(text, &ok));
-
-   /* Run the C code for doing the actual search */
-   if (ok || no_input)
-      cl_pointersearch_step
-      (
-         &m_Search,
-         no_input ? NULL : compare_value
-      );
+      m_StepValue.f = text.toFloat(&ok);
    else
+      m_StepValue.u = stringToValue(text, &ok);
+   if (!ok && !no_input)
       return false;
 
-   free(compare_value);
-   rebuild();
+   /* The first step compares every chain, so show its progress. The core
+      is paused until it finishes, so every chain is compared against memory
+      from the same frame. */
+   if (m_Search.streaming)
+   {
+      cl_fe_pause();
+      m_Stepping = true;
+      startSearchThread(new ClePointerSearchThread(&m_Search,
+         no_input ? NULL : &m_StepValue), tr("Comparing pointer chains..."),
+         this);
+   }
+   else
+   {
+      /* Run the C code for doing the actual search */
+      cl_pointersearch_step(&m_Search, no_input ? NULL : &m_StepValue);
+      rebuild();
+   }
 
    return true;
 }
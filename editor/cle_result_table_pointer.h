@@ -1,6 +1,11 @@
 #ifndef CLE_RESULT_TABLE_POINTER_H
 #define CLE_RESULT_TABLE_POINTER_H
 
+#include <QAtomicInt>
+#include <QProgressDialog>
+#include <QThread>
+#include <QTimer>
+
 #include "cle_result_table.h"
 
 class CleResultTablePointer : public CleResultTable
@@ -9,12 +14,19 @@ class CleResultTablePointer : public CleResultTable
 
 public:
    CleResultTablePointer(QWidget *parent, uint32_t address, uint8_t size, 
-      uint8_t passes, uint32_t range, uint32_t max_results);
+      uint8_t passes, uint32_t range, uint32_t page_size);
    ~CleResultTablePointer();
 
    cl_addr_t getClickedResultAddress() override;
    void* getSearchData() override;
    bool isInitted() { return true; }
+
+   /*
+      Called by the C code from its search threads. Stores the progress for
+      the dialog to pick up, and returns FALSE once it is cancelled.
+   */
+   static bool onSearchProgress(void *data, unsigned pass, uint32_t done,
+      uint32_t total);
    void rebuild() override;
    void reset(uint8_t value_type) override;
    void run() override;
@@ -40,6 +52,12 @@ public slots:
    void onResultEdited(QTableWidgetItem *item) override;
    void onResultRightClick(const QPoint&) override;
 
+private slots:
+   void onScrollResults(int value);
+   void onSearchCancelled();
+   void onSearchFinished();
+   void onSearchProgressTimer();
+
 signals:
    void addressChanged(cl_addr_t address);
    void requestAddMemoryNote(cl_memnote_t note);
@@ -50,6 +68,43 @@ private:
    uint8_t m_ColValuePrev;
    uint8_t m_ColValueCurr;
    cl_pointersearch_t m_Search;
+
+   /*
+      Adds table rows for the results from "first" onward.
+   */
+   void appendRows(uint32_t first);
+
+   /*
+      Runs part of the search on another thread, showing a dialog with its
+      progress until it finishes. Results are not shown until then.
+   */
+   void startSearchThread(QThread *thread, const QString& label,
+      QWidget *parent);
+
+   /* The initial search and the first step run on their own thread, with a
+      dialog showing them */
+   QThread         *m_SearchThread;
+   QProgressDialog *m_ProgressDialog;
+   QTimer          *m_ProgressTimer;
+   QAtomicInt       m_ProgressPass;
+   QAtomicInt       m_ProgressDone;
+   QAtomicInt       m_ProgressTotal;
+   QAtomicInt       m_Cancelled;
+   uint32_t         m_PageSize;
+
+   /* The value compared to by a step, which may run on another thread */
+   union
+   {
+      float    f;
+      uint32_t u;
+   } m_StepValue;
+
+   /* Whether the search thread has finished and results can be shown */
+   bool m_Ready;
+
+   /* Whether the search thread is running the first step, with the core
+      paused until it finishes */
+   bool m_Stepping;
 };
 
 #endif